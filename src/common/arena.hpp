@@ -0,0 +1,136 @@
+#ifndef __ARENA_HPP__
+#define __ARENA_HPP__
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "utils.hpp"
+
+
+/** Alignment of every arena allocation; one cache line. */
+#define ARENA_ALIGN 64
+/** Smallest block an arena allocates. */
+#define ARENA_MIN_BLOCK (1 << 20)
+
+
+/**
+ *
+ * Bump allocator for short-lived buffers. Allocations are carved out of
+ * large blocks and never freed one by one; reset() releases all of them at
+ * once. If a round outgrew the first block, reset() replaces the blocks with
+ * a single one of their combined size, so a steady workload settles on one
+ * block and stops allocating.
+ *
+ */
+class Arena {
+public:
+    Arena() : used(0), total(0) {}
+    ~Arena() { release(); }
+
+    void *alloc(size_t bytes) {
+        bytes = (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+        if (blocks.empty() || used + bytes > blocks.back().size) {
+            grow(bytes);
+        }
+        char *ptr = blocks.back().base + used;
+        used += bytes;
+        return ptr;
+    }
+
+    bool owns(const void *ptr) const {
+        for (const Block &b : blocks) {
+            if ((const char *)ptr >= b.base && (const char *)ptr < b.base + b.size) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void reset() {
+        if (blocks.size() > 1) {
+            size_t size = total;
+            release();
+            grow(size);
+        }
+        used = 0;
+    }
+
+    // Arena the calling thread's Matrix temporaries come from, or NULL for
+    // the heap. Set it with an ArenaScope.
+    static Arena *&current() {
+        static thread_local Arena *arena = NULL;
+        return arena;
+    }
+
+private:
+    struct Block {
+        char *base;
+        size_t size;
+    };
+
+    void grow(size_t bytes) {
+        Block b;
+        b.size = std::max(bytes, std::max((size_t)ARENA_MIN_BLOCK, total));
+        void *base = NULL;
+        if (posix_memalign(&base, ARENA_ALIGN, b.size) != 0) {
+            throw std::bad_alloc();
+        }
+        b.base = (char *)base;
+        blocks.push_back(b);
+        total += b.size;
+        used = 0;
+    }
+
+    void release() {
+        for (Block &b : blocks) {
+            ::free(b.base);
+        }
+        blocks.clear();
+        total = 0;
+        used = 0;
+    }
+
+    std::vector<Block> blocks;
+    size_t used;        // bytes handed out of the last block
+    size_t total;       // bytes over all blocks
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+};
+
+/**
+ *
+ * Routes the calling thread's Matrix temporaries to an arena (or back to the
+ * heap, with NULL) until the scope ends.
+ *
+ */
+class ArenaScope {
+public:
+    ArenaScope(Arena *arena) : prev(Arena::current()) { Arena::current() = arena; }
+    ~ArenaScope() { Arena::current() = prev; }
+
+private:
+    Arena *prev;
+};
+
+/** Allocate / free feature data from the current arena, if any. */
+inline FeatType *newFeats(size_t cnt) {
+    Arena *arena = Arena::current();
+    if (arena) {
+        return (FeatType *)arena->alloc(sizeof(FeatType) * cnt);
+    }
+    return new FeatType[cnt];
+}
+
+inline void deleteFeats(FeatType *data) {
+    Arena *arena = Arena::current();
+    if (arena && arena->owns(data)) {
+        return;
+    }
+    delete[] data;
+}
+
+
+#endif // __ARENA_HPP__
@@ -50,7 +50,7 @@ void Matrix::setData(FeatType *_data) { data = _data; }
 
 void Matrix::free() {
     if (data) {
-        delete[] data;
+        deleteFeats(data);
         data = NULL;
     }
 }
@@ -59,7 +59,7 @@ bool Matrix::empty() { return rows == 0 || cols == 0; }
 
 
 Matrix Matrix::operator*(float rhs) {
-    FeatType* result = new FeatType[getNumElemts()];
+    FeatType* result = newFeats(getNumElemts());
 
     for (unsigned ui = 0; ui < getNumElemts(); ++ui) {
         result[ui] = data[ui] * rhs;
@@ -69,7 +69,7 @@ Matrix Matrix::operator*(float rhs) {
 }
 
 Matrix operator*(float lhs, Matrix& rhs) {
-    FeatType* result = new FeatType[rhs.getNumElemts()];
+    FeatType* result = newFeats(rhs.getNumElemts());
 
     FeatType* rhsData = rhs.getData();
     for (unsigned ui = 0; ui < rhs.getNumElemts(); ++ui) {
@@ -86,7 +86,7 @@ void Matrix::operator*=(float rhs) {
 }
 
 Matrix Matrix::operator/(float rhs) {
-    FeatType* result = new FeatType[getNumElemts()];
+    FeatType* result = newFeats(getNumElemts());
 
     for (unsigned ui = 0; ui < getNumElemts(); ++ui) {
         result[ui] = data[ui] / rhs;
@@ -104,7 +104,7 @@ void Matrix::operator/=(float rhs) {
 
 // Addition by float
 Matrix Matrix::operator+(float rhs) {
-    FeatType* result = new FeatType[getNumElemts()];
+    FeatType* result = newFeats(getNumElemts());
 
     for (unsigned ui = 0; ui < getNumElemts(); ++ui) {
         result[ui] = data[ui] + rhs;
@@ -114,7 +114,7 @@ Matrix Matrix::operator+(float rhs) {
 }
 
 Matrix operator+(float lhs, Matrix& rhs) {
-    FeatType* result = new FeatType[rhs.getNumElemts()];
+    FeatType* result = newFeats(rhs.getNumElemts());
 
     FeatType* rhsData = rhs.getData();
     for (unsigned ui = 0; ui < rhs.getNumElemts(); ++ui) {
@@ -131,7 +131,7 @@ void Matrix::operator+=(float rhs) {
 }
 
 Matrix Matrix::operator-(float rhs) {
-    FeatType* result = new FeatType[getNumElemts()];
+    FeatType* result = newFeats(getNumElemts());
 
     for (unsigned ui = 0; ui < getNumElemts(); ++ui) {
         result[ui] = data[ui] - rhs;
@@ -148,7 +148,7 @@ void Matrix::operator-=(float rhs) {
 }
 
 Matrix Matrix::operator^(float rhs) {
-    FeatType* result = new FeatType[getNumElemts()];
+    FeatType* result = newFeats(getNumElemts());
 
     for (unsigned ui = 0; ui < getNumElemts(); ++ui) {
         result[ui] = std::pow(data[ui], rhs);
@@ -168,7 +168,7 @@ Matrix Matrix::operator*(Matrix& M) {
     assert(rows == M.getRows());
     assert(cols == M.getCols());
 
-    FeatType* result = new FeatType[rows * cols];
+    FeatType* result = newFeats(rows * cols);
 
     FeatType* MData = M.getData();
     for (unsigned ui = 0; ui < getNumElemts(); ++ui) {
@@ -182,7 +182,7 @@ Matrix Matrix::operator/(Matrix& M) {
     assert(rows == M.getRows());
     assert(cols == M.getCols());
 
-    FeatType* result = new FeatType[rows * cols];
+    FeatType* result = newFeats(rows * cols);
 
     FeatType* MData = M.getData();
     for (unsigned ui = 0; ui < getNumElemts(); ++ui) {
@@ -196,7 +196,7 @@ Matrix Matrix::operator+(Matrix& M) {
     assert(rows == M.getRows());
     assert(cols == M.getCols());
 
-    FeatType* result = new FeatType[rows * cols];
+    FeatType* result = newFeats(rows * cols);
 
     FeatType* MData = M.getData();
     for (unsigned ui = 0; ui < getNumElemts(); ++ui) {
@@ -210,7 +210,7 @@ Matrix Matrix::operator-(Matrix& M) {
     assert(rows == M.getRows());
     assert(cols == M.getCols());
 
-    FeatType* result = new FeatType[rows * cols];
+    FeatType* result = newFeats(rows * cols);
 
     FeatType* MData = M.getData();
     for (unsigned ui = 0; ui < getNumElemts(); ++ui) {
@@ -275,7 +275,7 @@ Matrix Matrix::dot(Matrix& M, bool transpose1, bool transpose2, float scale) {
         m = getRows(), k = getCols(), n = M.getCols();
         assert(k == M.getRows());
 
-        result = new FeatType[m * n];
+        result = newFeats(m * n);
         cblas_sgemm(CblasRowMajor, cblasTrans1, cblasTrans2, m, n, k, scale,
                     getData(), k, M.getData(), n, 0.0, result, n);
 
@@ -286,7 +286,7 @@ Matrix Matrix::dot(Matrix& M, bool transpose1, bool transpose2, float scale) {
         cblasTrans1 = CblasTrans;
         cblasTrans2 = CblasTrans;
 
-        result = new FeatType[m * n];
+        result = newFeats(m * n);
         cblas_sgemm(CblasRowMajor, cblasTrans1, cblasTrans2, m, n, k, scale,
                     getData(), m, M.getData(), k, 0.0, result, n);
 
@@ -296,7 +296,7 @@ Matrix Matrix::dot(Matrix& M, bool transpose1, bool transpose2, float scale) {
         assert(k == M.getRows());
         cblasTrans1 = CblasTrans;
 
-        result = new FeatType[m * n];
+        result = newFeats(m * n);
         cblas_sgemm(CblasRowMajor, cblasTrans1, cblasTrans2, m, n, k, scale,
                     getData(), m, M.getData(), n, 0.0, result, n);
 
@@ -306,7 +306,7 @@ Matrix Matrix::dot(Matrix& M, bool transpose1, bool transpose2, float scale) {
         assert(k == M.getCols());
         cblasTrans2 = CblasTrans;
 
-        result = new FeatType[m * n];
+        result = newFeats(m * n);
         cblas_sgemm(CblasRowMajor, cblasTrans1, cblasTrans2, m, n, k, scale,
                     getData(), k, M.getData(), k, 0.0, result, n);
     }
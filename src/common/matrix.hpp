@@ -7,6 +7,7 @@
 
 #include "cblas.h"
 
+#include "arena.hpp"
 #include "utils.hpp"
 
 struct EdgeTensor {
@@ -0,0 +1,249 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include "shm_ring.hpp"
+
+
+#define SHM_RING_MAGIC 0x474e495259524f44ULL  // "DORYRING"
+#define SHM_RING_WRAP (~0ULL)                  // length of a skip to the start
+
+
+static inline unsigned long long
+recordSize(unsigned long long len) {
+    return (sizeof(unsigned long long) + len + 7) & ~7ULL;
+}
+
+
+// The wakeup FIFOs of a ring sit next to its segment.
+static inline std::string
+fifoPath(const std::string &name, const char *what) {
+    return "/dev/shm" + name + what;
+}
+
+static int
+openFifo(const std::string &path, bool make) {
+    if (make) {
+        unlink(path.c_str());
+        if (mkfifo(path.c_str(), 0600) != 0)
+            return -1;
+    }
+    // Read-write, so neither end ever sees the other one hang up.
+    return ::open(path.c_str(), O_RDWR | O_NONBLOCK);
+}
+
+static inline void
+wake(int fd) {
+    char c = 0;
+    ssize_t n = write(fd, &c, 1);   // a full FIFO is already awake
+    (void)n;
+}
+
+static inline void
+drain(int fd) {
+    char buf[64];
+    while (read(fd, buf, sizeof(buf)) > 0);
+}
+
+
+/**
+ *
+ * Create the segment under `name`, replacing any a crashed run left behind.
+ *
+ */
+bool
+ShmRing::create(const std::string &_name, unsigned long long capacity) {
+    name = _name;
+    owner = true;
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+        return false;
+
+    mapSize = sizeof(ShmRingHeader) + capacity;
+    if (ftruncate(fd, mapSize) != 0) {
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    void *ptr = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    hdr = (ShmRingHeader *)ptr;
+    data = (char *)ptr + sizeof(ShmRingHeader);
+    dataFd = openFifo(fifoPath(name, ".data"), true);
+    spaceFd = openFifo(fifoPath(name, ".space"), true);
+    if (dataFd < 0 || spaceFd < 0) {
+        close();
+        return false;
+    }
+    hdr->capacity = capacity;
+    hdr->head = 0;
+    hdr->tail = 0;
+    hdr->producerWaiting = 0;
+    hdr->consumerWaiting = 0;
+    __atomic_store_n(&hdr->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+
+/**
+ *
+ * Map a segment the receiver created; false if it is not there, e.g. the
+ * peer runs in another shared memory namespace.
+ *
+ */
+bool
+ShmRing::open(const std::string &_name) {
+    name = _name;
+    owner = false;
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmRingHeader)) {
+        ::close(fd);
+        return false;
+    }
+    mapSize = st.st_size;
+    void *ptr = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED)
+        return false;
+
+    hdr = (ShmRingHeader *)ptr;
+    data = (char *)ptr + sizeof(ShmRingHeader);
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC ||
+        sizeof(ShmRingHeader) + hdr->capacity != mapSize) {
+        close();
+        return false;
+    }
+    dataFd = openFifo(fifoPath(name, ".data"), false);
+    spaceFd = openFifo(fifoPath(name, ".space"), false);
+    if (dataFd < 0 || spaceFd < 0) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+
+void
+ShmRing::unlink() {
+    if (!owner)
+        return;
+    shm_unlink(name.c_str());
+    ::unlink(fifoPath(name, ".data").c_str());
+    ::unlink(fifoPath(name, ".space").c_str());
+    owner = false;
+}
+
+
+void
+ShmRing::close() {
+    unlink();
+    if (hdr != NULL)
+        munmap(hdr, mapSize);
+    if (dataFd >= 0)
+        ::close(dataFd);
+    if (spaceFd >= 0)
+        ::close(spaceFd);
+    hdr = NULL;
+    data = NULL;
+    dataFd = -1;
+    spaceFd = -1;
+}
+
+
+bool
+ShmRing::push(const void *value, unsigned long long len) {
+    unsigned long long cap = hdr->capacity;
+    unsigned long long head = hdr->head;    // only we write it
+    unsigned long long tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+    unsigned long long off = head % cap;
+    unsigned long long need = recordSize(len);
+    unsigned long long skip = off + need > cap ? cap - off : 0;
+    if (head + skip + need - tail > cap)
+        return false;
+
+    if (skip) {
+        *(unsigned long long *)(data + off) = SHM_RING_WRAP;
+        off = 0;
+    }
+    *(unsigned long long *)(data + off) = len;
+    std::memcpy(data + off + sizeof(unsigned long long), value, len);
+    __atomic_store_n(&hdr->head, head + skip + need, __ATOMIC_RELEASE);
+
+    // Against armWait(): either it sees the message or we see its flag.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&hdr->consumerWaiting, __ATOMIC_RELAXED))
+        wake(dataFd);
+    return true;
+}
+
+
+void
+ShmRing::pushWait(const void *value, unsigned long long len) {
+    if (push(value, len))
+        return;
+
+    // Against pop(): either our push sees the space it frees or it sees
+    // our flag and wakes us.
+    __atomic_store_n(&hdr->producerWaiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (!push(value, len)) {
+        struct pollfd item = { spaceFd, POLLIN, 0 };
+        poll(&item, 1, -1);
+        drain(spaceFd);
+    }
+    __atomic_store_n(&hdr->producerWaiting, 0, __ATOMIC_RELAXED);
+}
+
+
+bool
+ShmRing::pop(zmq::message_t &msg) {
+    unsigned long long cap = hdr->capacity;
+    unsigned long long tail = hdr->tail;    // only we write it
+    unsigned long long head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    if (tail == head)
+        return false;
+
+    unsigned long long off = tail % cap;
+    unsigned long long len = *(unsigned long long *)(data + off);
+    if (len == SHM_RING_WRAP) {
+        tail += cap - off;
+        off = 0;
+        len = *(unsigned long long *)data;
+    }
+    msg.rebuild(len);
+    std::memcpy(msg.data(), data + off + sizeof(unsigned long long), len);
+    __atomic_store_n(&hdr->tail, tail + recordSize(len), __ATOMIC_RELEASE);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&hdr->producerWaiting, __ATOMIC_RELAXED))
+        wake(spaceFd);
+    return true;
+}
+
+
+bool
+ShmRing::armWait() {
+    __atomic_store_n(&hdr->consumerWaiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE) ==
+           __atomic_load_n(&hdr->tail, __ATOMIC_RELAXED);
+}
+
+
+void
+ShmRing::disarmWait() {
+    __atomic_store_n(&hdr->consumerWaiting, 0, __ATOMIC_RELAXED);
+    drain(dataFd);
+}
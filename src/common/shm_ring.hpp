@@ -0,0 +1,84 @@
+#ifndef __SHM_RING_HPP__
+#define __SHM_RING_HPP__
+
+
+#include <cstdio>
+#include <string>
+#include <zmq.hpp>
+
+
+/** Bytes of message data one ring holds. */
+#define SHM_RING_BYTES (8 * 1024 * 1024)
+
+
+/** Start of a ring's shared memory segment, followed by its data area. */
+struct ShmRingHeader {
+    unsigned long long magic;       // set last, once the ring is ready
+    unsigned long long capacity;
+    alignas(64) unsigned long long head;    // bytes ever written
+    unsigned producerWaiting;               // sender blocked on a full ring
+    alignas(64) unsigned long long tail;    // bytes ever read
+    unsigned consumerWaiting;               // receiver blocked on an empty ring
+};
+
+
+/**
+ *
+ * Single-producer single-consumer ring of messages in a POSIX shared memory
+ * segment, between two processes on the same host. The receiver creates and
+ * owns the segment; the sender opens it. Each message is a 8-byte length and
+ * the bytes, padded to 8; one that does not fit before the end of the data
+ * area skips to its start. Callers serialize their own end of the ring.
+ *
+ * A side about to block raises its flag in the header and sleeps on a FIFO
+ * next to the segment; the other side writes a byte to that FIFO when it
+ * sees the flag, so neither end ever has to spin.
+ *
+ */
+class ShmRing {
+
+public:
+    bool create(const std::string &_name, unsigned long long capacity);
+    bool open(const std::string &_name);
+    // Take the names down once the peer has mapped the ring; both ends
+    // keep using it, and nothing is left behind if either one crashes.
+    void unlink();
+    void close();
+
+    // Copy a message in; false if the ring has no room for it right now.
+    bool push(const void *data, unsigned long long len);
+    // Copy a message in, sleeping while the ring is full.
+    void pushWait(const void *data, unsigned long long len);
+    // Copy the oldest message out into msg; false if there is none.
+    bool pop(zmq::message_t &msg);
+
+    // For a consumer about to block: after armWait(), readyFd() turns
+    // readable once a message comes in. armWait() returns false if one
+    // already has; disarmWait() ends the wait either way.
+    bool armWait();
+    void disarmWait();
+    int readyFd() const { return dataFd; }
+    // Largest message push() can ever take.
+    unsigned long long maxMsgSize() const { return hdr->capacity / 2 - 8; }
+
+private:
+    std::string name;
+    bool owner = false;     // and the names are still up
+    int dataFd = -1;    // a byte per wakeup of a waiting consumer
+    int spaceFd = -1;   // a byte per wakeup of a waiting producer
+    ShmRingHeader *hdr = NULL;
+    char *data = NULL;
+    unsigned long long mapSize = 0;
+};
+
+
+/** Ring a graph server pulls weights through from a weight server on its host. */
+static inline std::string
+weightRingName(unsigned weightPort, unsigned nodeId) {
+    char name[64];
+    sprintf(name, "/dorylus.w.%u.%u", weightPort, nodeId);
+    return name;
+}
+
+
+#endif //__SHM_RING_HPP__
@@ -40,7 +40,8 @@ enum OP {
     REQ_EDG_BACKWARD, PUSH_EDG_BACKWARD, PULL_EDG_BACKWARD,
     PULL_EDG_EVAL, PUSH_EDG_EVAL,
     PUSH, PULL, PULLE, PUSHE, PULLEINFO, FIN, EVAL,
-    RESP, INFO, TERM
+    RESP, INFO, TERM,
+    PULLSHM     // a PULL whose data may come back through a shared memory ring
 };
 enum TYPE { GRAD, AH, Z, ACT, LAB };
 enum PROP_TYPE { FORWARD, BACKWARD };
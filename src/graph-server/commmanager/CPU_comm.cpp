@@ -11,7 +11,8 @@ CPUComm::CPUComm(Engine *engine_)
 {
     loadWeightServers(weightServerAddrs, wServersFile);
     msgService.setUpWeightSocket(
-        weightServerAddrs.at(nodeId % weightServerAddrs.size()));
+        weightServerAddrs.at(nodeId % weightServerAddrs.size()),
+        engine_->commManager.getShmData());
     for (char *addr : weightServerAddrs) {
         free(addr);
     }
@@ -20,194 +21,272 @@ CPUComm::CPUComm(Engine *engine_)
 }
 
 void CPUComm::NNCompute(Chunk &chunk) {
+    // Temporaries come from this thread's arena. Results are copied out into
+    // savedNNTensors, so it is rewound for every chunk.
+    static thread_local Arena arena;
+    arena.reset();
+    ArenaScope scope(&arena);
+
     unsigned layer = chunk.layer;
     if (chunk.vertex) {
         if (chunk.dir == PROP_TYPE::FORWARD) {
             // printLog(nodeId, "CPU FORWARD vtx NN started");
-            vtxNNForward(layer, layer == (totalLayers - 1));
+            vtxNNForward(chunk, layer == (totalLayers - 1));
         } else {
             // printLog(nodeId, "CPU BACKWARD vtx NN started");
-            vtxNNBackward(layer);
+            vtxNNBackward(chunk);
         }
     } else {
         layer--; // YIFAN: fix this
         if (chunk.dir == PROP_TYPE::FORWARD) {
             // printLog(nodeId, "CPU FORWARD edg NN started");
-            edgNNForward(layer, layer == (totalLayers - 1));
+            edgNNForward(chunk, layer, layer == (totalLayers - 1));
         } else {
             // printLog(nodeId, "CPU BACKWARD edg NN started");
-            edgNNBackward(layer);
+            edgNNBackward(chunk, layer);
         }
     }
     // printLog(nodeId, "CPU NN Done");
     NNRecvCallback(engine, chunk);
 }
 
-void CPUComm::vtxNNForward(unsigned layer, bool lastLayer) {
+void CPUComm::vtxNNForward(Chunk &chunk, bool lastLayer) {
     switch (gnn_type) {
         case GNN::GCN:
-            vtxNNForwardGCN(layer, lastLayer);
+            vtxNNForwardGCN(chunk, lastLayer);
             break;
         case GNN::GAT:
-            vtxNNForwardGAT(layer, lastLayer);
+            vtxNNForwardGAT(chunk, lastLayer);
             break;
         default:
             abort();
     }
 }
 
-void CPUComm::vtxNNBackward(unsigned layer) {
+void CPUComm::vtxNNBackward(Chunk &chunk) {
     switch (gnn_type) {
         case GNN::GCN:
-            vtxNNBackwardGCN(layer);
+            vtxNNBackwardGCN(chunk);
             break;
         case GNN::GAT:
-            vtxNNBackwardGAT(layer);
+            vtxNNBackwardGAT(chunk);
             break;
         default:
             abort();
     }
 }
 
-void CPUComm::edgNNForward(unsigned layer, bool lastLayer) {
+void CPUComm::edgNNForward(Chunk &chunk, unsigned layer, bool lastLayer) {
     switch (gnn_type) {
         case GNN::GCN:
-            edgNNForwardGCN(layer, lastLayer);
+            edgNNForwardGCN(chunk, layer, lastLayer);
             break;
         case GNN::GAT:
-            edgNNForwardGAT(layer, lastLayer);
+            edgNNForwardGAT(chunk, layer, lastLayer);
             break;
         default:
             abort();
     }
 }
 
-void CPUComm::edgNNBackward(unsigned layer) {
+void CPUComm::edgNNBackward(Chunk &chunk, unsigned layer) {
     switch (gnn_type) {
         case GNN::GCN:
-            edgNNBackwardGCN(layer);
+            edgNNBackwardGCN(chunk, layer);
             break;
         case GNN::GAT:
-            edgNNBackwardGAT(layer);
+            edgNNBackwardGAT(chunk, layer);
             break;
         default:
             abort();
     }
 }
 
-void CPUComm::vtxNNForwardGCN(unsigned layer, bool lastLayer) {
-    Matrix feats = savedNNTensors[layer]["ah"];
+// Rows [lowBound, upBound) of a vertex tensor, in place.
+static Matrix chunkRows(Matrix &mat, Chunk &chunk) {
+    return Matrix(chunk.upBound - chunk.lowBound, mat.getCols(),
+                  mat.get(chunk.lowBound));
+}
+
+// Weight gradients are summed over all chunks by the weight server, so each
+// chunk sends its own partial sum. They are sent and freed by the message
+// service, so they are kept off the arena.
+static Matrix weightGrad(Matrix &in, Matrix &outGrad) {
+    ArenaScope heap(NULL);
+    return in.dot(outGrad, true, false);
+}
+
+// The next epoch's weights are fetched once every chunk is done with them.
+// Workers may finish chunks at once, so exactly one sees the last of them.
+void CPUComm::chunkBackwardDone() {
+    unsigned due = engine->numLambdasForward;
+    if (__sync_add_and_fetch(&bwdChunksDone, 1) == due) {
+        __sync_fetch_and_sub(&bwdChunksDone, due);
+        msgService.prefetchWeightsMatrix();
+    }
+}
+
+void CPUComm::vtxNNForwardGCN(Chunk &chunk, bool lastLayer) {
+    unsigned layer = chunk.layer;
+    // A transform-first layer aggregated H·W, so its "ah" already holds z.
+    bool transFirst = engine->transformFirst[layer];
+    Matrix feats = chunkRows(savedNNTensors[layer]["ah"], chunk);
     Matrix weight = msgService.getWeightMatrix(layer);
-    Matrix z = feats.dot(weight);
+    Matrix z = transFirst ? feats : feats.dot(weight);
     if (!lastLayer) {
-        memcpy(savedNNTensors[layer]["z"].getData(), z.getData(), z.getDataSize());
+        if (!transFirst) {
+            memcpy(savedNNTensors[layer]["z"].get(chunk.lowBound),
+                   z.getData(), z.getDataSize());
+        }
         Matrix act_z = activate(z);  // z data get activated ...
-        memcpy(savedNNTensors[layer]["h"].getData(), act_z.getData(),
+        memcpy(savedNNTensors[layer]["h"].get(chunk.lowBound), act_z.getData(),
                act_z.getDataSize());
+        // The next layer transforms first, so H·W is scattered instead of H.
+        if (engine->transformFirst[layer + 1]) {
+            Matrix nextWeight = msgService.getWeightMatrix(layer + 1);
+            Matrix hw = act_z.dot(nextWeight);
+            memcpy(savedNNTensors[layer]["hw"].get(chunk.lowBound),
+                   hw.getData(), hw.getDataSize());
+            deleteMatrix(hw);
+        }
         deleteMatrix(act_z);
     } else {
         Matrix predictions = softmax(z);
-        Matrix labels = savedNNTensors[layer]["lab"];
+        Matrix labels = chunkRows(savedNNTensors[layer]["lab"], chunk);
 
         float acc, loss;
         getTrainStat(predictions, labels, acc, loss);
         unsigned valsetSize = (unsigned)(predictions.getRows() * VAL_PORTION);
-        msgService.sendAccloss(acc, loss, predictions.getRows());
+        msgService.sendAccloss(acc, loss, chunk);
         printLog(nodeId, "batch Acc: %f, Loss: %f", acc / valsetSize, loss / valsetSize);
 
         maskout(predictions, labels);
 
         Matrix d_output = hadamardSub(predictions, labels);
         d_output /= engine->graph.globalVtxCnt * TRAIN_PORTION; // Averaging init backward gradient
-        Matrix weight = msgService.getWeightMatrix(layer);
-        Matrix interGrad = d_output.dot(weight, false, true);
-        memcpy(savedNNTensors[layer]["grad"].getData(), interGrad.getData(),
-               interGrad.getDataSize());
+        if (transFirst) {
+            // dL/dz is scattered as is; the layer below applies W^T and
+            // computes this layer's weight gradient.
+            memcpy(savedNNTensors[layer]["grad"].get(chunk.lowBound),
+                   d_output.getData(), d_output.getDataSize());
+        } else {
+            Matrix interGrad = d_output.dot(weight, false, true);
+            memcpy(savedNNTensors[layer]["grad"].get(chunk.lowBound),
+                   interGrad.getData(), interGrad.getDataSize());
 
-        Matrix ah = savedNNTensors[layer]["ah"];
-        Matrix weightUpdates = ah.dot(d_output, true, false);
-        msgService.sendWeightUpdate(weightUpdates, layer);
-        deleteMatrix(interGrad);
+            Matrix weightUpdates = weightGrad(feats, d_output);
+            msgService.sendWeightUpdate(weightUpdates, layer);
+            deleteMatrix(interGrad);
+        }
         deleteMatrix(d_output);
         deleteMatrix(predictions);
     }
-    deleteMatrix(z);
+    if (!transFirst) deleteMatrix(z);
 }
 
-void CPUComm::vtxNNBackwardGCN(unsigned layer) {
+void CPUComm::vtxNNBackwardGCN(Chunk &chunk) {
+    unsigned layer = chunk.layer;
+    bool transFirst = engine->transformFirst[layer];
     Matrix weight = msgService.getWeightMatrix(layer);
-    Matrix grad = savedNNTensors[layer]["aTg"];
-    Matrix z = savedNNTensors[layer]["z"];
+    Matrix grad = chunkRows(savedNNTensors[layer]["aTg"], chunk);
+    // The layer above transformed first and its aggregate is A^T·dL/dz. Its
+    // weight gradient is H^T·(A^T·dL/dz), and dL/dH is that times W^T.
+    bool aboveTransFirst = layer + 1 < totalLayers &&
+                           engine->transformFirst[layer + 1];
+    if (aboveTransFirst) {
+        Matrix h = chunkRows(savedNNTensors[layer]["h"], chunk);
+        Matrix aboveWeightUpdates = weightGrad(h, grad);
+        msgService.sendWeightUpdate(aboveWeightUpdates, layer + 1);
+        Matrix aboveWeight = msgService.getWeightMatrix(layer + 1);
+        grad = grad.dot(aboveWeight, false, true);
+    }
+    Matrix z = chunkRows(savedNNTensors[layer][transFirst ? "ah" : "z"], chunk);
 
     Matrix actDeriv = activateDerivative(z);
     Matrix interGrad = grad * actDeriv;
 
-    Matrix ah = savedNNTensors[layer]["ah"];
-    Matrix weightUpdates = ah.dot(interGrad, true, false);
-    msgService.sendWeightUpdate(weightUpdates, layer);
-    if (layer != 0) {
-        Matrix resultGrad = interGrad.dot(weight, false, true);
-        memcpy(savedNNTensors[layer]["grad"].getData(), resultGrad.getData(),
-               resultGrad.getDataSize());
-        deleteMatrix(resultGrad);
+    if (transFirst) {
+        // Scattered as dL/dz, see vtxNNForwardGCN
+        memcpy(savedNNTensors[layer]["grad"].get(chunk.lowBound),
+               interGrad.getData(), interGrad.getDataSize());
+    } else {
+        Matrix ah = chunkRows(savedNNTensors[layer]["ah"], chunk);
+        Matrix weightUpdates = weightGrad(ah, interGrad);
+        msgService.sendWeightUpdate(weightUpdates, layer);
+        if (layer != 0) {
+            Matrix resultGrad = interGrad.dot(weight, false, true);
+            memcpy(savedNNTensors[layer]["grad"].get(chunk.lowBound),
+                   resultGrad.getData(), resultGrad.getDataSize());
+            deleteMatrix(resultGrad);
+        }
     }
 
+    if (aboveTransFirst) deleteMatrix(grad);
     deleteMatrix(actDeriv);
     deleteMatrix(interGrad);
 
-    if (layer == 0) msgService.prefetchWeightsMatrix();
+    if (layer == 0) chunkBackwardDone();
 }
 
-void CPUComm::vtxNNForwardGAT(unsigned layer, bool lastLayer) {
+void CPUComm::vtxNNForwardGAT(Chunk &chunk, bool lastLayer) {
+    unsigned layer = chunk.layer;
     Matrix feats = layer == 0
-                 ? savedNNTensors[layer]["h"]
-                 : savedNNTensors[layer - 1]["ah"];
+                 ? chunkRows(savedNNTensors[layer]["h"], chunk)
+                 : chunkRows(savedNNTensors[layer - 1]["ah"], chunk);
     Matrix weight = msgService.getWeightMatrix(layer);
     Matrix z = feats.dot(weight);
-    memcpy(savedNNTensors[layer]["z"].getData(), z.getData(), z.getDataSize());
+    memcpy(savedNNTensors[layer]["z"].get(chunk.lowBound), z.getData(),
+           z.getDataSize());
     deleteMatrix(z);
 }
 
-void CPUComm::vtxNNBackwardGAT(unsigned layer) {
+void CPUComm::vtxNNBackwardGAT(Chunk &chunk) {
+    unsigned layer = chunk.layer;
     Matrix weight = msgService.getWeightMatrix(layer);
-    Matrix grad = savedNNTensors[layer]["aTg"];
+    Matrix grad = chunkRows(savedNNTensors[layer]["aTg"], chunk);
     Matrix h = layer == 0
-             ? savedNNTensors[layer]["h"]
-             : savedNNTensors[layer - 1]["ah"];
+             ? chunkRows(savedNNTensors[layer]["h"], chunk)
+             : chunkRows(savedNNTensors[layer - 1]["ah"], chunk);
 
-    Matrix weightUpdates = h.dot(grad, true, false);
+    Matrix weightUpdates = weightGrad(h, grad);
     msgService.sendWeightUpdate(weightUpdates, layer);
 
     if (layer != 0) {
         Matrix resultGrad = grad.dot(weight, false, true);
-        memcpy(savedNNTensors[layer - 1]["grad"].getData(), resultGrad.getData(),
-               resultGrad.getDataSize());
+        memcpy(savedNNTensors[layer - 1]["grad"].get(chunk.lowBound),
+               resultGrad.getData(), resultGrad.getDataSize());
         resultGrad.free();
     }
-    if (layer == 0) msgService.prefetchWeightsMatrix();
+    if (layer == 0) chunkBackwardDone();
 }
 
-void CPUComm::edgNNForwardGAT(unsigned layer, bool lastLayer) {
+void CPUComm::edgNNForwardGAT(Chunk &chunk, unsigned layer, bool lastLayer) {
     Matrix a = msgService.getaMatrix(layer); // YIFAN: fix this
     unsigned featLayer = layer; // YIFAN: fix this
     Matrix z = savedNNTensors[featLayer]["z"];
+    CSCMatrix<EdgeType> &forwardAdj = engine->graph.forwardAdj;
+    // The chunk's vertices own the edges of their CSC columns.
+    unsigned long long edgStt = forwardAdj.columnPtrs[chunk.lowBound];
 
     // expand and dot
-    Matrix zaTensor = expandDot(z, a, engine->graph.forwardAdj);
-    memcpy(savedNNTensors[featLayer]["az"].getData(), zaTensor.getData(), zaTensor.getDataSize());
+    Matrix zaTensor = expandDot(z, a, forwardAdj, chunk.lowBound, chunk.upBound);
+    memcpy(savedNNTensors[featLayer]["az"].get(edgStt), zaTensor.getData(), zaTensor.getDataSize());
     Matrix outputTensor = leakyRelu(zaTensor);
     zaTensor.free();
 
-    memcpy(savedNNTensors[featLayer]["A"].getData(), outputTensor.getData(), outputTensor.getDataSize());
+    memcpy(savedNNTensors[featLayer]["A"].get(edgStt), outputTensor.getData(), outputTensor.getDataSize());
     outputTensor.free();
 }
 
-void CPUComm::edgNNBackwardGAT(unsigned layer) {
+void CPUComm::edgNNBackwardGAT(Chunk &chunk, unsigned layer) {
     Matrix a = msgService.getaMatrix(layer);
     unsigned featLayer = layer;
+    CSCMatrix<EdgeType> &forwardAdj = engine->graph.forwardAdj;
+    unsigned long long edgStt = forwardAdj.columnPtrs[chunk.lowBound];
+    unsigned long long edgEnd = forwardAdj.columnPtrs[chunk.upBound];
     Matrix gradTensor = savedNNTensors[featLayer]["grad"];
-    Matrix zaTensor = savedNNTensors[featLayer]["az"];
-    Matrix localZTensor = savedNNTensors[featLayer]["z"]; // serve as Z_dst, and part of Z_src
+    Matrix zaTensor(edgEnd - edgStt, 1, savedNNTensors[featLayer]["az"].get(edgStt));
+    Matrix localZTensor = chunkRows(savedNNTensors[featLayer]["z"], chunk); // serve as Z_dst, and part of Z_src
     // Matrix ghostZTensor = savedNNTensors[featLayer]["fg_z"]; // serve as part of Z_src
     // FeatType **fedge = engine->savedEdgeTensors[featLayer]["fedge"]; // This serves the purpose of Z_src and Z_dst
     // unsigned edgCnt = engine->graph.forwardAdj.nnz;
@@ -217,12 +296,13 @@ void CPUComm::edgNNBackwardGAT(unsigned layer) {
     Matrix dLRelu = leakyReluBackward(zaTensor);
     // expand dP to (|E|, featDim) and element-wise multiply dLRelu
     // Shape of dAct is (|E|, featDim)
-    Matrix dAct = expandHadamardMul(gradTensor, dLRelu, engine->graph.forwardAdj);
+    Matrix dAct = expandHadamardMul(gradTensor, dLRelu, forwardAdj,
+                                    chunk.lowBound, chunk.upBound);
     dLRelu.free();
 
     // Shape of dA: (|E|, 1), serve as gradient of each edge for backward agg
     Matrix dA = dAct.dot(a);
-    memcpy(savedNNTensors[featLayer]["dA"].getData(), dA.getData(), dA.getDataSize());
+    memcpy(savedNNTensors[featLayer]["dA"].get(edgStt), dA.getData(), dA.getDataSize());
     dA.free();
 
     // reduce dAct(|E|, featDim) to (1, featDim)
@@ -234,7 +314,11 @@ void CPUComm::edgNNBackwardGAT(unsigned layer) {
     // Matrix zz = expandMulZZ(fedge, edgCnt, featDim);
     Matrix zz = localZTensor.dot(localZTensor, true, false);
     // (1, featDim) \dot (featDim, featDim) -> (1, featDim), which is da's shape
-    Matrix da = zz.dot(dAct_reduce, false, true);
+    Matrix da;
+    {   // sent and freed by the message service, so off the heap
+        ArenaScope heap(NULL);
+        da = zz.dot(dAct_reduce, false, true);
+    }
     dAct_reduce.free();
     zz.free();
     msgService.sendaUpdate(da, layer);
@@ -263,7 +347,7 @@ void loadWeightServers(std::vector<char *> &addresses,
 }
 
 Matrix activate(Matrix &mat) {
-    FeatType *activationData = new FeatType[mat.getNumElemts()];
+    FeatType *activationData = newFeats(mat.getNumElemts());
     FeatType *zData = mat.getData();
 
 #pragma omp parallel for
@@ -274,7 +358,7 @@ Matrix activate(Matrix &mat) {
 }
 
 Matrix softmax(Matrix &mat) {
-    FeatType *result = new FeatType[mat.getNumElemts()];
+    FeatType *result = newFeats(mat.getNumElemts());
 
 #pragma omp parallel for
     for (unsigned r = 0; r < mat.getRows(); ++r) {
@@ -296,21 +380,25 @@ Matrix softmax(Matrix &mat) {
     return Matrix(mat.getRows(), mat.getCols(), result);
 }
 
-Matrix expandDot(Matrix &m, Matrix &v, CSCMatrix<EdgeType> &forwardAdj) {
-    FeatType *outputData = new FeatType[forwardAdj.nnz];
-    Matrix outputTensor(forwardAdj.nnz, 1, outputData);
+// Edge outputs below cover the CSC columns of vertices [start, end), indexed
+// from the first edge of start.
+Matrix expandDot(Matrix &m, Matrix &v, CSCMatrix<EdgeType> &forwardAdj,
+                 unsigned start, unsigned end) {
+    unsigned long long edgStt = forwardAdj.columnPtrs[start];
+    unsigned edgCnt = forwardAdj.columnPtrs[end] - edgStt;
+    FeatType *outputData = newFeats(edgCnt);
+    Matrix outputTensor(edgCnt, 1, outputData);
     memset(outputData, 0, outputTensor.getDataSize());
 
-    unsigned vtcsCnt = m.getRows();
     unsigned featDim = m.getCols();
     FeatType *vPtr = v.getData();
 #pragma omp parallel for
-    for (unsigned lvid = 0; lvid < vtcsCnt; lvid++) {
+    for (unsigned lvid = start; lvid < end; lvid++) {
         FeatType *mPtr = m.get(lvid);
         for (unsigned long long eid = forwardAdj.columnPtrs[lvid];
             eid < forwardAdj.columnPtrs[lvid + 1]; ++eid) {
             for (unsigned j = 0; j < featDim; ++j) {
-                outputData[eid] += mPtr[j] * vPtr[j];
+                outputData[eid - edgStt] += mPtr[j] * vPtr[j];
             }
         }
     }
@@ -318,24 +406,25 @@ Matrix expandDot(Matrix &m, Matrix &v, CSCMatrix<EdgeType> &forwardAdj) {
     return outputTensor;
 }
 
-Matrix expandHadamardMul(Matrix &m, Matrix &v, CSCMatrix<EdgeType> &forwardAdj) {
-    unsigned vtcsCnt = m.getRows();
+Matrix expandHadamardMul(Matrix &m, Matrix &v, CSCMatrix<EdgeType> &forwardAdj,
+                         unsigned start, unsigned end) {
     unsigned featDim = m.getCols();
-    unsigned edgCnt = forwardAdj.nnz;
+    unsigned long long edgStt = forwardAdj.columnPtrs[start];
+    unsigned edgCnt = forwardAdj.columnPtrs[end] - edgStt;
 
-    FeatType *outputData = new FeatType[edgCnt * featDim];
-    Matrix outputTensor(forwardAdj.nnz, featDim, outputData);
+    FeatType *outputData = newFeats(edgCnt * featDim);
+    Matrix outputTensor(edgCnt, featDim, outputData);
     memset(outputData, 0, outputTensor.getDataSize());
 
     FeatType *vPtr = v.getData();
 #pragma omp parallel for
-    for (unsigned lvid = 0; lvid < vtcsCnt; lvid++) {
+    for (unsigned lvid = start; lvid < end; lvid++) {
         FeatType *mPtr = m.get(lvid);
         for (unsigned long long eid = forwardAdj.columnPtrs[lvid];
             eid < forwardAdj.columnPtrs[lvid + 1]; ++eid) {
-            FeatType normFactor = vPtr[eid];
+            FeatType normFactor = vPtr[eid - edgStt];
             for (unsigned j = 0; j < featDim; ++j) {
-                outputData[eid * featDim + j] = mPtr[j] * normFactor;
+                outputData[(eid - edgStt) * featDim + j] = mPtr[j] * normFactor;
             }
         }
     }
@@ -344,7 +433,7 @@ Matrix expandHadamardMul(Matrix &m, Matrix &v, CSCMatrix<EdgeType> &forwardAdj)
 }
 
 Matrix expandMulZZ(FeatType **eFeats, unsigned edgCnt, unsigned featDim) {
-    FeatType *zzData = new FeatType[featDim * featDim];
+    FeatType *zzData = newFeats(featDim * featDim);
     Matrix zzTensor(featDim, featDim, zzData);
     memset(zzData, 0, zzTensor.getDataSize());
 
@@ -367,8 +456,9 @@ Matrix reduce(Matrix &mat) {
     unsigned edgCnt = mat.getRows();
     unsigned featDim = mat.getCols();
 
-    FeatType *outputData = new FeatType[featDim];
+    FeatType *outputData = newFeats(featDim);
     Matrix outputTensor(1, featDim, outputData);
+    memset(outputData, 0, outputTensor.getDataSize());
 
     FeatType *mPtr = mat.getData();
 #pragma omp parallel for
@@ -383,7 +473,7 @@ Matrix reduce(Matrix &mat) {
 
 Matrix leakyRelu(Matrix &mat) {
     FeatType alpha = 0.01;
-    FeatType *activationData = new FeatType[mat.getNumElemts()];
+    FeatType *activationData = newFeats(mat.getNumElemts());
     FeatType *inputData = mat.getData();
 
 #pragma omp parallel for
@@ -396,7 +486,7 @@ Matrix leakyRelu(Matrix &mat) {
 
 Matrix leakyReluBackward(Matrix &mat) {
     FeatType alpha = 0.01;
-    FeatType *outputData = new FeatType[mat.getNumElemts()];
+    FeatType *outputData = newFeats(mat.getNumElemts());
     FeatType *inputData = mat.getData();
 
 #pragma omp parallel for
@@ -408,7 +498,7 @@ Matrix leakyReluBackward(Matrix &mat) {
 }
 
 Matrix hadamardMul(Matrix &A, Matrix &B) {
-    FeatType *result = new FeatType[A.getRows() * A.getCols()];
+    FeatType *result = newFeats(A.getRows() * A.getCols());
 
     FeatType *AData = A.getData();
     FeatType *BData = B.getData();
@@ -422,7 +512,7 @@ Matrix hadamardMul(Matrix &A, Matrix &B) {
 }
 
 Matrix hadamardSub(Matrix &A, Matrix &B) {
-    FeatType *result = new FeatType[A.getRows() * B.getCols()];
+    FeatType *result = newFeats(A.getRows() * B.getCols());
 
     FeatType *AData = A.getData();
     FeatType *BData = B.getData();
@@ -435,7 +525,7 @@ Matrix hadamardSub(Matrix &A, Matrix &B) {
 }
 
 Matrix activateDerivative(Matrix &mat) {
-    FeatType *res = new FeatType[mat.getNumElemts()];
+    FeatType *res = newFeats(mat.getNumElemts());
     FeatType *zData = mat.getData();
 
 #pragma omp parallel for
@@ -472,7 +562,7 @@ void CPUComm::maskout(Matrix &preds, Matrix &labels) {
 
 void deleteMatrix(Matrix &mat) {
     if (!mat.empty()) {
-        delete[] mat.getData();
+        deleteFeats(mat.getData());
         mat = Matrix();
     }
 }
\ No newline at end of file
@@ -27,11 +27,12 @@ public:
     void prefetchWeights() { msgService.prefetchWeightsMatrix(); };
 
 private:
-    // compute related
-    void vtxNNForward(unsigned layer, bool lastLayer);
-    void vtxNNBackward(unsigned layer);
-    void edgNNForward(unsigned layer, bool lastLayer);
-    void edgNNBackward(unsigned layer);
+    // compute related, on the rows of a chunk
+    void vtxNNForward(Chunk &chunk, bool lastLayer);
+    void vtxNNBackward(Chunk &chunk);
+    void edgNNForward(Chunk &chunk, unsigned layer, bool lastLayer);
+    void edgNNBackward(Chunk &chunk, unsigned layer);
+    void chunkBackwardDone();
 
     void getTrainStat(Matrix &preds, Matrix &labels, float &acc,
                            float &loss);
@@ -40,6 +41,8 @@ private:
     unsigned nodeId;
     unsigned numNodes;
     unsigned numLocalVertices;
+    // chunks through backward layer 0 this epoch
+    unsigned bwdChunksDone = 0;
 
     std::vector<TensorMap> &savedNNTensors;
 
@@ -54,15 +57,15 @@ private:
     MessageService msgService;
 
     // GCN specific
-    void vtxNNForwardGCN(unsigned layer, bool lastLayer);
-    void vtxNNBackwardGCN(unsigned layer);
-    void edgNNForwardGCN(unsigned layer, bool lastLayer) {}
-    void edgNNBackwardGCN(unsigned layer) {}
+    void vtxNNForwardGCN(Chunk &chunk, bool lastLayer);
+    void vtxNNBackwardGCN(Chunk &chunk);
+    void edgNNForwardGCN(Chunk &chunk, unsigned layer, bool lastLayer) {}
+    void edgNNBackwardGCN(Chunk &chunk, unsigned layer) {}
     // GAT specific
-    void vtxNNForwardGAT(unsigned layer, bool lastLayer);
-    void vtxNNBackwardGAT(unsigned layer);
-    void edgNNForwardGAT(unsigned layer, bool lastLayer);
-    void edgNNBackwardGAT(unsigned layer);
+    void vtxNNForwardGAT(Chunk &chunk, bool lastLayer);
+    void vtxNNBackwardGAT(Chunk &chunk);
+    void edgNNForwardGAT(Chunk &chunk, unsigned layer, bool lastLayer);
+    void edgNNBackwardGAT(Chunk &chunk, unsigned layer);
 };
 
 Matrix activateDerivative(Matrix &mat);
@@ -71,8 +74,10 @@ Matrix hadamardSub(Matrix &A, Matrix &B);
 Matrix softmax(Matrix &mat);
 Matrix activate(Matrix &mat);
 // GAT compute utils
-Matrix expandDot(Matrix &m, Matrix &v, CSCMatrix<EdgeType> &forwardAdj);
-Matrix expandHadamardMul(Matrix &m, Matrix &v, CSCMatrix<EdgeType> &forwardAdj);
+Matrix expandDot(Matrix &m, Matrix &v, CSCMatrix<EdgeType> &forwardAdj,
+                 unsigned start, unsigned end);
+Matrix expandHadamardMul(Matrix &m, Matrix &v, CSCMatrix<EdgeType> &forwardAdj,
+                         unsigned start, unsigned end);
 Matrix expandMulZZ(FeatType **edgFeats, unsigned edgCnt, unsigned featDim);
 Matrix reduce(Matrix &mat);
 
@@ -1,4 +1,5 @@
 #include <unistd.h>
+#include <fstream>
 #include "commmanager.hpp"
 
 
@@ -22,31 +23,42 @@ CommManager::init(NodeManager& nodeManager, unsigned ctxThds) {
     // Set data context threads for high scatter bandwidth
     zmq_ctx_set((void *)dataContext, ZMQ_IO_THREADS, ctxThds);
 
-    // Data publisher & subscriber.
-    dataPublisher = new zmq::socket_t(dataContext, ZMQ_PUB);
-    dataPublisher->setsockopt(ZMQ_SNDHWM, 0);       // Set no limit on number of message queueing.
-    dataPublisher->setsockopt(ZMQ_RCVHWM, 0);
+    // Data receiver & send lanes. Credits, not the HWM, bound the queues;
+    // credits still unsent when we close are of no use to anyone.
+    assert(dataLanes <= 256);   // A lane is one byte of the identity.
+    dataReceiver = new zmq::socket_t(dataContext, ZMQ_ROUTER);
+    dataReceiver->setsockopt(ZMQ_SNDHWM, 0);
+    dataReceiver->setsockopt(ZMQ_RCVHWM, 0);
+    dataReceiver->setsockopt(ZMQ_LINGER, 0);
     char hostPort[50];
     sprintf(hostPort, "tcp://%s:%u", me.ip.c_str(), dataPort);
     // printLog(nodeId, "Data port binding to %d", dataPort); 
-    dataPublisher->bind(hostPort);
-
-    dataSubscriber = new zmq::socket_t(dataContext, ZMQ_SUB);
-    dataSubscriber->setsockopt(ZMQ_SNDHWM, 0);
-    dataSubscriber->setsockopt(ZMQ_RCVHWM, 0);
-    char filter[9]; // filter for data subscriber
-    sprintf(filter, "%8X", nodeId);
-    dataSubscriber->setsockopt(ZMQ_SUBSCRIBE, filter, 8);
-    dataSubscriber->setsockopt(ZMQ_SUBSCRIBE, "FFFFFFFF", 8);
+    dataReceiver->bind(hostPort);
+    dataTaken.assign(numNodes * dataLanes, 0);
+
+    dataLanesTo.resize(numNodes);
     for (unsigned i = 0; i < numNodes; ++i) {
+        if (i == nodeId)    // Skip myself.
+            continue;
+
         Node node = nodeManager.getNode(i);
-        char hostPort[50];
         sprintf(hostPort, "tcp://%s:%u", node.ip.c_str(), dataPort);
-        dataSubscriber->connect(hostPort);
+        for (unsigned l = 0; l < dataLanes; ++l) {
+            DataLane *lane = new DataLane;
+            lane->lk.init();
+            lane->sock = new zmq::socket_t(dataContext, ZMQ_DEALER);
+            lane->sock->setsockopt(ZMQ_SNDHWM, 0);
+            lane->sock->setsockopt(ZMQ_RCVHWM, 0);
+            lane->sock->setsockopt(ZMQ_LINGER, 0);
+            // The receiver tells sender and lane apart by the identity.
+            unsigned char identity[3] = { 'D', (unsigned char)nodeId, (unsigned char)l };
+            lane->sock->setsockopt(ZMQ_IDENTITY, identity, sizeof(identity));
+            lane->sock->connect(hostPort);
+            dataLanesTo[i].push_back(lane);
+        }
     }
 
-    lockDataPublisher.init();
-    lockDataSubscriber.init();
+    lockDataReceiver.init();
 
     // Control publishers & subscribers.
     controlPublishers = new zmq::socket_t*[numNodes];
@@ -166,6 +178,8 @@ CommManager::init(NodeManager& nodeManager, unsigned ctxThds) {
 
     flushData();
     flushControl();
+    if (shmData)
+        setupDataRings();
     printLog(nodeId, "CommManager initialization complete.");
 }
 
@@ -183,15 +197,32 @@ CommManager::destroy() {
     flushControl();
     flushData();
 
-    // Data publisher & subscriber.
-    dataPublisher->close();
-    dataSubscriber->close();
+    // Data receiver & send lanes.
+    dataReceiver->close();
+    delete dataReceiver;
+
+    for (std::vector<DataLane *> &lanes : dataLanesTo) {
+        for (DataLane *lane : lanes) {
+            lane->sock->close();
+            delete lane->sock;
+            if (lane->ring != NULL) {
+                lane->ring->close();
+                delete lane->ring;
+            }
+            lane->lk.destroy();
+            delete lane;
+        }
+    }
+    dataLanesTo.clear();
 
-    delete dataPublisher;
-    delete dataSubscriber;
+    for (DataRingIn *in : dataRingsIn) {
+        in->ring.close();
+        in->lk.destroy();
+        delete in;
+    }
+    dataRingsIn.clear();
 
-    lockDataPublisher.destroy();
-    lockDataSubscriber.destroy();
+    lockDataReceiver.destroy();
 
     // Control publishers & subscribers.
     for (unsigned i = 0; i < numNodes; ++i) {
@@ -213,18 +244,35 @@ CommManager::destroy() {
     delete[] lockControlSubscribers;
 }
 
+/**
+ *
+ * Push a data message, header included, to a specific node (cannot be myself).
+ *
+ */
 void
-CommManager::rawMsgPushOut(zmq::message_t &msg) {
+CommManager::rawMsgPushOut(unsigned receiver, zmq::message_t &msg) {
     if (numNodes == 0) return;
 
-    lockDataPublisher.lock();
-    dataPublisher->ksend(msg, ZMQ_DONTWAIT);
-    lockDataPublisher.unlock();
+    sendData(receiver, msg);
 }
 
 /**
  *
- * Push a value on a certain topic to all the nodes (including myself).
+ * Like rawMsgPushOut, but give up instead of waiting for room at the
+ * receiver, leaving msg intact. Lets a receiving thread send without
+ * blocking the messages it should be taking in.
+ *
+ */
+bool
+CommManager::rawMsgTryPushOut(unsigned receiver, zmq::message_t &msg) {
+    if (numNodes == 0) return true;
+
+    return sendData(receiver, msg, false);
+}
+
+/**
+ *
+ * Push a value on a certain topic to a specific node (cannot be myself).
  *
  */
 void
@@ -243,9 +291,7 @@ CommManager::dataPushOut(unsigned receiver, unsigned sender, unsigned topic, voi
     if (valSize > 0)
         memcpy((void *)msgPtr, value, valSize);
 
-    lockDataPublisher.lock();
-    dataPublisher->ksend(outMsg, ZMQ_DONTWAIT);
-    lockDataPublisher.unlock();
+    sendData(receiver, outMsg);
 }
 
 
@@ -259,12 +305,7 @@ CommManager::dataPullIn(unsigned *sender, unsigned *topic, void *value, unsigned
     if (numNodes == 0) return true;
 
     zmq::message_t inMsg;
-
-    lockDataSubscriber.lock();
-    bool ret = dataSubscriber->krecv(&inMsg, ZMQ_DONTWAIT);
-    lockDataSubscriber.unlock();
-
-    if (!ret)
+    if (!recvData(inMsg))
         return false;
 
     unsigned valSize = inMsg.size() - sizeof(char) * 8 - sizeof(unsigned) - sizeof(unsigned);
@@ -281,6 +322,60 @@ CommManager::dataPullIn(unsigned *sender, unsigned *topic, void *value, unsigned
 }
 
 
+/**
+ *
+ * Pull a data message in without copying it out. The value stays in msg,
+ * starting DATA_MSG_HEADER_SIZE bytes into msg.data().
+ *
+ */
+bool
+CommManager::dataPullIn(unsigned *sender, unsigned *topic, zmq::message_t &msg) {
+    if (numNodes == 0) return false;
+
+    if (!recvData(msg))
+        return false;
+
+    assert(msg.size() >= DATA_MSG_HEADER_SIZE);
+    char *msgPtr = (char *)msg.data();
+    msgPtr += 8;
+    memcpy(sender, msgPtr, sizeof(unsigned));
+    msgPtr += sizeof(unsigned);
+    memcpy(topic, msgPtr, sizeof(unsigned));
+
+    return true;
+}
+
+
+/**
+ *
+ * Like dataPullIn, but first waits up to timeoutMs for a message to arrive.
+ *
+ */
+bool
+CommManager::dataWaitIn(unsigned *sender, unsigned *topic, zmq::message_t &msg, long timeoutMs) {
+    if (numNodes == 0) return false;
+
+    // One wait on the socket and on the wakeups of the rings into me.
+    lockDataReceiver.lock();
+    bool idle = true;
+    for (DataRingIn *in : dataRingsIn)
+        idle = in->ring.armWait() && idle;
+    int ready = 1;
+    if (idle) {
+        std::vector<zmq::pollitem_t> items(1 + dataRingsIn.size());
+        items[0] = { (void *)*dataReceiver, 0, ZMQ_POLLIN, 0 };
+        for (unsigned r = 0; r < dataRingsIn.size(); ++r)
+            items[r + 1] = { NULL, dataRingsIn[r]->ring.readyFd(), ZMQ_POLLIN, 0 };
+        ready = zmq::poll(items, timeoutMs);
+    }
+    for (DataRingIn *in : dataRingsIn)
+        in->ring.disarmWait();
+    lockDataReceiver.unlock();
+
+    return ready > 0 && dataPullIn(sender, topic, msg);
+}
+
+
 /**
  *
  * Push a value to a specific node (cannot be myself).
@@ -335,11 +430,257 @@ CommManager::controlPullIn(unsigned from, void *value, unsigned maxValSize) {
 }
 
 
+/**
+ *
+ * Pull a message of any size in from a specific node (cannot be myself). The
+ * value stays in msg, starting sizeof(ControlMessage) bytes into msg.data().
+ *
+ */
+bool
+CommManager::controlPullIn(unsigned from, zmq::message_t &msg) {
+
+    if (numNodes == 0) return false;
+
+    assert(from >= 0 && from < numNodes);
+    assert(from != nodeId);
+
+    lockControlSubscribers[from].lock();
+    bool ret = controlSubscribers[from]->krecv(&msg, ZMQ_DONTWAIT);
+    lockControlSubscribers[from].unlock();
+
+    if (!ret)
+        return false;
+
+    ControlMessage cM = *((ControlMessage *) msg.data());
+    assert(cM.messageType == APPMSG);
+
+    return true;
+}
+
+
 ///////////////////////////////////////////////////////////////
 // Below are private function for the communication manager. //
 ///////////////////////////////////////////////////////////////
 
 
+/**
+ *
+ * Send lane of the calling thread to a node. Threads take lanes round robin
+ * on first use, so with as many lanes as sending threads none share one.
+ *
+ */
+CommManager::DataLane &
+CommManager::myLane(unsigned receiver) {
+    static thread_local unsigned lane = UINT_MAX;
+    if (lane == UINT_MAX)
+        lane = __sync_fetch_and_add(&nextLane, 1) % dataLanes;
+    return *dataLanesTo[receiver][lane];
+}
+
+
+/**
+ *
+ * Send a data message on my lane to the receiver, spending one credit.
+ * Without credits left, wait for the receiver to return some; or, unless
+ * wait, return false.
+ *
+ */
+bool
+CommManager::sendData(unsigned receiver, zmq::message_t &msg, bool wait) {
+    assert(receiver < numNodes && receiver != nodeId);
+    DataLane &lane = myLane(receiver);
+
+    if (!wait) {
+        if (pthread_mutex_trylock(lane.lk.internal_ptr()) != 0)
+            return false;
+    } else {
+        lane.lk.lock();
+    }
+    if (lane.ring != NULL && msg.size() <= lane.ring->maxMsgSize()) {
+        bool sent = true;
+        if (wait)
+            lane.ring->pushWait(msg.data(), msg.size());
+        else
+            sent = lane.ring->push(msg.data(), msg.size());
+        lane.lk.unlock();
+        return sent;
+    }
+
+    zmq::message_t creditMsg;
+    while (lane.sock->krecv(&creditMsg, ZMQ_DONTWAIT))
+        lane.credits += *(unsigned *)creditMsg.data();
+    while (lane.credits == 0 && wait) {
+        zmq::pollitem_t item = { (void *)*lane.sock, 0, ZMQ_POLLIN, 0 };
+        zmq::poll(&item, 1, -1);
+        while (lane.sock->krecv(&creditMsg, ZMQ_DONTWAIT))
+            lane.credits += *(unsigned *)creditMsg.data();
+    }
+    if (lane.credits == 0) {
+        lane.lk.unlock();
+        return false;
+    }
+    --lane.credits;
+    lane.sock->ksend(msg);
+    lane.lk.unlock();
+    return true;
+}
+
+
+/**
+ *
+ * Take a data message in, if any, from a ring or the socket. Every
+ * DATA_CREDIT_BATCH messages taken from a lane go back to it as credits;
+ * flush markers earn none.
+ *
+ */
+bool
+CommManager::recvData(zmq::message_t &msg, bool flush) {
+    if (!dataRingsIn.empty() && recvRing(msg))
+        return true;
+
+    zmq::message_t identity;
+
+    lockDataReceiver.lock();
+    bool ret = dataReceiver->krecv(&identity, ZMQ_DONTWAIT);
+    if (ret)
+        dataReceiver->krecv(&msg);  // Parts of a message arrive together.
+    if (ret && !flush) {
+        const unsigned char *id = (const unsigned char *)identity.data();
+        assert(id[2] < dataLanes);
+        unsigned &taken = dataTaken[id[1] * dataLanes + id[2]];
+        if (++taken == DATA_CREDIT_BATCH) {
+            taken = 0;
+            zmq::message_t creditMsg(sizeof(unsigned));
+            *(unsigned *)creditMsg.data() = DATA_CREDIT_BATCH;
+            dataReceiver->ksend(identity, ZMQ_SNDMORE);
+            dataReceiver->ksend(creditMsg);
+        }
+    }
+    lockDataReceiver.unlock();
+
+    return ret;
+}
+
+
+/**
+ *
+ * Take a message in from the first ring that has one and no other receiver
+ * is reading.
+ *
+ */
+bool
+CommManager::recvRing(zmq::message_t &msg) {
+    unsigned n = dataRingsIn.size();
+    unsigned first = __sync_fetch_and_add(&nextRingIn, 1);
+    for (unsigned i = 0; i < n; ++i) {
+        DataRingIn &in = *dataRingsIn[(first + i) % n];
+        if (pthread_mutex_trylock(in.lk.internal_ptr()) != 0)
+            continue;
+        bool got = in.ring.pop(msg);
+        in.lk.unlock();
+        if (got)
+            return true;
+    }
+    return false;
+}
+
+
+/**
+ *
+ * Send every other node a value over the control channel and collect
+ * theirs, by node ID; my own is in my slot.
+ *
+ */
+std::vector<std::string>
+CommManager::exchangeControl(const std::string &value) {
+    std::vector<std::string> values(numNodes);
+    values[nodeId] = value;
+    for (unsigned i = 0; i < numNodes; ++i) {
+        if (i != nodeId)
+            controlPushOut(i, (void *)value.data(), value.size());
+    }
+    for (unsigned i = 0; i < numNodes; ++i) {
+        if (i == nodeId)
+            continue;
+        zmq::message_t msg;
+        while (!controlPullIn(i, msg))
+            usleep(SHM_RING_WAIT_US);
+        values[i].assign((char *)msg.data() + sizeof(ControlMessage),
+                         msg.size() - sizeof(ControlMessage));
+    }
+    return values;
+}
+
+
+std::string
+CommManager::ringName(unsigned from, unsigned to, unsigned lane) {
+    char name[64];
+    sprintf(name, "/dorylus.%u.%u.%u.%u", dataPort, from, to, lane);
+    return name;
+}
+
+
+/**
+ *
+ * Move the lanes to peers on this host onto shared memory rings. A host is
+ * known by its name and boot ID; a peer whose rings cannot be mapped, e.g.
+ * from another container, stays on TCP.
+ *
+ */
+void
+CommManager::setupDataRings() {
+    char hostName[256] = "";
+    gethostname(hostName, sizeof(hostName) - 1);
+    std::string bootId;
+    std::ifstream("/proc/sys/kernel/random/boot_id") >> bootId;
+    std::string myHost = std::string(hostName) + "/" + bootId;
+    std::vector<std::string> hosts = exchangeControl(myHost);
+
+    // Rings into me, all created before anyone opens theirs.
+    for (unsigned i = 0; i < numNodes; ++i) {
+        if (i == nodeId || hosts[i] != myHost)
+            continue;
+        for (unsigned l = 0; l < dataLanes; ++l) {
+            DataRingIn *in = new DataRingIn;
+            if (!in->ring.create(ringName(i, nodeId, l), SHM_RING_BYTES)) {
+                printLog(nodeId, "Cannot create data ring from node %u [Reason: %s]",
+                         i, std::strerror(errno));
+                delete in;
+                continue;
+            }
+            in->lk.init();
+            dataRingsIn.push_back(in);
+        }
+    }
+    exchangeControl("");
+
+    unsigned shmPeers = 0;
+    for (unsigned i = 0; i < numNodes; ++i) {
+        if (i == nodeId || hosts[i] != myHost)
+            continue;
+        bool allLanes = true;
+        for (unsigned l = 0; l < dataLanes; ++l) {
+            ShmRing *ring = new ShmRing;
+            if (ring->open(ringName(nodeId, i, l))) {
+                dataLanesTo[i][l]->ring = ring;
+            } else {
+                delete ring;
+                allLanes = false;
+            }
+        }
+        shmPeers += allLanes;
+    }
+
+    // Everyone has mapped what it could; drop the names of the rings into
+    // me, so that a crash from here on leaves nothing in /dev/shm.
+    exchangeControl("");
+    for (DataRingIn *in : dataRingsIn)
+        in->ring.unlink();
+    printLog(nodeId, "Data to %u nodes on this host goes through shared memory",
+             shmPeers);
+}
+
+
 /**
  *
  * Flush the data communication pipe between myself and all living nodes.
@@ -347,30 +688,38 @@ CommManager::controlPullIn(unsigned from, void *value, unsigned maxValSize) {
  */
 void
 CommManager::flushData() {
-    lockDataPublisher.lock();
-    lockDataSubscriber.lock();
+    // A marker down every lane; markers spend no credits.
+    for (unsigned i = 0; i < numNodes; ++i) {
+        if (i == nodeId)    // Skip myself.
+            continue;
 
-    zmq::message_t outMsg(sizeof(char) * 8 + sizeof(unsigned));
-    char *msgPtr = (char *)(outMsg.data());
-    sprintf(msgPtr, "FFFFFFFF");
-    msgPtr += 8;
-    *(unsigned *)msgPtr = NULL_CHAR;
-    dataPublisher->ksend(outMsg);
+        for (DataLane *lane : dataLanesTo[i]) {
+            zmq::message_t outMsg(sizeof(char) * 8 + sizeof(unsigned));
+            char *msgPtr = (char *)(outMsg.data());
+            sprintf(msgPtr, "%8X", i);
+            msgPtr += 8;
+            *(unsigned *)msgPtr = NULL_CHAR;
+
+            lane->lk.lock();
+            lane->sock->ksend(outMsg);
+            lane->lk.unlock();
+        }
+    }
 
-    unsigned rem = numNodes;
+    unsigned rem = (numNodes - 1) * dataLanes;
 
     while (rem > 0) {
         zmq::message_t inMsg;
-        dataSubscriber->recv(&inMsg);
+        if (!recvData(inMsg, true)) {
+            usleep(SHM_RING_WAIT_US);
+            continue;
+        }
         char *msgPtr = (char *)inMsg.data();
         msgPtr += 8;
         unsigned idx = *((unsigned *)msgPtr);
         if (idx == NULL_CHAR)
             --rem;
     }
-
-    lockDataSubscriber.unlock();
-    lockDataPublisher.unlock();
 }
 
 
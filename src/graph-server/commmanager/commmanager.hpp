@@ -9,10 +9,24 @@
 #include "../parallel/lock.hpp"
 #include "../utils/utils.hpp"
 #include "../nodemanager/nodemanager.hpp"
+#include "../../common/shm_ring.hpp"
 
 
 #define NULL_CHAR MAX_IDTYPE
 
+/** Receiver ID, sender and topic preceding the value of a data message. */
+#define DATA_MSG_HEADER_SIZE (sizeof(char) * 8 + sizeof(unsigned) + sizeof(unsigned))
+
+/**
+ * Data messages a send lane may have outstanding at a receiver, and how many
+ * the receiver takes in before returning that many credits.
+ */
+#define DATA_CREDIT_WINDOW 16
+#define DATA_CREDIT_BATCH (DATA_CREDIT_WINDOW / 2)
+
+/** Nap between polls for the peers while setting up, in microseconds. */
+#define SHM_RING_WAIT_US 16
+
 
 /** Control message topic & contents. */
 #define CONTROL_MESSAGE_TOPIC 'C'
@@ -38,13 +52,20 @@ public:
     void init(NodeManager& nodeManager, unsigned ctxThds = 2);
     void destroy();
 
-    void rawMsgPushOut(zmq::message_t &msg);
+    void rawMsgPushOut(unsigned receiver, zmq::message_t &msg);
+    bool rawMsgTryPushOut(unsigned receiver, zmq::message_t &msg);
     void dataPushOut(unsigned receiver, unsigned sender, unsigned topic, void* value, unsigned valSize);
     bool dataPullIn(unsigned *sender, unsigned *topic, void *value, unsigned maxValSize);
+    bool dataPullIn(unsigned *sender, unsigned *topic, zmq::message_t &msg);
+    bool dataWaitIn(unsigned *sender, unsigned *topic, zmq::message_t &msg, long timeoutMs);
     void controlPushOut(unsigned to, void* value, unsigned valSize);
     bool controlPullIn(unsigned from, void *value, unsigned maxValSize);
+    bool controlPullIn(unsigned from, zmq::message_t &msg);
 
     void setDataPort(unsigned dPort) { dataPort = dPort; }
+    void setDataLanes(unsigned lanes) { dataLanes = lanes ? lanes : 1; }
+    void setShmData(bool on) { shmData = on; }
+    bool getShmData() const { return shmData; }
     void setControlPortStart(unsigned cPort) { controlPortStart = cPort; }
 
 private:
@@ -52,13 +73,36 @@ private:
     unsigned numNodes = 0;
     unsigned nodeId = 0;
 
+    // Data goes point to point: every peer has `dataLanes` DEALER sockets
+    // to our one ROUTER, so threads sending at once each get a lane of
+    // their own. A lane spends a credit per message and stalls once it has
+    // none left; the receiver returns them as it takes messages in, so a
+    // slow receiver pushes back on its senders. Lanes to a peer on the same
+    // host write to a shared memory ring instead, which pushes back by
+    // filling up.
+    struct DataLane {
+        Lock lk;
+        zmq::socket_t *sock = NULL;
+        unsigned credits = DATA_CREDIT_WINDOW;
+        ShmRing *ring = NULL;
+    };
+    struct DataRingIn {
+        Lock lk;
+        ShmRing ring;
+    };
+
     zmq::context_t dataContext;
-    zmq::socket_t *dataPublisher = NULL;
-    zmq::socket_t *dataSubscriber = NULL;
+    std::vector<std::vector<DataLane *>> dataLanesTo;  // by node ID and lane
+    zmq::socket_t *dataReceiver = NULL;
+    std::vector<unsigned> dataTaken;    // by sender lane, since last credits
     unsigned dataPort;
+    unsigned dataLanes = 1;
+    unsigned nextLane = 0;
+    bool shmData = true;    // use rings to peers on this host
+    std::vector<DataRingIn *> dataRingsIn;
+    unsigned nextRingIn = 0;
 
-    Lock lockDataPublisher;
-    Lock lockDataSubscriber;
+    Lock lockDataReceiver;
 
     zmq::context_t controlContext;
     zmq::socket_t **controlPublishers = NULL;
@@ -68,6 +112,15 @@ private:
     Lock *lockControlPublishers = NULL;
     Lock *lockControlSubscribers = NULL;
 
+    DataLane &myLane(unsigned receiver);
+    bool sendData(unsigned receiver, zmq::message_t &msg, bool wait = true);
+    bool recvData(zmq::message_t &msg, bool flush = false);
+    bool recvRing(zmq::message_t &msg);
+
+    std::vector<std::string> exchangeControl(const std::string &value);
+    std::string ringName(unsigned from, unsigned to, unsigned lane);
+    void setupDataRings();
+
     void flushControl();
     void flushData();
 };
@@ -14,7 +14,7 @@ static void deleteMatrix(Matrix &mat) {
     }
 }
 
-Matrix recvTensor(zmq::socket_t &socket) {
+Matrix recvTensor(zmq::socket_t &socket, ShmRing *ring, bool &ringed) {
     zmq::message_t tensorHeader(TENSOR_HDR_SIZE);
     zmq::message_t tensorData;
 
@@ -27,6 +27,14 @@ Matrix recvTensor(zmq::socket_t &socket) {
     }
     std::string name = parseName((char *)tensorHeader.data());
     socket.recv(&tensorData);
+    // The data of a weight server on this host came through our ring.
+    if (resp == OP::PULLSHM) {
+        if (ring == NULL || !ring->pop(tensorData)) {
+            std::cerr << "Tensor data missing from the weight ring" << std::endl;
+            return Matrix();
+        }
+        ringed = true;
+    }
 
     unsigned rows = parse<unsigned>((char *)tensorHeader.data(), 3);
     unsigned cols = parse<unsigned>((char *)tensorHeader.data(), 4);
@@ -38,12 +46,13 @@ Matrix recvTensor(zmq::socket_t &socket) {
 }
 
 std::vector<Matrix> reqTensors(zmq::socket_t &socket, Chunk &chunk,
-                               std::vector<std::string> &tensorRequests) {
+                               std::vector<std::string> &tensorRequests,
+                               ShmRing *ring, bool &ringed) {
     bool empty = true;
     std::vector<Matrix> matrices;
     while (empty) {
         zmq::message_t header(HEADER_SIZE);
-        populateHeader(header.data(), OP::PULL, chunk);
+        populateHeader(header.data(), ring ? OP::PULLSHM : OP::PULL, chunk);
         socket.send(header, ZMQ_SNDMORE);
         unsigned numTensors = tensorRequests.size();
         for (unsigned u = 0; u < tensorRequests.size(); ++u) {
@@ -60,7 +69,7 @@ std::vector<Matrix> reqTensors(zmq::socket_t &socket, Chunk &chunk,
         unsigned more = 1;
         empty = false;
         while (more && !empty) {
-            Matrix result = recvTensor(socket);
+            Matrix result = recvTensor(socket, ring, ringed);
             if (result.empty()) {
                 empty = result.empty();
 
@@ -124,7 +133,16 @@ MessageService::MessageService(unsigned wPort_, unsigned nodeId_,
     }
 }
 
-void MessageService::setUpWeightSocket(char *addr) {
+MessageService::~MessageService() {
+    if (wSndThread.joinable()) wSndThread.join();
+    if (wReqThread.joinable()) wReqThread.join();
+    if (wring != NULL) {
+        wring->close();
+        delete wring;
+    }
+}
+
+void MessageService::setUpWeightSocket(char *addr, bool shm) {
     wsocktReady = 1;
     char ipc_addr[50];
     unsigned ipc_addr_len = strlen(ipc_addr);
@@ -137,6 +155,30 @@ void MessageService::setUpWeightSocket(char *addr) {
     sprintf(whost_port, "tcp://%s:%u", addr, wPort);
     // printf("connect to %s\n", whost_port);
     wsocket.connect(whost_port);
+
+    if (shm) {
+        wring = new ShmRing;
+        if (!wring->create(weightRingName(wPort, nodeId), SHM_RING_BYTES)) {
+            delete wring;
+            wring = NULL;
+        }
+    }
+}
+
+// The first pull tells whether the weight server could map our ring. Either
+// way its name goes; weights keep their sizes, so if nothing came through it
+// then, nothing ever will.
+void MessageService::settleWeightRing(bool ringed) {
+    if (wring == NULL || wringMapped)
+        return;
+    if (ringed) {
+        wring->unlink();
+        wringMapped = true;
+    } else {
+        wring->close();
+        delete wring;
+        wring = NULL;
+    }
 }
 
 Matrix MessageService::getWeightMatrix(unsigned layer) {
@@ -198,36 +240,49 @@ void MessageService::prefetchWeightsMatrix() {
                 deleteMatrix(weights[i]);
             }
             Chunk c = { 0, nodeId, 0, 0, 0, PROP_TYPE::FORWARD, epoch, true };
+            bool ringed = false;
             for (unsigned j = 0; j < numLayers; ++j) {
                 c.layer = j;
                 std::vector<std::string> weightRequests { "w" };
-                std::vector<Matrix> wa = reqTensors(wsocket, c, weightRequests);
+                std::vector<Matrix> wa = reqTensors(wsocket, c, weightRequests,
+                                                    wring, ringed);
                 weights[j] = wa[0];
             }
+            settleWeightRing(ringed);
         } else if (gnn_type == GNN::GAT) {
             for (unsigned i = 0; i < weights.size(); ++i) {
                 deleteMatrix(weights[i]);
                 deleteMatrix(as[i]);
             }
             Chunk c = { 0, nodeId, 0, 0, 0, PROP_TYPE::FORWARD, epoch, true };
+            bool ringed = false;
             for (unsigned j = 0; j < numLayers; ++j) {
                 c.layer = j;
                 std::vector<std::string> weightRequests{ "w", "a_i" };
-                std::vector<Matrix> wa = reqTensors(wsocket, c, weightRequests);
+                std::vector<Matrix> wa = reqTensors(wsocket, c, weightRequests,
+                                                    wring, ringed);
                 weights[j] = wa[0];
                 as[j] = wa[1];
             }
+            settleWeightRing(ringed);
         }
     });
 }
 
 
 void MessageService::sendAccloss(float acc, float loss, unsigned vtcsCnt) {
+    Chunk chunk = { nodeId, nodeId, 0, vtcsCnt, 1, PROP_TYPE::FORWARD, epoch, true };
+    sendAccloss(acc, loss, chunk);
+}
+
+// Report the stats of one chunk; the weight server sums them over all chunks.
+void MessageService::sendAccloss(float acc, float loss, Chunk &c) {
     if (wSndThread.joinable()) {
         wSndThread.join();
     }
 
-    Chunk chunk = { nodeId, nodeId, 0, vtcsCnt, 1, PROP_TYPE::FORWARD, epoch, true };
+    Chunk chunk = c;
+    chunk.epoch = epoch;
 
     zmq::message_t header(HEADER_SIZE);
     populateHeader(header.data(), OP::EVAL, chunk);
@@ -7,6 +7,7 @@
 #include <zmq.hpp>
 
 #include "../../common/matrix.hpp"
+#include "../../common/shm_ring.hpp"
 #include "../../common/utils.hpp"
 #include "../utils/utils.hpp"
 
@@ -15,9 +16,10 @@ class MessageService {
 public:
     MessageService(unsigned wPort_, unsigned nodeId_,
                    unsigned numLayers_, GNN gnn_type);
+    ~MessageService();
 
     // weight server related
-    void setUpWeightSocket(char *addr);
+    void setUpWeightSocket(char *addr, bool shm = false);
     void prefetchWeightsMatrix();
 
     // for 'w' weight matrix
@@ -28,6 +30,7 @@ public:
     void sendaUpdate(Matrix &matrix, unsigned layer);
 
     void sendAccloss(float acc, float loss, unsigned vtcsCnt);
+    void sendAccloss(float acc, float loss, Chunk &chunk);
 
 private:
     zmq::context_t wctx;
@@ -37,6 +40,12 @@ private:
     unsigned wPort;
     bool wsocktReady;
 
+    // Pulled weights come through a ring when the weight server shares our
+    // host; it is kept only if the first pull used it.
+    ShmRing *wring = NULL;
+    bool wringMapped = false;
+    void settleWeightRing(bool ringed);
+
     GNN gnn_type;
     unsigned epoch;
     unsigned numLayers;
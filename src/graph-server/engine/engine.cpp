@@ -21,6 +21,7 @@
 #include <unordered_set>
 
 #include "../graph/dataloader.hpp"
+#include "ops/spmm.hpp"
 
 #ifdef _GPU_ENABLED_
 #include "../commmanager/GPU_comm.hpp"
@@ -62,17 +63,30 @@ void Engine::init(int argc, char *argv[])
 
     std::string graphFile =
         datasetDir + "graph." + std::to_string(nodeId) + ".bin";
-    // detect whether preprocessed
+    // detect whether preprocessed, in the current layout and vertex order
     {
-        std::ifstream gfile(graphFile.c_str(), std::ios::binary);
-        if (!gfile.good() || forcePreprocess)
+        GraphFileHeader header;
+        if (!Graph::readHeader(graphFile, header) || forcePreprocess ||
+            header.reorder != (unsigned)reorder)
         {
-            DataLoader dl(datasetDir, nodeId, numNodes, undirected);
+            DataLoader dl(datasetDir, nodeId, numNodes, undirected, reorder);
             dl.preprocess();
+            preprocessed = true;
         }
     }
-    graph.init(graphFile);
+    if (!graph.init(graphFile))
+    {
+        printLog(nodeId, "Cannot load graph file %s", graphFile.c_str());
+        exit(-1);
+    }
+    buildSendPlans();
+    buildHubPlans();
+    buildBoundarySets();
+    computeChunkBounds();
+    buildGhostDeps();
+    buildGhostFormats();
     printGraphMetrics();
+    chooseGCNOpOrder();
     printLog(nodeId, "Print graph stats");
 
     for (unsigned i = 0; i < 2 * numLayers; i++)
@@ -85,6 +99,16 @@ void Engine::init(int argc, char *argv[])
         vecTimeLambdaWait.push_back(0.0);
     }
 
+    // Pushes into a stage's queues wake its idle threads
+    schQueue.setSignal(&schSignal);
+    GAQueue.setSignal(&executor.getSignal());
+    GAInteriorQueue.setSignal(&executor.getSignal());
+    GABoundaryQueue.setSignal(&executor.getSignal());
+    AVQueue.setSignal(&executor.getSignal());
+    SCQueue.setSignal(&SCSignal);
+    SCStashQueue.setSignal(&SCSignal);
+    AEQueue.setSignal(&executor.getSignal());
+
     // Save intermediate tensors during forward phase for backward computation.
     savedNNTensors.resize(numLayers + 1);
     savedEdgeTensors.resize(numLayers + 1);
@@ -134,11 +158,6 @@ void Engine::init(int argc, char *argv[])
     NormAdjMatrixOut->loadSpCSR(cu.spHandle, graph);
 #endif
 
-    // Initialize synchronization utilities.
-    recvCnt = 0;
-    recvCntLock.init();
-    recvCntCond.init(recvCntLock);
-
     if (nodeId == 0)
     {
         printLog(nodeId, "Creating WeightComm with port %d", weightserverPort);
@@ -186,6 +205,19 @@ void Engine::init(int argc, char *argv[])
     }
 #endif
 
+#ifndef _GPU_ENABLED_
+    printLog(nodeId, "Aggregation kernels: %s", spmmIsaName(detectSpMMIsa()));
+#endif
+
+    // One pool of compute workers for GA, AV, AE and their split gathers.
+    // Scatter, ghost receivers and the scheduler keep their own threads, as
+    // they mostly block on the network.
+    if (cThreads == 0)
+        cThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    executor.start(cThreads,
+                   std::bind(&Engine::stageTask, this, std::placeholders::_1),
+                   stagePoll);
+
     timeInit += getTimer();
     printLog(nodeId, "Engine initialization complete.");
 }
@@ -198,13 +230,14 @@ void Engine::init(int argc, char *argv[])
 void Engine::destroy()
 {
     // printLog(nodeId, "Destroying the engine...");
+    executor.stop();
+    for (std::vector<StageSample> *buf : stageBufs)
+        delete buf;
+    stageBufs.clear();
 
     nodeManager.destroy();
     commManager.destroy();
 
-    recvCntLock.destroy();
-    recvCntCond.destroy();
-
     if (nodeId == 0)
     {
         weightComm->shutdown();
@@ -259,6 +292,8 @@ void Engine::run()
     // printLog(nodeId, "Going to preallocate tensor of type %d", gnn_type);
     preallocate_tensors(gnn_type);
     // printLog(nodeId, "Allocated tensors", gnn_type);
+    if (gnn_type == GNN::GCN && aggCache)
+        cacheLayer0AggGCN();
 
     start_time = getCurrentTime();
     switch (gnn_type)
@@ -278,27 +313,10 @@ void Engine::runPipeline()
     // printLog(nodeId, "Starting run pipeline");
     using ThreadVector = std::vector<std::thread>;
     pipelineHalt = false;
+    peersHalted = false;
     unsigned commThdCnt = dThreads;
     // unsigned commThdCnt = std::max(2u, cThreads / 4);
 
-    auto gaWrkrFunc =
-        std::bind(&Engine::gatherWorkFunc, this, std::placeholders::_1);
-    ThreadVector gaWrkrThds;
-    for (unsigned tid = 0; tid < cThreads; ++tid)
-    {
-        gaWrkrThds.push_back(std::thread(gaWrkrFunc, 2 + tid));
-    }
-    // printLog(nodeId, "Allocated gaWrkrThds");
-
-    auto avWrkrFunc =
-        std::bind(&Engine::applyVertexWorkFunc, this, std::placeholders::_1);
-    ThreadVector avWrkrThds;
-    for (unsigned tid = 0; tid < 1; ++tid)
-    {
-        avWrkrThds.push_back(std::thread(avWrkrFunc, tid));
-    }
-    // printLog(nodeId, "Allocated avWrkrThds");
-
     auto scWrkrFunc =
         std::bind(&Engine::scatterWorkFunc, this, std::placeholders::_1);
 
@@ -319,15 +337,6 @@ void Engine::runPipeline()
     }
     // printLog(nodeId, "Allocated ghstRcvrThds");
 
-    auto aeWrkrFunc =
-        std::bind(&Engine::applyEdgeWorkFunc, this, std::placeholders::_1);
-    ThreadVector aeWrkrThds;
-    for (unsigned tid = 0; tid < 1; ++tid)
-    {
-        aeWrkrThds.push_back(std::thread(aeWrkrFunc, tid));
-    }
-    // printLog(nodeId, "Allocated aeWrkrThds");
-
     // printLog(nodeId, "Pre barrier 1");
     nodeManager.barrier();
     // printLog(nodeId, "Post barrier 1");
@@ -356,19 +365,7 @@ void Engine::runPipeline()
     // printLog(nodeId, "Pre barrier 2");
     nodeManager.barrier();
     // printLog(nodeId, "Post barrier 2");
-
-    for (unsigned tid = 0; tid < cThreads; ++tid)
-    {
-        gaWrkrThds[tid].join();
-    }
-    // printLog(nodeId, "Joined gaWrkrThds");
-
-    for (unsigned tid = 0; tid < 1; ++tid)
-    {
-        avWrkrThds[tid].join();
-        aeWrkrThds[tid].join();
-    }
-    // printLog(nodeId, "Joined avWrkrThds and aeWrkrThds");
+    peersHalted = true;
 
     for (unsigned tid = 0; tid < commThdCnt; ++tid)
         scWrkrThds[tid].join();
@@ -378,20 +375,25 @@ void Engine::runPipeline()
         ghstRcvrThds[tid].join();
     // printLog(nodeId, "Joined ghstRcvrThds");
 
+    // Let stage tasks in flight finish before dropping leftover chunks
+    executor.drain();
+    GAQueue.clear();
+    GAInteriorQueue.clear();
+    GABoundaryQueue.clear();
+    AVQueue.clear();
+    AEQueue.clear();
+
     {
         // clean up
         unsigned sender, topic;
-        char *msgBuf = new char[MAX_MSG_SIZE];
-        if (commManager.dataPullIn(&sender, &topic, msgBuf,
-                                   MAX_MSG_SIZE))
+        zmq::message_t msg;
+        if (commManager.dataPullIn(&sender, &topic, msg))
         {
             printLog(nodeId, "CLEAN UP: Still msgs in buffer");
         };
-        while (commManager.dataPullIn(&sender, &topic, msgBuf,
-                                      MAX_MSG_SIZE))
+        while (commManager.dataPullIn(&sender, &topic, msg))
         {
         };
-        delete[] msgBuf;
     }
 }
 
@@ -2,10 +2,12 @@
 #define __ENGINE_HPP__
 
 #include <set>
+#include <deque>
 #include <vector>
 #include <climits>
 #include <atomic>
 #include <tuple>
+#include <functional>
 #include <cstdio>
 #include <mutex>
 #include <condition_variable>
@@ -17,20 +19,39 @@
 #include "../nodemanager/nodemanager.hpp"
 #include "../parallel/lock.hpp"
 #include "../parallel/cond.hpp"
+#include "../parallel/signal.hpp"
+#include "../parallel/executor.hpp"
 #include "../utils/utils.hpp"
 #include "../../common/matrix.hpp"
+#include "ops/ghost_codec.hpp"
 
 // Max size (bytes) for a message received by the data communicator.
 #define MAX_MSG_SIZE (1 * 1024 * 1024)
 #define NODE_ID_DIGITS 8 // Digits num of node id.
 #define NODE_ID_HEADER "%8X" // Header for node id. For communication.
-#define DATA_HEADER_SIZE (NODE_ID_DIGITS + sizeof(unsigned) * 5)
+#define DATA_HEADER_SIZE (NODE_ID_DIGITS + sizeof(unsigned) * 7)
 
 /** Binary features file header struct. */
 struct FeaturesHeaderType {
     unsigned numFeatures;
 };
 
+/** Binary layer-0 aggregation cache file header struct. */
+struct AggCacheHeaderType {
+    unsigned long long localInEdgeCnt;
+    unsigned localVtxCnt;
+    unsigned srcGhostCnt;
+    unsigned featDim;
+    unsigned reorder;
+    // Identity of the inputs Â·X was computed from: size and modification
+    // time of the graph and features files, and the features file's path.
+    unsigned long long graphSize;
+    unsigned long long graphMtimeNs;
+    unsigned long long featsSize;
+    unsigned long long featsMtimeNs;
+    unsigned long long featsPathHash;
+};
+
 /** Binary labels file header struct. */
 struct LabelsHeaderType {
     unsigned labelKinds;
@@ -40,26 +61,100 @@ class LockChunkQueue {
 public:
     void lock() { lk.lock(); }
     void unlock() { lk.unlock(); }
+    void setSignal(StageSignal *s) { signal = s; }
 
     bool empty() const { return cq.empty(); }
     size_t size() const { return cq.size(); }
     const Chunk &top() const { return cq.top(); }
-    void push(const Chunk &chunk) { cq.push(chunk); }
+    void push(const Chunk &chunk) {
+        if (cq.empty())
+            emptyPushTime = getTimer();
+        cq.push(chunk);
+        if (signal)
+            signal->ring();
+    }
     void push_atomic(const Chunk &chunk) {
         lk.lock();
-        cq.push(chunk);
+        push(chunk);
         lk.unlock();
     }
-    void pop() { cq.pop(); }
+    void pop() {
+        if (emptyPushTime != 0.0) {
+            wakeTimeSum += getTimer() - emptyPushTime;
+            ++wakeCnt;
+            emptyPushTime = 0.0;
+        }
+        cq.pop();
+    }
     void clear() {
         while (!cq.empty())
             cq.pop();
     }
+
+    // Mean time (ms) from a push into the empty queue to the next pop,
+    // i.e. how long an idle stage takes to notice new work
+    double avgWakeTime() const { return wakeCnt ? wakeTimeSum / wakeCnt : 0.0; }
+    unsigned wakeCount() const { return wakeCnt; }
 private:
     Lock lk;
     ChunkQueue cq;
+    StageSignal *signal = NULL;
+    double emptyPushTime = 0.0;
+    double wakeTimeSum = 0.0;
+    unsigned wakeCnt = 0;
+};
+
+/** Rows of a chunk an aggregation covers. */
+enum AggRows {
+    AGG_ALL_ROWS,
+    AGG_INTERIOR_ROWS,  // rows with no ghost neighbor in the direction
+    AGG_BOUNDARY_ROWS   // rows with at least one
+};
+
+/** Pipeline stages timed per chunk, see recordStage. */
+enum StageId {
+    STAGE_GA,
+    STAGE_AV,
+    STAGE_SC,
+    STAGE_AE,
+    NUM_STAGES
+};
+
+/** One stage call on one chunk. */
+struct StageSample {
+    unsigned epoch;
+    unsigned layer;
+    unsigned chunk;
+    unsigned char dir;
+    unsigned char stage;
+    float ms;
+};
+
+/** Codec error and traffic of one ghost tensor, sampled at the sender. */
+struct GhostCodecStats {
+    double errSq;       // over the first row of each message
+    double valSq;
+    double maxErr;
+    unsigned long long values;
+    unsigned long long wireBytes;   // of all rows sent
+    unsigned long long rawBytes;    // the same rows as fp32
 };
 
+/**
+ *
+ * Local vertices scattered to one remote node in one direction, in lvid
+ * order, with the row each lands in of that node's ghost tensors. A chunk
+ * sends the slice of lvids within its bounds.
+ *
+ */
+struct SendPlan {
+    std::vector<unsigned> lvids;
+    std::vector<unsigned> ghostIds;
+};
+
+/** Hub row messages a receiver still has to pass on, by tree child. */
+typedef std::deque<std::pair<unsigned, zmq::message_t>> RelayQueue;
+
 /**
  *
  * Class of a GNN-LAMBDA engine executing on a node.
@@ -71,6 +166,8 @@ public:
     void init(int argc, char *argv[]);
     void preallocate_tensors(GNN gnn_type);
     void preallocateGCN();
+    void chooseGCNOpOrder();
+    void cacheLayer0AggGCN();
     void preallocateGAT();
 
     void run();
@@ -82,7 +179,7 @@ public:
     bool master();
 
     // HIGH LEVEL SAGA FUNCITONS
-    void aggregateGCN(Chunk &chunk);
+    void aggregateGCN(Chunk &chunk, AggRows rows = AGG_ALL_ROWS);
     void applyVertexGCN(Chunk &chunk);
     void scatterGCN(Chunk &chunk);
     void applyEdgeGCN(Chunk &chunk);
@@ -97,18 +194,34 @@ public:
     LockChunkQueue AVQueue;
     LockChunkQueue SCQueue;
     LockChunkQueue AEQueue;
-    void gatherWorkFunc(unsigned tid);
-    void applyVertexWorkFunc(unsigned tid);
+    // Split GCN gathers of the sync pipeline, see scatterWorkFunc
+    LockChunkQueue GAInteriorQueue;
+    LockChunkQueue GABoundaryQueue;
+    // Wakeups of the scheduler and of SC, which also covers its stash. GA,
+    // AV and AE ring the executor's signal.
+    StageSignal schSignal, SCSignal;
+    bool stagePoll = false; // idle stages poll with backoff instead of parking
+    void wakeStages();
+    // GA, AV and AE run as tasks on one work-stealing executor, see stageTask
+    Executor executor;
+    unsigned avRunning = 0; // AV and AE run one chunk at a time
+    unsigned aeRunning = 0;
+    bool stageTask(unsigned wid);
+    void gatherChunk(Chunk &c, AggRows rows);
+    void recordGatherTime(const Chunk &c, double stt);
+    void applyVertexChunk(Chunk &c);
+    void applyEdgeChunk(Chunk &c);
     void scatterWorkFunc(unsigned tid);
     void ghostReceiverFunc(unsigned tid);
     void ghostReceiverGCN(unsigned tid);
     void ghostReceiverGAT(unsigned tid);
-    void applyEdgeWorkFunc(unsigned tid);
     void scheduleFunc(unsigned tid);
     void scheduleAsyncFunc(unsigned tid);
     LockChunkQueue SCStashQueue;
     PROP_TYPE currDir;
     bool pipelineHalt = false;
+    // Every node's pipeline halted; hub rows still unrelayed are unneeded.
+    bool peersHalted = false;
     bool async = false;
 
     unsigned getAbsLayer(const Chunk &c);
@@ -116,7 +229,18 @@ public:
     Chunk incLayerGAT(const Chunk &c);
     bool isLastLayer(const Chunk &c);
 
+    void computeChunkBounds();
     void loadChunks();
+    // Chunk cid covers local vertices [chunkBounds[cid], chunkBounds[cid + 1])
+    std::vector<unsigned> chunkBounds;
+    // 0: equal vertex ranges, 1: equal in-edges plus a per-vertex cost,
+    // 2: as 1, then rebalanced between sync epochs by measured gather time
+    unsigned chunking;
+    // Gather time of each chunk since the last rebalance, in microseconds
+    std::vector<unsigned long long> chunkGatherTime;
+    double chunkCost(unsigned lvid);
+    void cutChunks(const std::function<double(unsigned)> &costPrefix);
+    bool rebalanceChunks();
 
     // TENSOR OPS
     // NOTE: Implementing in engine for now but need to move later
@@ -163,11 +287,41 @@ public:
     // Labels one-hot storage array.
     FeatType *localVerticesLabels = NULL;
 
-    // For pipeline scatter sync
-    int recvCnt = 0;
-    Lock recvCntLock;
-    Cond recvCntCond;
-    int ghostVtcsRecvd;
+    // Per remote node send plans, built once at init
+    std::vector<SendPlan> forwardSendPlans;
+    std::vector<SendPlan> backwardSendPlans;
+    // Local vertices that are ghosts on every peer (hubs), per direction, in
+    // the same form but with global IDs for ghost IDs. A hub row leaves once
+    // down a relay tree of fanout hubFanout instead of once per peer; each
+    // node it reaches passes the message on unchanged, see hubChildren.
+    SendPlan hubPlans[2];
+    unsigned hubFanout;
+
+    // Whether a local vertex has a ghost neighbor, per direction. In the sync
+    // pipeline interior rows aggregate while ghosts are still arriving.
+    std::vector<bool> forwardBoundary;
+    std::vector<bool> backwardBoundary;
+    bool overlapInterior = false;
+    // Split passes of a chunk's gather still running, by chunk local ID
+    std::vector<unsigned> aggPartsLeft;
+
+    // Ghost dependencies of the chunks, per direction: ghost row -> chunks
+    // whose in-edges read it (CSR style), and the row count of each chunk.
+    std::vector<unsigned long long> ghostChunkPtrs[2];
+    std::vector<unsigned> ghostChunks[2];
+    std::vector<unsigned> chunkGhostDeps[2];
+    // Rows each chunk still waits on per ghost tensor, plus one until all
+    // local chunks have scattered; indexed by ghostSlot(dir, layer) and cid.
+    std::vector<unsigned> ghostDepsLeft;
+    // Chunks waiting on their ghosts, by chunk local ID
+    std::vector<Chunk> waitingChunks;
+
+    // Ghost rows each peer sends us in one exchange, per direction and node
+    // ID, from the send plan handshake; and the rows still due per ghost
+    // tensor, indexed by ghostSlot(dir, layer) * numNodes + node ID. A sync
+    // exchange needs no acks: a peer is done once its count runs out.
+    std::vector<unsigned> peerGhostRows[2];
+    std::vector<int> peerRowsLeft;
 
     // Read-in files
     std::string datasetDir;
@@ -180,6 +334,13 @@ public:
     std::string myPubIpFile;
 
     bool forcePreprocess = false;
+    // Whether the graph was (re)preprocessed by this run.
+    bool preprocessed = false;
+    // Local vertex order the graph is preprocessed with.
+    ReorderType reorder = REORDER_NONE;
+    // Wire format of the ghost rows, as given and per ghostSlot(dir, layer).
+    std::string ghostFormatSpec;
+    std::vector<GhostFormat> ghostFormats;
 
     std::time_t start_time;
     std::time_t end_time;
@@ -222,31 +383,74 @@ public:
     std::vector<double> vecTimeScatter;
     std::vector<double> epochTimes;
     double asyncAvgEpochTime;
+    // Stage call times. Each thread appends to a buffer of its own, so
+    // recording takes no lock; the buffers are merged in output().
+    std::mutex stageBufLock;
+    std::vector<std::vector<StageSample> *> stageBufs;
+    void recordStage(StageId stage, const Chunk &key, double stt);
+    void reportStageTimes();
+    // Ghost codec stats per ghostSlot(dir, layer); scatter threads share it.
+    std::mutex ghostStatsLock;
+    std::vector<GhostCodecStats> ghostStats;
+    void reportGhostCodec();
 
     void calcAcc(FeatType *predicts, FeatType *labels, unsigned vtcsCnt,
                  unsigned featDim);
 
     // Worker and communicator thread function.
+    void buildSendPlans();
+    void buildBoundarySets();
+    void buildGhostDeps();
+    void buildGhostFormats();
+    void resetGhostDeps();
+    unsigned ghostTensorLayer(const Chunk &c);
+    inline unsigned ghostSlot(unsigned dir, unsigned layer) {
+        return dir * (numLayers + 1) + layer;
+    }
+    void ghostRowsLanded(unsigned slot, std::vector<unsigned> &chunkHits);
+    void peerRowsLanded(unsigned slot, unsigned sender, unsigned rows);
+    void chunkScattered(Chunk &c);
+    void buildHubPlans();
+    std::vector<unsigned> hubChildren(unsigned origin);
+    unsigned hubGhostRow(unsigned dir, unsigned gvid);
+    void packGhostRows(zmq::message_t &msg, unsigned receiver,
+      unsigned totCnt, unsigned *lvids, unsigned *keys, FeatType *inputTensor,
+      unsigned featDim, Chunk &c, bool hub);
+    void readdressGhostRows(zmq::message_t &msg, unsigned receiver);
     void verticesPushOut(unsigned receiver, unsigned totCnt, unsigned *lvids,
-      FeatType *inputTensor, unsigned featDim, Chunk& c);
+      unsigned *ghostIds, FeatType *inputTensor, unsigned featDim, Chunk& c);
+    void hubVerticesPushOut(unsigned totCnt, unsigned *lvids,
+      unsigned *globalIds, FeatType *inputTensor, unsigned featDim, Chunk &c);
+    void relayHubRows(zmq::message_t &msg, unsigned origin, RelayQueue &relays);
+    void flushHubRelays(RelayQueue &relays);
     void sendEpochUpdate(unsigned currEpoch);
 
-    // transform from vtxFeats/edgFeats to edgFeats/vtxFeats
-    FeatType** srcVFeats2eFeats(FeatType *vtcsTensor, FeatType* ghostTensor, unsigned vtcsCnt, unsigned featDim);
-    FeatType** dstVFeats2eFeats(FeatType *vtcsTensor, FeatType* ghostTensor, unsigned vtcsCnt, unsigned featDim);
-    // FeatType* eFeats2dstVFeats(FeatType **edgsTensor, unsigned edgsCnt, unsigned featDim);
-    // FeatType* eFeats2srcVFeats(FeatType **edgsTensor, unsigned edgsCnt, unsigned featDim);
-
     // About the global data arrays.
     inline unsigned getFeatDim(unsigned layer) {
         return layerConfig[layer];
     }
 
+    // Width the given GCN layer aggregates and exchanges ghosts at.
+    inline unsigned getAggDim(unsigned layer) {
+        return transformFirst[layer] ? layerConfig[layer + 1]
+                                     : layerConfig[layer];
+    }
+
     inline FeatType *localVertexLabelsPtr(unsigned lvid) {
         return localVerticesLabels + lvid * getFeatDim(numLayers);
     }
 
     unsigned timeoutRatio;
+    // Feature-tiled aggregation: 0 off, 1 tile width from L2, N columns.
+    unsigned aggTile;
+    // GCN operation order: 0 always A·X then ·W, 1 chosen per layer by cost.
+    unsigned opOrder;
+    // Per layer, whether X·W is computed before aggregating (A·(XW)).
+    std::vector<bool> transformFirst;
+    // Layer-0 forward aggregation: 0 every epoch, 1 once per run, 2 once and
+    // cached on disk across runs.
+    unsigned aggCache;
+    bool layer0AggCached = false;
     unsigned staleness;
     volatile CONVERGE_STATE convergeState = CONVERGE_STATE::EARLY;
     unsigned minEpoch;
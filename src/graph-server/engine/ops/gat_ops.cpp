@@ -19,6 +19,7 @@
 
 #include "../engine.hpp"
 #include "../../utils/utils.hpp"
+#include "spmm.hpp"
 
 #ifdef _GPU_ENABLED_
 #include "../../GPU-Computation/comp_unit.cuh"
@@ -65,10 +66,6 @@ void Engine::preallocateGAT() {
 
         // Attention scores stored in CSCMatrix<>::values
 
-        FeatType **eVFeatsTensor = srcVFeats2eFeats(
-            zTensor, ghostZTensor, vtxCnt, nextFeatDim);
-        savedEdgeTensors[layer]["fedge"] = eVFeatsTensor;
-
         FeatType *ahTensor = new FeatType[vtxCnt * nextFeatDim];
         std::memset(ahTensor, 0, sizeof(FeatType) * vtxCnt * nextFeatDim);
         savedNNTensors[layer]["ah"] = Matrix("ah", vtxCnt, nextFeatDim, ahTensor);
@@ -78,9 +75,6 @@ void Engine::preallocateGAT() {
             std::memset(hTensor, 0, sizeof(FeatType) * vtxCnt * nextFeatDim);
             savedNNTensors[layer + 1]["h"] = Matrix(vtxCnt, nextFeatDim, hTensor);
         }
-        // FeatType **edgeTensor =
-        //     srcVFeats2eFeats(hTensor, ghostTensor, vtxCnt, featDim);
-        // savedEdgeTensors[layer + 1]["fedge"] = edgeTensor;
     }
 
     // backward tensor allocation
@@ -107,10 +101,6 @@ void Engine::preallocateGAT() {
         FeatType *ghostTensor = new FeatType[graph.dstGhostCnt * featDim];
         savedNNTensors[layer]["bg_d"] =
             Matrix(graph.dstGhostCnt, featDim, ghostTensor);
-
-        FeatType **eGrad =
-            dstVFeats2eFeats(gradTensor, ghostTensor, vtxCnt, featDim);
-        savedEdgeTensors[layer]["bedge"] = eGrad;
     }
 }
 
@@ -170,75 +160,68 @@ void Engine::aggregateGAT(Chunk &c) {
     }
 }
 #else // !defined(_GPU_ENABLED_)
+// out[v] += (adj·in)[v] for rows [start, end), as tasks of about equal nnz;
+// hub rows are cut into segments whose partial sums are added in at the end.
+static void parallelSpMM(Executor &executor, SpMMKernel kernel,
+                         const SparseOperand &adj, const DenseOperand &in,
+                         FeatType *out, unsigned start, unsigned end) {
+    std::vector<std::pair<unsigned, unsigned>> ranges(
+        1, std::make_pair(start, end));
+    unsigned long long cost =
+        adj.ptrs[end] - adj.ptrs[start] + (end - start);
+    SpMMSplit split = spmmSplitByNnz(adj, ranges,
+                                     executor.grain(cost, SPMM_MIN_PART_NNZ));
+    std::vector<FeatType> partials(split.partialRows.size() * in.featDim);
+    executor.parallelFor(0, split.parts.size(), 1,
+                         [&](unsigned pLo, unsigned pHi) {
+        for (unsigned p = pLo; p < pHi; ++p) {
+            spmmRunPart(kernel, adj, in, out, partials.data(), split.parts[p]);
+        }
+    });
+    spmmAddPartials(split, out, partials.data(), in.featDim);
+}
+
 void Engine::aggregateGAT(Chunk &c) {
     unsigned start = c.lowBound;
     unsigned end = c.upBound;
     PROP_TYPE dir = c.dir;
 
-    unsigned featDim;
-    FeatType **inputFTensor = NULL; // forward edge activations
-    FeatType **inputBTensor = NULL; // backward edge gradients
+    unsigned featDim = getFeatDim(c.layer);
+    // Forward edge activations: z of local vertices and of src ghosts.
+    DenseOperand zIn(savedNNTensors[c.layer - 1]["z"].getData(),
+                     savedNNTensors[c.layer - 1]["fg_z"].getData(),
+                     graph.localVtxCnt, featDim);
     FeatType *outputTensor = NULL;
-    // Forward specific
-    FeatType *featTensor = NULL;
-    // Backward specific
-    FeatType *dA = NULL;
 
     if (dir == PROP_TYPE::FORWARD) { // forward
-        featDim = getFeatDim(c.layer);
-        featTensor = getVtxFeat(savedNNTensors[c.layer - 1]["z"].getData(),
-                                start, featDim);
-        inputFTensor = savedEdgeTensors[c.layer - 1]["fedge"];
         outputTensor = savedNNTensors[c.layer - 1]["ah"].getData();
-    } else { // backward
-        featDim = getFeatDim(c.layer);
-        inputFTensor = savedEdgeTensors[c.layer - 1]["fedge"];
-        inputBTensor = savedEdgeTensors[c.layer - 1]["bedge"];
-        outputTensor = savedNNTensors[c.layer - 1]["aTg"].getData();
-        dA = savedNNTensors[c.layer - 1]["dA"].getData();
-    }
-
-    if (dir == PROP_TYPE::FORWARD) {
         FeatType *chunkPtr = getVtxFeat(outputTensor, start, featDim);
-        std::memcpy(chunkPtr, featTensor,
+        std::memcpy(chunkPtr, zIn.row(start),
                     sizeof(FeatType) * (end - start) * featDim);
-    }
-#ifdef _CPU_ENABLED_
-#pragma omp parallel for
-#endif
-    for (unsigned lvid = start; lvid < end; lvid++) {
-        // Read out data of the current layer of given vertex.
-        FeatType *currDataDst = getVtxFeat(outputTensor, lvid, featDim);
-        if (dir == PROP_TYPE::FORWARD) {
-            // Aggregate activations from incoming neighbors.
-            for (uint64_t eid = graph.forwardAdj.columnPtrs[lvid];
-                eid < graph.forwardAdj.columnPtrs[lvid + 1]; ++eid) {
-                EdgeType edgeWeight = graph.forwardAdj.values[eid];
-                for (unsigned j = 0; j < featDim; ++j) {
-                    currDataDst[j] += inputFTensor[eid][j] * edgeWeight;
-                }
-            }
-        } else {
-            // A.transpose().dot(dPred)
-            // Aggregate gradients from outgoing neighbors.
-            for (uint64_t eid = graph.backwardAdj.rowPtrs[lvid];
-                eid < graph.backwardAdj.rowPtrs[lvid + 1]; ++eid) {
-                EdgeType edgeWeight = graph.backwardAdj.values[eid];
-                for (unsigned j = 0; j < featDim; ++j) {
-                    currDataDst[j] += inputBTensor[eid][j] * edgeWeight;
-                }
-            }
-            // dA.dot(Z)
-            // Aggregate activations from incoming neighbors.
-            for (uint64_t eid = graph.forwardAdj.columnPtrs[lvid];
-                eid < graph.forwardAdj.columnPtrs[lvid + 1]; ++eid) {
-                // Note the edgeGrad here is different from other for loops
-                EdgeType edgeGrad = dA[eid];
-                for (unsigned j = 0; j < featDim; ++j) {
-                    currDataDst[j] += inputFTensor[eid][j] * edgeGrad;
-                }
-            }
-        }
+
+        // Aggregate activations from incoming neighbors.
+        SparseOperand adj(graph.forwardAdj.columnPtrs, graph.forwardAdj.rowIdxs,
+                          graph.forwardAdj.values);
+        SpMMKernel kernel = selectSpMMKernel(featDim);
+        parallelSpMM(executor, kernel, adj, zIn, outputTensor, start, end);
+    } else { // backward
+        outputTensor = savedNNTensors[c.layer - 1]["aTg"].getData();
+        // Backward edge gradients: grad of local vertices and of dst ghosts.
+        DenseOperand gradIn(savedNNTensors[c.layer - 1]["grad"].getData(),
+                            savedNNTensors[c.layer - 1]["bg_d"].getData(),
+                            graph.localVtxCnt, featDim);
+        SparseOperand adjT(graph.backwardAdj.rowPtrs, graph.backwardAdj.columnIdxs,
+                           graph.backwardAdj.values);
+        // Note the edge values here are the attention gradients dA
+        SparseOperand dAdj(graph.forwardAdj.columnPtrs, graph.forwardAdj.rowIdxs,
+                           savedNNTensors[c.layer - 1]["dA"].getData());
+        SpMMKernel kernel = selectSpMMKernel(featDim);
+        // A.transpose().dot(dPred)
+        // Aggregate gradients from outgoing neighbors.
+        parallelSpMM(executor, kernel, adjT, gradIn, outputTensor, start, end);
+        // dA.dot(Z)
+        // Aggregate activations from incoming neighbors.
+        parallelSpMM(executor, kernel, dAdj, zIn, outputTensor, start, end);
     }
 }
 #endif // _GPU_ENABLED_
@@ -290,27 +273,27 @@ void Engine::scatterGAT(Chunk &c) {
     unsigned endId = c.upBound;
     unsigned featDim = getFeatDim(featLayer);
 
-    std::map<unsigned, std::vector<unsigned>> &ghostMap =
-        c.dir == PROP_TYPE::FORWARD ? graph.forwardGhostMap
-                                    : graph.backwardGhostMap;
+    std::vector<SendPlan> &sendPlans =
+        c.dir == PROP_TYPE::FORWARD ? forwardSendPlans : backwardSendPlans;
 
     // batch sendouts similar to the sequential version
+    GhostFormat fmt = ghostFormats[ghostSlot(c.dir, ghostTensorLayer(c))];
     const unsigned BATCH_SIZE = std::max(
         (MAX_MSG_SIZE - DATA_HEADER_SIZE) /
-            (sizeof(unsigned) + sizeof(FeatType) * featDim),
+            (sizeof(unsigned) + ghostRowBytes(fmt, featDim)),
         1ul);  // at least send one vertex
-    // Create a series of buckets for batching sendout messages to nodes
-    auto *batchedIds = new std::vector<unsigned>[numNodes];
-    for (unsigned lvid = startId; lvid < endId; ++lvid) {
-        for (unsigned nid : ghostMap[lvid]) {
-            batchedIds[nid].push_back(lvid);
-        }
-    }
-
     for (unsigned nid = 0; nid < numNodes; ++nid) {
         if (nid == nodeId)
             continue;
-        unsigned ghostVCnt = batchedIds[nid].size();
+        // This chunk's slice of the node's send plan
+        SendPlan &plan = sendPlans[nid];
+        unsigned planStart = std::lower_bound(plan.lvids.begin(),
+                                              plan.lvids.end(), startId)
+                           - plan.lvids.begin();
+        unsigned planEnd = std::lower_bound(plan.lvids.begin() + planStart,
+                                            plan.lvids.end(), endId)
+                         - plan.lvids.begin();
+        unsigned ghostVCnt = planEnd - planStart;
 #if false && (defined(_CPU_ENABLED_) || defined(_GPU_ENABLED_))
 #pragma omp parallel for
 #endif
@@ -318,120 +301,120 @@ void Engine::scatterGAT(Chunk &c) {
             unsigned sendBatchSize = (ghostVCnt - ib) < BATCH_SIZE
                                    ? (ghostVCnt - ib) : BATCH_SIZE;
             verticesPushOut(nid, sendBatchSize,
-                            batchedIds[nid].data() + ib, scatterTensor,
-                            featDim, c);
-            if (!async) {
-                // recvCntLock.lock();
-                // recvCnt++;
-                // recvCntLock.unlock();
-                __sync_fetch_and_add(&recvCnt, 1);
-            }
+                            plan.lvids.data() + planStart + ib,
+                            plan.ghostIds.data() + planStart + ib,
+                            scatterTensor, featDim, c);
         }
     }
 
-    delete[] batchedIds;
+    // Hub rows leave once, down my relay tree
+    SendPlan &hubs = hubPlans[c.dir];
+    unsigned hubStart = std::lower_bound(hubs.lvids.begin(), hubs.lvids.end(),
+                                         startId) - hubs.lvids.begin();
+    unsigned hubEnd = std::lower_bound(hubs.lvids.begin() + hubStart,
+                                       hubs.lvids.end(), endId)
+                    - hubs.lvids.begin();
+    for (unsigned ib = hubStart; ib < hubEnd; ib += BATCH_SIZE) {
+        unsigned sendBatchSize = std::min(hubEnd - ib, BATCH_SIZE);
+        hubVerticesPushOut(sendBatchSize, hubs.lvids.data() + ib,
+                           hubs.ghostIds.data() + ib, scatterTensor, featDim,
+                           c);
+    }
 }
 
 void Engine::ghostReceiverGAT(unsigned tid) {
     // printLog(nodeId, "RECEIVER: Starting");
     BackoffSleeper bs;
     unsigned sender, topic;
-    FeatType *msgBuf = (FeatType *)new char[MAX_MSG_SIZE];
+    // Rows of a message each chunk reads, see ghostRowsLanded
+    std::vector<unsigned> chunkHits(waitingChunks.size(), 0);
+    // Hub rows still to pass on, see relayHubRows
+    RelayQueue relays;
 
     // While loop, looping infinitely to get the next message.
     while (true) {
-        // No message in queue.
-        if (!commManager.dataPullIn(&sender, &topic, msgBuf, MAX_MSG_SIZE)) {
-            bs.sleep();
-            if (pipelineHalt) {
+        flushHubRelays(relays);
+        zmq::message_t msg;
+        // No message in queue. Unless polling or holding relays, block on
+        // the socket a while
+        bool spin = stagePoll || !relays.empty();
+        bool got = spin ?
+            commManager.dataPullIn(&sender, &topic, msg) :
+            commManager.dataWaitIn(&sender, &topic, msg,
+                                   StageSignal::PARK_US / 1000);
+        if (!got) {
+            if (spin)
+                bs.sleep();
+            if (pipelineHalt && (relays.empty() || peersHalted)) {
                 break;
             }
             // Pull in the next message, and process this message.
         } else {
-            // A normal ghost value broadcast.
-            if (topic < MAX_IDTYPE - 1) {
-                if (!async) {
-                    // Using MAX_IDTYPE - 1 as the receive signal.
-                    commManager.dataPushOut(sender, nodeId, MAX_IDTYPE - 1, NULL, 0);
-                }
-                char *bufPtr = (char *)msgBuf;
-                unsigned recvGhostVCnt = topic;
-                unsigned featDim = *(unsigned *)bufPtr;
-                bufPtr += sizeof(unsigned);
-                unsigned layer = *(unsigned *)bufPtr;
-                bufPtr += sizeof(unsigned);
-                unsigned dir = *(unsigned *)bufPtr;
-                bufPtr += sizeof(unsigned);
-                // Get proper variables depending on forward or backward
-                std::string tensorName = dir == PROP_TYPE::FORWARD
-                                       ? "fg_z" : "bg_d";
-                std::map<unsigned, unsigned> &globalToGhostVtcs =
-                    dir == PROP_TYPE::FORWARD ? graph.srcGhostVtcs
-                                              : graph.dstGhostVtcs;
-
-                // printLog(nodeId, "RECEIVER: Got msg %u:%s", layer,
-                //   dir == PROP_TYPE::FORWARD ? "F" : "B");
-                FeatType *ghostData =
-                    savedNNTensors[layer][tensorName].getData();
-                if (ghostData == NULL) {
-                    printLog(nodeId,
-                             "RECEIVER: Coudn't find tensor '%s' for layer %u",
-                             tensorName.c_str(), layer);
-                }
-
-                // Update ghost vertices
-                for (unsigned i = 0; i < recvGhostVCnt; ++i) {
-                    unsigned gvid = *(unsigned *)bufPtr;
-                    bufPtr += sizeof(unsigned);
-                    FeatType *dataPtr = getVtxFeat(
-                        ghostData, globalToGhostVtcs[gvid] - graph.localVtxCnt,
-                        featDim);
-                    memcpy(dataPtr, bufPtr, sizeof(FeatType) * featDim);
-                    bufPtr += sizeof(FeatType) * featDim;
-                }
+            // A ghost value broadcast; the topic is its row count
+            char *bufPtr = (char *)msg.data() + DATA_MSG_HEADER_SIZE;
+            unsigned recvGhostVCnt = topic;
+            unsigned featDim = *(unsigned *)bufPtr;
+            bufPtr += sizeof(unsigned);
+            unsigned layer = *(unsigned *)bufPtr;
+            bufPtr += sizeof(unsigned);
+            unsigned dir = *(unsigned *)bufPtr;
+            bufPtr += sizeof(unsigned);
+            GhostFormat fmt = (GhostFormat)*(unsigned *)bufPtr;
+            bufPtr += sizeof(unsigned);
+            size_t rowBytes = ghostRowBytes(fmt, featDim);
+            bool hub = *(unsigned *)bufPtr;
+            bufPtr += sizeof(unsigned);
+            if (hub) {
+                relayHubRows(msg, sender, relays);
+            }
+            // Get proper variables depending on forward or backward
+            std::string tensorName = dir == PROP_TYPE::FORWARD
+                                   ? "fg_z" : "bg_d";
+
+            // printLog(nodeId, "RECEIVER: Got msg %u:%s", layer,
+            //   dir == PROP_TYPE::FORWARD ? "F" : "B");
+            FeatType *ghostData =
+                savedNNTensors[layer][tensorName].getData();
+            if (ghostData == NULL) {
+                printLog(nodeId,
+                         "RECEIVER: Coudn't find tensor '%s' for layer %u",
+                         tensorName.c_str(), layer);
+            }
 
-                if (!async) {
-                    // recvCntLock.lock();
-                    // ghostVtcsRecvd += topic;
-                    // recvCntLock.unlock();
-                    __sync_fetch_and_add(&ghostVtcsRecvd, topic);
+            // Update ghost vertices, straight from the message
+            std::vector<unsigned long long> &gPtrs = ghostChunkPtrs[dir];
+            std::vector<unsigned> &gChunks = ghostChunks[dir];
+            for (unsigned i = 0; i < recvGhostVCnt; ++i) {
+                unsigned ghostId = *(unsigned *)bufPtr;
+                bufPtr += sizeof(unsigned);
+                if (hub) {
+                    ghostId = hubGhostRow(dir, ghostId);
                 }
-
-                // A respond to a broadcast, and the topic vertex is in my local
-                // vertices. I should update the corresponding recvWaiter's
-                // value. If waiters become empty, send a signal in case the
-                // workers are waiting on it to be empty at the layer barrier.
-            } else { // (topic == MAX_IDTYPE - 1)
-                if (!async) {
-                    // recvCntLock.lock();
-                    // recvCnt--;
-                    // recvCntLock.unlock();
-                    __sync_fetch_and_add(&recvCnt, -1);
+                FeatType *dataPtr = getVtxFeat(ghostData, ghostId, featDim);
+                ghostDecodeRow(fmt, bufPtr, featDim, dataPtr);
+                bufPtr += rowBytes;
+                for (unsigned long long k = gPtrs[ghostId];
+                     k < gPtrs[ghostId + 1]; ++k) {
+                    ++chunkHits[gChunks[k]];
                 }
             }
-            unsigned totalGhostCnt = currDir == PROP_TYPE::FORWARD
-                                   ? graph.srcGhostCnt
-                                   : graph.dstGhostCnt;
 
             if (!async) {
-                recvCntLock.lock();
-                if (recvCnt == 0 && ghostVtcsRecvd == totalGhostCnt) {
-                    recvCntCond.signal();
-                }
-                recvCntLock.unlock();
+                peerRowsLanded(ghostSlot(dir, layer), sender, recvGhostVCnt);
+                ghostRowsLanded(ghostSlot(dir, layer), chunkHits);
+            } else {
+                std::fill(chunkHits.begin(), chunkHits.end(), 0);
             }
-
             bs.reset();
         }
     }
 
-    if (commManager.dataPullIn(&sender, &topic, msgBuf, MAX_MSG_SIZE)) {
+    zmq::message_t msg;
+    if (commManager.dataPullIn(&sender, &topic, msg)) {
         printLog(nodeId, "CLEAN UP: Still messages in buffer");
         // clean up
-        while (commManager.dataPullIn(&sender, &topic, msgBuf,
-                                        MAX_MSG_SIZE)) {};
+        while (commManager.dataPullIn(&sender, &topic, msg)) {};
     }
-    delete[] msgBuf;
 }
 
 void Engine::applyEdgeGAT(Chunk &c) {
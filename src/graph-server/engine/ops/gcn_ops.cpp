@@ -16,14 +16,50 @@
 #include <string>
 #include <thread>
 #include <unordered_set>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "../engine.hpp"
 #include "../../utils/utils.hpp"
+#include "spmm.hpp"
 
 #ifdef _GPU_ENABLED_
 #include "../../GPU-Computation/comp_unit.cuh"
 #endif
 
+/**
+ *
+ * Choose per GCN layer whether to aggregate first, (A·H)·W, or to transform
+ * first, A·(H·W). Either way a layer does the same dense GEMMs per epoch, so
+ * only the work that scales with the width the layer aggregates at differs:
+ * the SpMM over in- and out-edges plus the self term, and the ghost rows
+ * exchanged in both directions.
+ *
+ * H·W is computed by the previous layer's NN ahead of the scatter, which only
+ * the CPU backend does. Layer 0 always aggregates first: its weight gradient
+ * needs A·X, which is the same every epoch.
+ *
+ */
+void Engine::chooseGCNOpOrder() {
+    transformFirst.assign(numLayers, false);
+    if (gnn_type != GNN::GCN || mode != CPU || opOrder == 0)
+        return;
+
+    // Rough cost of moving one ghost feature, in edge multiply-adds.
+    const double GHOST_ELEM_COST = 16.0;
+    double costPerCol = (double)graph.localInEdgeCnt + graph.localOutEdgeCnt
+                      + 2.0 * graph.localVtxCnt
+                      + GHOST_ELEM_COST * (graph.srcGhostCnt + graph.dstGhostCnt);
+    for (unsigned layer = 1; layer < numLayers; ++layer) {
+        double aggFirstCost = costPerCol * getFeatDim(layer);
+        double transFirstCost = costPerCol * getFeatDim(layer + 1);
+        transformFirst[layer] = transFirstCost < aggFirstCost;
+        printLog(nodeId, "GCN layer %u (%u -> %u): %s", layer,
+                 getFeatDim(layer), getFeatDim(layer + 1),
+                 transformFirst[layer] ? "A(XW)" : "(AX)W");
+    }
+}
+
 void Engine::preallocateGCN() {
     unsigned vtxCnt = graph.localVtxCnt;
 
@@ -35,77 +71,160 @@ void Engine::preallocateGCN() {
         Matrix(graph.srcGhostCnt, getFeatDim(0), forwardGhostInitData);
     savedNNTensors[numLayers - 1]["lab"] =
         Matrix(vtxCnt, getFeatDim(numLayers), localVerticesLabels);
-
-    FeatType **eVFeatsTensor = srcVFeats2eFeats(
-        forwardVerticesInitData, forwardGhostInitData, vtxCnt, getFeatDim(0));
-    savedEdgeTensors[0]["fedge"] = eVFeatsTensor;
     // printLog(nodeId, "Finished storing input tensors");
 
     // forward tensor allocation
     // printLog(nodeId, "Start forward tensor allocation");
     for (int layer = 0; layer < numLayers; ++layer) {
-        unsigned featDim = getFeatDim(layer);
+        unsigned aggDim = getAggDim(layer);
         unsigned nextFeatDim = getFeatDim(layer + 1);
 
         // GATHER TENSORS
-        FeatType *ahTensor = new FeatType[vtxCnt * featDim];
-        savedNNTensors[layer]["ah"] = Matrix("ah", vtxCnt, featDim, ahTensor);
+        // A transform-first layer aggregates H·W, so "ah" already holds z.
+        FeatType *ahTensor = new FeatType[vtxCnt * aggDim];
+        savedNNTensors[layer]["ah"] = Matrix("ah", vtxCnt, aggDim, ahTensor);
         // printLog(nodeId, "Finished forward gather for %d", layer);
 
         // APPLY TENSORS
         if (layer < numLayers - 1) {
-            FeatType *zTensor = new FeatType[vtxCnt * nextFeatDim];
+            if (!transformFirst[layer]) {
+                FeatType *zTensor = new FeatType[vtxCnt * nextFeatDim];
+                savedNNTensors[layer]["z"] =
+                    Matrix(vtxCnt, nextFeatDim, zTensor);
+            }
             FeatType *hTensor = new FeatType[vtxCnt * nextFeatDim];
-
-            savedNNTensors[layer]["z"] = Matrix(vtxCnt, nextFeatDim, zTensor);
             savedNNTensors[layer]["h"] = Matrix(vtxCnt, nextFeatDim, hTensor);
             // printLog(nodeId, "Finished forward feat type for %d", layer);
 
             // SCATTER TENSORS
+            // H·W of the next layer is scattered in place of H.
+            unsigned nextAggDim = getAggDim(layer + 1);
+            if (transformFirst[layer + 1]) {
+                FeatType *hwTensor = new FeatType[vtxCnt * nextAggDim];
+                savedNNTensors[layer]["hw"] =
+                    Matrix(vtxCnt, nextAggDim, hwTensor);
+            }
             FeatType *ghostTensor =
-                new FeatType[graph.srcGhostCnt * nextFeatDim];
+                new FeatType[graph.srcGhostCnt * nextAggDim];
             savedNNTensors[layer + 1]["fg"] =
-                Matrix(graph.srcGhostCnt, nextFeatDim, ghostTensor);
-
-            FeatType **edgeTensor =
-                srcVFeats2eFeats(hTensor, ghostTensor, vtxCnt, nextFeatDim);
-            savedEdgeTensors[layer + 1]["fedge"] = edgeTensor;
-            // printLog(nodeId, "Finished forward gather for %d", layer);
+                Matrix(graph.srcGhostCnt, nextAggDim, ghostTensor);
         }
         // printLog(nodeId, "Finished forward loop for %d", layer);
     }
 
     // backward tensor allocation
     // printLog(nodeId, "Start backward tensor allocation");
+    // A transform-first layer scatters and aggregates dL/dz; W^T is applied
+    // by the NN of the layer below.
     for (int layer = numLayers - 1; layer > 0; --layer) {
-        unsigned featDim = getFeatDim(layer);
+        unsigned aggDim = getAggDim(layer);
 
         // APPLY TENSORS
-        FeatType *gradTensor = new FeatType[vtxCnt * featDim];
+        FeatType *gradTensor = new FeatType[vtxCnt * aggDim];
         savedNNTensors[layer]["grad"] =
-            Matrix("grad", vtxCnt, featDim, gradTensor);
+            Matrix("grad", vtxCnt, aggDim, gradTensor);
         // printLog(nodeId, "Finished backward apply for %d", layer);
 
         // SCATTER TENSORS
-        FeatType *ghostTensor = new FeatType[graph.dstGhostCnt * featDim];
+        FeatType *ghostTensor = new FeatType[graph.dstGhostCnt * aggDim];
         savedNNTensors[layer - 1]["bg"] =
-            Matrix(graph.dstGhostCnt, featDim, ghostTensor);
-
-        FeatType **eFeats =
-            dstVFeats2eFeats(gradTensor, ghostTensor, vtxCnt, featDim);
-        savedEdgeTensors[layer - 1]["bedge"] = eFeats;
+            Matrix(graph.dstGhostCnt, aggDim, ghostTensor);
         // printLog(nodeId, "Finished backward scatter for %d", layer);
 
         // GATHER TENSORS
-        FeatType *aTgTensor = new FeatType[vtxCnt * featDim];
-        savedNNTensors[layer - 1]["aTg"] = Matrix(vtxCnt, featDim, aTgTensor);
+        FeatType *aTgTensor = new FeatType[vtxCnt * aggDim];
+        savedNNTensors[layer - 1]["aTg"] = Matrix(vtxCnt, aggDim, aTgTensor);
         // printLog(nodeId, "Finished backward gather for %d", layer);
     }
     // printLog(nodeId, "Finished backward tensor allocation");
 }
 
+// Size and modification time of a file; zeros if it cannot be stat'ed.
+static void fileIdentity(const std::string &path, unsigned long long &size,
+                         unsigned long long &mtimeNs) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        size = mtimeNs = 0;
+        return;
+    }
+    size = st.st_size;
+    mtimeNs = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+}
+
+/**
+ *
+ * X and the layer-0 ghost rows never change during training, so neither does
+ * Â·X. Aggregate it once into "ah" of layer 0 and skip the layer-0 forward
+ * gather in every epoch. With aggCache 2 it is also kept in a cache file
+ * next to the feature cache, reused only if the graph and features files it
+ * was computed from are unchanged.
+ *
+ */
+void Engine::cacheLayer0AggGCN() {
+    unsigned featDim = getFeatDim(0);
+    Matrix &ahTensor = savedNNTensors[0]["ah"];
+    // Rows are in local ID order, which depends on the vertex order.
+    std::string reorderTag = graph.reorder == REORDER_NONE
+                           ? "" : std::string(".") + reorderTypeName(graph.reorder);
+    std::string cacheAggFile = datasetDir + "agg" + std::to_string(featDim)
+                             + reorderTag + "." + std::to_string(nodeId) + ".bin";
+    std::string graphFile =
+        datasetDir + "graph." + std::to_string(nodeId) + ".bin";
+
+    AggCacheHeaderType header;
+    memset(&header, 0, sizeof(AggCacheHeaderType));
+    header.localInEdgeCnt = graph.localInEdgeCnt;
+    header.localVtxCnt = graph.localVtxCnt;
+    header.srcGhostCnt = graph.srcGhostCnt;
+    header.featDim = featDim;
+    header.reorder = graph.reorder;
+    fileIdentity(graphFile, header.graphSize, header.graphMtimeNs);
+    fileIdentity(featuresFile, header.featsSize, header.featsMtimeNs);
+    // FNV-1a, so the hash is the same in every build
+    header.featsPathHash = 14695981039346656037ULL;
+    for (char ch : featuresFile) {
+        header.featsPathHash =
+            (header.featsPathHash ^ (unsigned char)ch) * 1099511628211ULL;
+    }
+
+    bool persist = aggCache >= 2;
+    AggCacheHeaderType fHeader;
+    std::ifstream infile;
+    if (persist) {
+        infile.open(cacheAggFile.c_str(), std::ios::binary);
+    }
+    if (persist && infile.good() &&
+        infile.read((char *)&fHeader, sizeof(AggCacheHeaderType)) &&
+        memcmp(&fHeader, &header, sizeof(AggCacheHeaderType)) == 0 &&
+        infile.read((char *)ahTensor.getData(), ahTensor.getDataSize())) {
+        printLog(nodeId, "Loaded layer-0 aggregation from %s",
+                 cacheAggFile.c_str());
+    } else {
+        Chunk all = { 0, nodeId * numLambdasForward, 0, graph.localVtxCnt, 0,
+                      PROP_TYPE::FORWARD, START_EPOCH, true };
+        aggregateGCN(all);
+
+        if (persist) {
+            // Written aside and renamed, so a reader never sees half a file
+            std::string tmpFile = cacheAggFile + ".tmp";
+            std::ofstream outfile(tmpFile.c_str(), std::ios::binary);
+            outfile.write((char *)&header, sizeof(AggCacheHeaderType));
+            outfile.write((char *)ahTensor.getData(), ahTensor.getDataSize());
+            outfile.close();
+            if (outfile.fail() ||
+                rename(tmpFile.c_str(), cacheAggFile.c_str()) != 0) {
+                printLog(nodeId, "Cannot write cache file: %s [Reason: %s]",
+                         cacheAggFile.c_str(), std::strerror(errno));
+                unlink(tmpFile.c_str());
+            }
+        }
+    }
+    layer0AggCached = true;
+}
+
 #ifdef _GPU_ENABLED_
-void Engine::aggregateGCN(Chunk &c) {
+void Engine::aggregateGCN(Chunk &c, AggRows rows) {
+    assert(rows == AGG_ALL_ROWS);
     PROP_TYPE dir = c.dir;
 
     // No edge feat tensor support for GPU. use featTensor + ghostTensor instead
@@ -139,67 +258,116 @@ void Engine::aggregateGCN(Chunk &c) {
     CuMatrix::freeGPU();
 }
 #else // !defined(_GPU_ENABLED_)
-void Engine::aggregateGCN(Chunk &c) {
+void Engine::aggregateGCN(Chunk &c, AggRows rows) {
     unsigned start = c.lowBound;
     unsigned end = c.upBound;
     PROP_TYPE dir = c.dir;
 
-    unsigned featDim;
-    FeatType *featTensor = NULL;
-    FeatType **inputTensor = NULL;
+    // Neighbor rows are read straight from the local tensor and the ghost
+    // tensor; ids >= localVtxCnt index into the ghost tensor.
+    unsigned featDim = getAggDim(c.layer);
+    FeatType *localTensor = NULL;
+    FeatType *ghostTensor = NULL;
     FeatType *outputTensor = NULL;
     if (dir == PROP_TYPE::FORWARD) { // forward
-        featDim = getFeatDim(c.layer);
-        featTensor = c.layer == 0
-                   ? getVtxFeat(savedNNTensors[c.layer]["x"].getData(),
-                                start, featDim)
-                   : getVtxFeat(savedNNTensors[c.layer - 1]["h"].getData(),
-                                start, featDim);
-        inputTensor = savedEdgeTensors[c.layer]["fedge"];  // input edgeFeatsTensor
+        localTensor = c.layer == 0
+                    ? savedNNTensors[c.layer]["x"].getData()
+                    : savedNNTensors[c.layer - 1]
+                        [transformFirst[c.layer] ? "hw" : "h"].getData();
+        ghostTensor = savedNNTensors[c.layer]["fg"].getData();
         outputTensor = savedNNTensors[c.layer]["ah"].getData(); // output aggregatedTensor
     } else { // backward
-        featDim = getFeatDim(c.layer);
-        featTensor = getVtxFeat(savedNNTensors[c.layer]["grad"].getData(),
-                                start, featDim);
-        inputTensor = savedEdgeTensors[c.layer - 1]["bedge"];
+        localTensor = savedNNTensors[c.layer]["grad"].getData();
+        ghostTensor = savedNNTensors[c.layer - 1]["bg"].getData();
         outputTensor = savedNNTensors[c.layer - 1]["aTg"].getData();
     }
-    FeatType *chunkPtr = getVtxFeat(outputTensor, start, featDim);
-    std::memcpy(chunkPtr, featTensor,
-                sizeof(FeatType) * (end - start) * featDim);
+    SparseOperand adj = dir == PROP_TYPE::FORWARD
+        ? SparseOperand(graph.forwardAdj.columnPtrs, graph.forwardAdj.rowIdxs,
+                        graph.forwardAdj.values)
+        : SparseOperand(graph.backwardAdj.rowPtrs, graph.backwardAdj.columnIdxs,
+                        graph.backwardAdj.values);
+    DenseOperand in(localTensor, ghostTensor, graph.localVtxCnt, featDim);
+    SpMMKernel kernel = selectSpMMKernel(featDim);
+    SpMMTiling tiling = selectSpMMTiling(featDim, aggTile > 1 ? aggTile : 0);
+    bool tiled = aggTile && tiling.tileCols < featDim;
+
+    // Rows to aggregate: the whole chunk, or runs of its interior or
+    // boundary rows
+    std::vector<std::pair<unsigned, unsigned>> ranges;
+    if (rows == AGG_ALL_ROWS) {
+        ranges.push_back(std::make_pair(start, end));
+    } else {
+        const std::vector<bool> &boundary = dir == PROP_TYPE::FORWARD
+                                          ? forwardBoundary : backwardBoundary;
+        bool wantBoundary = rows == AGG_BOUNDARY_ROWS;
+        for (unsigned lvid = start; lvid < end; ) {
+            if (boundary[lvid] != wantBoundary) {
+                ++lvid;
+                continue;
+            }
+            unsigned runEnd = lvid + 1;
+            while (runEnd < end && boundary[runEnd] == wantBoundary)
+                ++runEnd;
+            ranges.push_back(std::make_pair(lvid, runEnd));
+            lvid = runEnd;
+        }
+    }
 
-#ifdef _CPU_ENABLED_
-#pragma omp parallel for
-#endif
-    for (unsigned lvid = start; lvid < end; lvid++) {
-        // Read out data of the current layer of given vertex.
-        FeatType *currDataDst = getVtxFeat(outputTensor, lvid, featDim);
-        // Apply normalization factor on the current data.
-        {
+    // Output rows [lo, hi) start as the normalized self term
+    auto initRows = [&](unsigned lo, unsigned hi) {
+        if (lo == hi)
+            return;
+        std::memcpy(getVtxFeat(outputTensor, lo, featDim),
+                    getVtxFeat(localTensor, lo, featDim),
+                    sizeof(FeatType) * (hi - lo) * featDim);
+        for (unsigned lvid = lo; lvid < hi; ++lvid) {
+            FeatType *currDataDst = getVtxFeat(outputTensor, lvid, featDim);
             const EdgeType normFactor = graph.vtxDataVec[lvid];
             for (unsigned i = 0; i < featDim; ++i) {
                 currDataDst[i] *= normFactor;
             }
         }
-        // Aggregate from incoming neighbors.
-        if (dir == PROP_TYPE::FORWARD) { // using forward adj mat
-            for (uint64_t eid = graph.forwardAdj.columnPtrs[lvid];
-                eid < graph.forwardAdj.columnPtrs[lvid + 1]; ++eid) {
-                EdgeType normFactor = graph.forwardAdj.values[eid];
-                for (unsigned j = 0; j < featDim; ++j) {
-                    currDataDst[j] += inputTensor[eid][j] * normFactor;
-                }
-            }
-        } else { // using backward adj mat
-            for (uint64_t eid = graph.backwardAdj.rowPtrs[lvid];
-                eid < graph.backwardAdj.rowPtrs[lvid + 1]; ++eid) {
-                EdgeType normFactor = graph.backwardAdj.values[eid];
-                for (unsigned j = 0; j < featDim; ++j) {
-                    currDataDst[j] += inputTensor[eid][j] * normFactor;
-                }
-            }
+    };
+
+    if (tiled) {
+        // Row-blocks differ in edge count, so each is its own task.
+        std::vector<std::pair<unsigned, unsigned>> blocks;
+        for (const std::pair<unsigned, unsigned> &range : ranges) {
+            std::vector<unsigned> runBlocks =
+                spmmRowBlocks(adj, range.first, range.second, tiling.blockRows);
+            for (unsigned b = 0; b + 1 < runBlocks.size(); ++b)
+                blocks.push_back(std::make_pair(runBlocks[b], runBlocks[b + 1]));
         }
+        executor.parallelFor(0, blocks.size(), 1,
+                             [&](unsigned bLo, unsigned bHi) {
+            for (unsigned b = bLo; b < bHi; ++b) {
+                initRows(blocks[b].first, blocks[b].second);
+                spmmTiledBlock(adj, in, outputTensor, blocks[b].first,
+                               blocks[b].second, tiling.tileCols);
+            }
+        });
+        return;
+    }
+
+    // Parts of about equal nnz, one task each; hub rows are cut into
+    // segments whose partial sums are added in at the end
+    unsigned long long cost = 0;
+    for (const std::pair<unsigned, unsigned> &range : ranges) {
+        cost += adj.ptrs[range.second] - adj.ptrs[range.first] +
+                (range.second - range.first);
     }
+    SpMMSplit split = spmmSplitByNnz(adj, ranges,
+                                     executor.grain(cost, SPMM_MIN_PART_NNZ));
+    std::vector<FeatType> partials(split.partialRows.size() * featDim);
+    executor.parallelFor(0, split.parts.size(), 1,
+                         [&](unsigned pLo, unsigned pHi) {
+        for (unsigned p = pLo; p < pHi; ++p) {
+            const SpMMPart &part = split.parts[p];
+            initRows(part.rowStart, part.rowEnd);
+            spmmRunPart(kernel, adj, in, outputTensor, partials.data(), part);
+        }
+    });
+    spmmAddPartials(split, outputTensor, partials.data(), featDim);
 }
 #endif // _GPU_ENABLED
 
@@ -218,7 +386,7 @@ void Engine::scatterGCN(Chunk &c) {
     std::string tensorName;
     if (c.dir == PROP_TYPE::FORWARD) {
         outputLayer -= 1;
-        tensorName = "h";
+        tensorName = transformFirst[c.layer] ? "hw" : "h";
     } else {
         tensorName = "grad";
     }
@@ -227,29 +395,29 @@ void Engine::scatterGCN(Chunk &c) {
 
     unsigned startId = c.lowBound;
     unsigned endId = c.upBound;
-    unsigned featDim = getFeatDim(c.layer);
+    unsigned featDim = getAggDim(c.layer);
 
-    std::map<unsigned, std::vector<unsigned>> &ghostMap =
-        c.dir == PROP_TYPE::FORWARD ? graph.forwardGhostMap
-                                    : graph.backwardGhostMap;
+    std::vector<SendPlan> &sendPlans =
+        c.dir == PROP_TYPE::FORWARD ? forwardSendPlans : backwardSendPlans;
 
     // batch sendouts similar to the sequential version
+    GhostFormat fmt = ghostFormats[ghostSlot(c.dir, ghostTensorLayer(c))];
     const unsigned BATCH_SIZE = std::max(
         (MAX_MSG_SIZE - DATA_HEADER_SIZE) /
-            (sizeof(unsigned) + sizeof(FeatType) * featDim),
+            (sizeof(unsigned) + ghostRowBytes(fmt, featDim)),
         1ul);  // at least send one vertex
-    // Create a series of buckets for batching sendout messages to nodes
-    auto *batchedIds = new std::vector<unsigned>[numNodes];
-    for (unsigned lvid = startId; lvid < endId; ++lvid) {
-        for (unsigned nid : ghostMap[lvid]) {
-            batchedIds[nid].push_back(lvid);
-        }
-    }
-
     for (unsigned nid = 0; nid < numNodes; ++nid) {
         if (nid == nodeId)
             continue;
-        unsigned ghostVCnt = batchedIds[nid].size();
+        // This chunk's slice of the node's send plan
+        SendPlan &plan = sendPlans[nid];
+        unsigned planStart = std::lower_bound(plan.lvids.begin(),
+                                              plan.lvids.end(), startId)
+                           - plan.lvids.begin();
+        unsigned planEnd = std::lower_bound(plan.lvids.begin() + planStart,
+                                            plan.lvids.end(), endId)
+                         - plan.lvids.begin();
+        unsigned ghostVCnt = planEnd - planStart;
 #if defined(_GPU_ENABLED_)
 #pragma omp parallel for
 #endif
@@ -257,120 +425,120 @@ void Engine::scatterGCN(Chunk &c) {
             unsigned sendBatchSize = (ghostVCnt - ib) < BATCH_SIZE
                                    ? (ghostVCnt - ib) : BATCH_SIZE;
             verticesPushOut(nid, sendBatchSize,
-                            batchedIds[nid].data() + ib, scatterTensor,
-                            featDim, c);
-            if (!async) {
-                // recvCntLock.lock();
-                // recvCnt++;
-                // recvCntLock.unlock();
-                __sync_fetch_and_add(&recvCnt, 1);
-            }
+                            plan.lvids.data() + planStart + ib,
+                            plan.ghostIds.data() + planStart + ib,
+                            scatterTensor, featDim, c);
         }
     }
 
-    delete[] batchedIds;
+    // Hub rows leave once, down my relay tree
+    SendPlan &hubs = hubPlans[c.dir];
+    unsigned hubStart = std::lower_bound(hubs.lvids.begin(), hubs.lvids.end(),
+                                         startId) - hubs.lvids.begin();
+    unsigned hubEnd = std::lower_bound(hubs.lvids.begin() + hubStart,
+                                       hubs.lvids.end(), endId)
+                    - hubs.lvids.begin();
+    for (unsigned ib = hubStart; ib < hubEnd; ib += BATCH_SIZE) {
+        unsigned sendBatchSize = std::min(hubEnd - ib, BATCH_SIZE);
+        hubVerticesPushOut(sendBatchSize, hubs.lvids.data() + ib,
+                           hubs.ghostIds.data() + ib, scatterTensor, featDim,
+                           c);
+    }
 }
 
 void Engine::ghostReceiverGCN(unsigned tid) {
     // printLog(nodeId, "RECEIVER: Starting");
     BackoffSleeper bs;
     unsigned sender, topic;
-    FeatType *msgBuf = (FeatType *)new char[MAX_MSG_SIZE];
+    // Rows of a message each chunk reads, see ghostRowsLanded
+    std::vector<unsigned> chunkHits(waitingChunks.size(), 0);
+    // Hub rows still to pass on, see relayHubRows
+    RelayQueue relays;
 
     // While loop, looping infinitely to get the next message.
     while (true) {
-        // No message in queue.
-        if (!commManager.dataPullIn(&sender, &topic, msgBuf, MAX_MSG_SIZE)) {
-            bs.sleep();
-            if (pipelineHalt) {
+        flushHubRelays(relays);
+        zmq::message_t msg;
+        // No message in queue. Unless polling or holding relays, block on
+        // the socket a while
+        bool spin = stagePoll || !relays.empty();
+        bool got = spin ?
+            commManager.dataPullIn(&sender, &topic, msg) :
+            commManager.dataWaitIn(&sender, &topic, msg,
+                                   StageSignal::PARK_US / 1000);
+        if (!got) {
+            if (spin)
+                bs.sleep();
+            if (pipelineHalt && (relays.empty() || peersHalted)) {
                 break;
             }
             // Pull in the next message, and process this message.
         } else {
-            // A normal ghost value broadcast.
-            if (topic < MAX_IDTYPE - 1) {
-                if (!async) {
-                    // Using MAX_IDTYPE - 1 as the receive signal.
-                    commManager.dataPushOut(sender, nodeId, MAX_IDTYPE - 1, NULL, 0);
-                }
-                char *bufPtr = (char *)msgBuf;
-                unsigned recvGhostVCnt = topic;
-                unsigned featDim = *(unsigned *)bufPtr;
-                bufPtr += sizeof(unsigned);
-                unsigned layer = *(unsigned *)bufPtr;
-                bufPtr += sizeof(unsigned);
-                unsigned dir = *(unsigned *)bufPtr;
-                bufPtr += sizeof(unsigned);
-                // Get proper variables depending on forward or backward
-                std::string tensorName = dir == PROP_TYPE::FORWARD
-                                       ? "fg" : "bg";
-                std::map<unsigned, unsigned> &globalToGhostVtcs =
-                    dir == PROP_TYPE::FORWARD ? graph.srcGhostVtcs
-                                              : graph.dstGhostVtcs;
-
-                // printLog(nodeId, "RECEIVER: Got msg %u:%s", layer,
-                //   dir == PROP_TYPE::FORWARD ? "F" : "B");
-                FeatType *ghostData =
-                    savedNNTensors[layer][tensorName].getData();
-                if (ghostData == NULL) {
-                    printLog(nodeId,
-                             "RECEIVER: Coudn't find tensor '%s' for layer %u",
-                             tensorName.c_str(), layer);
-                }
-
-                // Update ghost vertices
-                for (unsigned i = 0; i < recvGhostVCnt; ++i) {
-                    unsigned gvid = *(unsigned *)bufPtr;
-                    bufPtr += sizeof(unsigned);
-                    FeatType *dataPtr = getVtxFeat(
-                        ghostData, globalToGhostVtcs[gvid] - graph.localVtxCnt,
-                        featDim);
-                    memcpy(dataPtr, bufPtr, sizeof(FeatType) * featDim);
-                    bufPtr += sizeof(FeatType) * featDim;
-                }
+            // A ghost value broadcast; the topic is its row count
+            char *bufPtr = (char *)msg.data() + DATA_MSG_HEADER_SIZE;
+            unsigned recvGhostVCnt = topic;
+            unsigned featDim = *(unsigned *)bufPtr;
+            bufPtr += sizeof(unsigned);
+            unsigned layer = *(unsigned *)bufPtr;
+            bufPtr += sizeof(unsigned);
+            unsigned dir = *(unsigned *)bufPtr;
+            bufPtr += sizeof(unsigned);
+            GhostFormat fmt = (GhostFormat)*(unsigned *)bufPtr;
+            bufPtr += sizeof(unsigned);
+            size_t rowBytes = ghostRowBytes(fmt, featDim);
+            bool hub = *(unsigned *)bufPtr;
+            bufPtr += sizeof(unsigned);
+            if (hub) {
+                relayHubRows(msg, sender, relays);
+            }
+            // Get proper variables depending on forward or backward
+            std::string tensorName = dir == PROP_TYPE::FORWARD
+                                   ? "fg" : "bg";
+
+            // printLog(nodeId, "RECEIVER: Got msg %u:%s", layer,
+            //   dir == PROP_TYPE::FORWARD ? "F" : "B");
+            FeatType *ghostData =
+                savedNNTensors[layer][tensorName].getData();
+            if (ghostData == NULL) {
+                printLog(nodeId,
+                         "RECEIVER: Coudn't find tensor '%s' for layer %u",
+                         tensorName.c_str(), layer);
+            }
 
-                if (!async) {
-                    // recvCntLock.lock();
-                    // ghostVtcsRecvd += topic;
-                    // recvCntLock.unlock();
-                    __sync_fetch_and_add(&ghostVtcsRecvd, topic);
+            // Update ghost vertices, straight from the message
+            std::vector<unsigned long long> &gPtrs = ghostChunkPtrs[dir];
+            std::vector<unsigned> &gChunks = ghostChunks[dir];
+            for (unsigned i = 0; i < recvGhostVCnt; ++i) {
+                unsigned ghostId = *(unsigned *)bufPtr;
+                bufPtr += sizeof(unsigned);
+                if (hub) {
+                    ghostId = hubGhostRow(dir, ghostId);
                 }
-
-                // A respond to a broadcast, and the topic vertex is in my local
-                // vertices. I should update the corresponding recvWaiter's
-                // value. If waiters become empty, send a signal in case the
-                // workers are waiting on it to be empty at the layer barrier.
-            } else { // (topic == MAX_IDTYPE - 1)
-                if (!async) {
-                    // recvCntLock.lock();
-                    // recvCnt--;
-                    // recvCntLock.unlock();
-                    __sync_fetch_and_add(&recvCnt, -1);
+                FeatType *dataPtr = getVtxFeat(ghostData, ghostId, featDim);
+                ghostDecodeRow(fmt, bufPtr, featDim, dataPtr);
+                bufPtr += rowBytes;
+                for (unsigned long long k = gPtrs[ghostId];
+                     k < gPtrs[ghostId + 1]; ++k) {
+                    ++chunkHits[gChunks[k]];
                 }
             }
-            unsigned totalGhostCnt = currDir == PROP_TYPE::FORWARD
-                                   ? graph.srcGhostCnt
-                                   : graph.dstGhostCnt;
 
             if (!async) {
-                recvCntLock.lock();
-                if (recvCnt == 0 && ghostVtcsRecvd == totalGhostCnt) {
-                    recvCntCond.signal();
-                }
-                recvCntLock.unlock();
+                peerRowsLanded(ghostSlot(dir, layer), sender, recvGhostVCnt);
+                ghostRowsLanded(ghostSlot(dir, layer), chunkHits);
+            } else {
+                std::fill(chunkHits.begin(), chunkHits.end(), 0);
             }
-
             bs.reset();
         }
     }
 
-    if (commManager.dataPullIn(&sender, &topic, msgBuf, MAX_MSG_SIZE)) {
+    zmq::message_t msg;
+    if (commManager.dataPullIn(&sender, &topic, msg)) {
         printLog(nodeId, "CLEAN UP: Still messages in buffer");
         // clean up
-        while (commManager.dataPullIn(&sender, &topic, msgBuf,
-                                        MAX_MSG_SIZE)) {};
+        while (commManager.dataPullIn(&sender, &topic, msg)) {};
     }
-    delete[] msgBuf;
 }
 
 void Engine::applyEdgeGCN(Chunk &chunk) {
@@ -0,0 +1,348 @@
+#include "ghost_codec.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+// Like the SpMM kernels, vector codecs are compiled with target attributes
+// and picked at runtime. Every AVX2 CPU also has F16C.
+#define AVX2_TARGET __attribute__((target("avx2,fma,f16c")))
+
+// Offset and scale of an INT8 row, then its bytes.
+static const size_t INT8_ROW_HEADER = 2 * sizeof(float);
+
+
+bool parseGhostFormat(const std::string &name, GhostFormat &fmt) {
+    if (name == "fp32")      fmt = GHOST_FP32;
+    else if (name == "fp16") fmt = GHOST_FP16;
+    else if (name == "bf16") fmt = GHOST_BF16;
+    else if (name == "int8") fmt = GHOST_INT8;
+    else return false;
+    return true;
+}
+
+const char *ghostFormatName(GhostFormat fmt) {
+    switch (fmt) {
+        case GHOST_FP32: return "fp32";
+        case GHOST_FP16: return "fp16";
+        case GHOST_BF16: return "bf16";
+        case GHOST_INT8: return "int8";
+        default:         return "unknown";
+    }
+}
+
+size_t ghostRowBytes(GhostFormat fmt, unsigned featDim) {
+    switch (fmt) {
+        case GHOST_FP16:
+        case GHOST_BF16: return sizeof(uint16_t) * featDim;
+        case GHOST_INT8: return INT8_ROW_HEADER + featDim;
+        default:         return sizeof(FeatType) * featDim;
+    }
+}
+
+
+/******************************** Scalar codecs ********************************/
+
+// Round to nearest even, like the F16C instructions.
+static inline uint16_t floatToHalf(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t absx = x & 0x7FFFFFFF;
+    if (absx >= 0x7F800000) {           // inf, NaN stays quiet NaN
+        return sign | 0x7C00 | (absx > 0x7F800000 ? 0x200 : 0);
+    }
+    if (absx >= 0x477FF000) {           // rounds past 65504
+        return sign | 0x7C00;
+    }
+    if (absx < 0x38800000) {            // half subnormal, or zero
+        if (absx < 0x33000000) {
+            return sign;
+        }
+        uint32_t shift = 126 - (absx >> 23);
+        uint32_t m = (absx & 0x7FFFFF) | 0x800000;
+        uint32_t h = m >> shift;
+        uint32_t rem = m & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (h & 1))) {
+            ++h;
+        }
+        return sign | h;
+    }
+    uint32_t h = (absx - 0x38000000) >> 13;
+    uint32_t rem = absx & 0x1FFF;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) {
+        ++h;
+    }
+    return sign | h;
+}
+
+static inline float halfToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t e = (h >> 10) & 0x1F;
+    uint32_t m = h & 0x3FF;
+    uint32_t x;
+    if (e == 0x1F) {
+        x = sign | 0x7F800000 | (m << 13);
+    } else if (e == 0) {
+        float f = m * (1.0f / 16777216.0f);
+        std::memcpy(&x, &f, sizeof(x));
+        x |= sign;
+    } else {
+        x = sign | ((e + 112) << 23) | (m << 13);
+    }
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+static inline uint16_t floatToBF16(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7FFFFFFF) > 0x7F800000) {
+        return (x >> 16) | 0x40;
+    }
+    return (x + 0x7FFF + ((x >> 16) & 1)) >> 16;
+}
+
+static inline float bf16ToFloat(uint16_t b) {
+    uint32_t x = (uint32_t)b << 16;
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+static void encodeHalfScalar(const FeatType *row, unsigned n, char *out) {
+    for (unsigned i = 0; i < n; ++i) {
+        uint16_t h = floatToHalf(row[i]);
+        std::memcpy(out + sizeof(h) * i, &h, sizeof(h));
+    }
+}
+
+static void decodeHalfScalar(const char *in, unsigned n, FeatType *row) {
+    for (unsigned i = 0; i < n; ++i) {
+        uint16_t h;
+        std::memcpy(&h, in + sizeof(h) * i, sizeof(h));
+        row[i] = halfToFloat(h);
+    }
+}
+
+static void encodeBF16Scalar(const FeatType *row, unsigned n, char *out) {
+    for (unsigned i = 0; i < n; ++i) {
+        uint16_t b = floatToBF16(row[i]);
+        std::memcpy(out + sizeof(b) * i, &b, sizeof(b));
+    }
+}
+
+static void decodeBF16Scalar(const char *in, unsigned n, FeatType *row) {
+    for (unsigned i = 0; i < n; ++i) {
+        uint16_t b;
+        std::memcpy(&b, in + sizeof(b) * i, sizeof(b));
+        row[i] = bf16ToFloat(b);
+    }
+}
+
+static void encodeInt8Scalar(const FeatType *row, unsigned n, char *out) {
+    float lo = n ? row[0] : 0.0f;
+    float hi = lo;
+    for (unsigned i = 1; i < n; ++i) {
+        lo = std::min(lo, row[i]);
+        hi = std::max(hi, row[i]);
+    }
+    float scale = (hi - lo) / 255.0f;
+    float inv = scale > 0.0f ? 1.0f / scale : 0.0f;
+    std::memcpy(out, &lo, sizeof(float));
+    std::memcpy(out + sizeof(float), &scale, sizeof(float));
+    uint8_t *q = (uint8_t *)out + INT8_ROW_HEADER;
+    for (unsigned i = 0; i < n; ++i) {
+        float v = std::nearbyint((row[i] - lo) * inv);
+        q[i] = (uint8_t)std::min(std::max(v, 0.0f), 255.0f);
+    }
+}
+
+static void decodeInt8Scalar(const char *in, unsigned n, FeatType *row) {
+    float lo, scale;
+    std::memcpy(&lo, in, sizeof(float));
+    std::memcpy(&scale, in + sizeof(float), sizeof(float));
+    const uint8_t *q = (const uint8_t *)in + INT8_ROW_HEADER;
+    for (unsigned i = 0; i < n; ++i) {
+        row[i] = lo + q[i] * scale;
+    }
+}
+
+
+/********************************* AVX2 codecs *********************************/
+
+AVX2_TARGET
+static void encodeHalfAVX2(const FeatType *row, unsigned n, char *out) {
+    unsigned i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(row + i),
+                                    _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *)(out + sizeof(uint16_t) * i), h);
+    }
+    encodeHalfScalar(row + i, n - i, out + sizeof(uint16_t) * i);
+}
+
+AVX2_TARGET
+static void decodeHalfAVX2(const char *in, unsigned n, FeatType *row) {
+    unsigned i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i *)(in + sizeof(uint16_t) * i));
+        _mm256_storeu_ps(row + i, _mm256_cvtph_ps(h));
+    }
+    decodeHalfScalar(in + sizeof(uint16_t) * i, n - i, row + i);
+}
+
+AVX2_TARGET
+static void encodeBF16AVX2(const FeatType *row, unsigned n, char *out) {
+    const __m256i bias = _mm256_set1_epi32(0x7FFF);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i quiet = _mm256_set1_epi32(0x40);
+    unsigned i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(row + i);
+        __m256i x = _mm256_castps_si256(v);
+        __m256i top = _mm256_srli_epi32(x, 16);
+        __m256i rounded = _mm256_srli_epi32(
+            _mm256_add_epi32(_mm256_add_epi32(x, bias),
+                             _mm256_and_si256(top, one)), 16);
+        __m256i nan = _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q));
+        __m256i b = _mm256_blendv_epi8(rounded, _mm256_or_si256(top, quiet), nan);
+        // Pack to 16 bits; the permute undoes the per-lane packing order.
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(b, b), 0x08);
+        _mm_storeu_si128((__m128i *)(out + sizeof(uint16_t) * i),
+                         _mm256_castsi256_si128(packed));
+    }
+    encodeBF16Scalar(row + i, n - i, out + sizeof(uint16_t) * i);
+}
+
+AVX2_TARGET
+static void decodeBF16AVX2(const char *in, unsigned n, FeatType *row) {
+    unsigned i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + sizeof(uint16_t) * i));
+        __m256i x = _mm256_slli_epi32(_mm256_cvtepu16_epi32(b), 16);
+        _mm256_storeu_ps(row + i, _mm256_castsi256_ps(x));
+    }
+    decodeBF16Scalar(in + sizeof(uint16_t) * i, n - i, row + i);
+}
+
+AVX2_TARGET
+static void encodeInt8AVX2(const FeatType *row, unsigned n, char *out) {
+    if (n < 8) {
+        encodeInt8Scalar(row, n, out);
+        return;
+    }
+    __m256 vlo = _mm256_loadu_ps(row);
+    __m256 vhi = vlo;
+    unsigned i = 8;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(row + i);
+        vlo = _mm256_min_ps(vlo, v);
+        vhi = _mm256_max_ps(vhi, v);
+    }
+    float los[8], his[8];
+    _mm256_storeu_ps(los, vlo);
+    _mm256_storeu_ps(his, vhi);
+    float lo = *std::min_element(los, los + 8);
+    float hi = *std::max_element(his, his + 8);
+    for (; i < n; ++i) {
+        lo = std::min(lo, row[i]);
+        hi = std::max(hi, row[i]);
+    }
+
+    float scale = (hi - lo) / 255.0f;
+    float inv = scale > 0.0f ? 1.0f / scale : 0.0f;
+    std::memcpy(out, &lo, sizeof(float));
+    std::memcpy(out + sizeof(float), &scale, sizeof(float));
+    uint8_t *q = (uint8_t *)out + INT8_ROW_HEADER;
+
+    const __m256 vmin = _mm256_set1_ps(lo);
+    const __m256 vinv = _mm256_set1_ps(inv);
+    const __m256 vmax = _mm256_set1_ps(255.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(row + i), vmin), vinv);
+        v = _mm256_min_ps(_mm256_max_ps(v, zero), vmax);
+        __m256i w = _mm256_cvtps_epi32(v);     // rounds to nearest even
+        // 32 -> 16 -> 8 bits; each lane ends up holding its four bytes first.
+        __m256i b = _mm256_packus_epi16(_mm256_packus_epi32(w, w),
+                                        _mm256_packus_epi32(w, w));
+        int lo4 = _mm256_extract_epi32(b, 0);
+        int hi4 = _mm256_extract_epi32(b, 4);
+        std::memcpy(q + i, &lo4, sizeof(lo4));
+        std::memcpy(q + i + 4, &hi4, sizeof(hi4));
+    }
+    for (; i < n; ++i) {
+        float v = std::nearbyint((row[i] - lo) * inv);
+        q[i] = (uint8_t)std::min(std::max(v, 0.0f), 255.0f);
+    }
+}
+
+AVX2_TARGET
+static void decodeInt8AVX2(const char *in, unsigned n, FeatType *row) {
+    float lo, scale;
+    std::memcpy(&lo, in, sizeof(float));
+    std::memcpy(&scale, in + sizeof(float), sizeof(float));
+    const uint8_t *q = (const uint8_t *)in + INT8_ROW_HEADER;
+    const __m256 vlo = _mm256_set1_ps(lo);
+    const __m256 vscale = _mm256_set1_ps(scale);
+    unsigned i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i b = _mm_loadl_epi64((const __m128i *)(q + i));
+        __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b));
+        _mm256_storeu_ps(row + i, _mm256_fmadd_ps(v, vscale, vlo));
+    }
+    for (; i < n; ++i) {
+        row[i] = lo + q[i] * scale;
+    }
+}
+
+
+/********************************** Dispatch **********************************/
+
+typedef void (*GhostEncoder)(const FeatType *, unsigned, char *);
+typedef void (*GhostDecoder)(const char *, unsigned, FeatType *);
+
+struct GhostCodecs {
+    GhostEncoder encode[NUM_GHOST_FORMATS];
+    GhostDecoder decode[NUM_GHOST_FORMATS];
+};
+
+static GhostCodecs selectGhostCodecs() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return GhostCodecs{
+            {NULL, encodeHalfAVX2, encodeBF16AVX2, encodeInt8AVX2},
+            {NULL, decodeHalfAVX2, decodeBF16AVX2, decodeInt8AVX2}};
+    }
+    return GhostCodecs{
+        {NULL, encodeHalfScalar, encodeBF16Scalar, encodeInt8Scalar},
+        {NULL, decodeHalfScalar, decodeBF16Scalar, decodeInt8Scalar}};
+}
+
+static const GhostCodecs &ghostCodecs() {
+    static const GhostCodecs codecs = selectGhostCodecs();
+    return codecs;
+}
+
+void ghostEncodeRow(GhostFormat fmt, const FeatType *row, unsigned featDim,
+                    char *out) {
+    if (fmt == GHOST_FP32) {
+        std::memcpy(out, row, sizeof(FeatType) * featDim);
+        return;
+    }
+    ghostCodecs().encode[fmt](row, featDim, out);
+}
+
+void ghostDecodeRow(GhostFormat fmt, const char *in, unsigned featDim,
+                    FeatType *row) {
+    if (fmt == GHOST_FP32) {
+        std::memcpy(row, in, sizeof(FeatType) * featDim);
+        return;
+    }
+    ghostCodecs().decode[fmt](in, featDim, row);
+}
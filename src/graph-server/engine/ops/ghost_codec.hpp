@@ -0,0 +1,34 @@
+#ifndef __GHOST_CODEC_HPP__
+#define __GHOST_CODEC_HPP__
+
+#include <cstddef>
+#include <string>
+
+#include "../../../common/utils.hpp"
+
+
+/** Wire format of the ghost rows of a message. */
+enum GhostFormat {
+    GHOST_FP32,
+    GHOST_FP16,
+    GHOST_BF16,
+    GHOST_INT8,     // float scale and offset, then a byte per feature
+    NUM_GHOST_FORMATS
+};
+
+bool parseGhostFormat(const std::string &name, GhostFormat &fmt);
+const char *ghostFormatName(GhostFormat fmt);
+
+/** Bytes of a row of featDim features on the wire. */
+size_t ghostRowBytes(GhostFormat fmt, unsigned featDim);
+
+/**
+ * Encode a row into out / decode one from in, both ghostRowBytes long and
+ * of any alignment. Vectorized where the CPU allows, picked at runtime.
+ */
+void ghostEncodeRow(GhostFormat fmt, const FeatType *row, unsigned featDim,
+                    char *out);
+void ghostDecodeRow(GhostFormat fmt, const char *in, unsigned featDim,
+                    FeatType *row);
+
+#endif // __GHOST_CODEC_HPP__
@@ -10,12 +10,13 @@ void Engine::scheduleAsyncFunc(unsigned tid) {
     const bool BLOCK = true;
     bool block = BLOCK;
 
-    BackoffSleeper bs;
+    StageWaiter waiter(schSignal, stagePoll);
     while (!pipelineHalt) {
+        waiter.arm();
         schQueue.lock();
         if (schQueue.empty()) {
             schQueue.unlock();
-            bs.sleep();
+            waiter.wait();
             continue;
         }
 
@@ -29,7 +30,7 @@ void Engine::scheduleAsyncFunc(unsigned tid) {
                 schQueue.unlock();
                 // (1.1) wait all chunks to finish
                 if (finishedChunks < numLambdasForward) {
-                    bs.sleep();
+                    waiter.wait();
                     continue;
                 } else { // (1.2) all chunks are done, exiting
                     if (async) {
@@ -46,6 +47,7 @@ void Engine::scheduleAsyncFunc(unsigned tid) {
                         asyncAvgEpochTime = totalAsyncTime / numAsyncEpochs;
                     }
                     pipelineHalt = true;
+                    wakeStages();
                     break;
                 }
             }
@@ -58,7 +60,7 @@ void Engine::scheduleAsyncFunc(unsigned tid) {
                         maxEpoch = nodeManager.syncCurrEpoch(currEpoch);
                         // printLog(nodeId, "Max epoch %u", maxEpoch);
                     } else { // block other threads if any
-                        bs.sleep();
+                        waiter.wait();
                     }
                     continue;
                 }
@@ -67,7 +69,7 @@ void Engine::scheduleAsyncFunc(unsigned tid) {
                     unsigned finishedChunks = schQueue.size();
                     schQueue.unlock();
                     if (finishedChunks < numLambdasForward) {
-                        bs.sleep();
+                        waiter.wait();
                         continue;
                     } else { // (2.3) all chunks finish, switch to sync
                         nodeManager.barrier();
@@ -75,8 +77,7 @@ void Engine::scheduleAsyncFunc(unsigned tid) {
                         printLog(nodeId, "Switch to sync from %u",
                                  maxEpoch + 1);
                         // reset scatter status
-                        recvCnt = 0;
-                        ghostVtcsRecvd = 0;
+                        resetGhostDeps();
                         // reset [min|max] epoch info
                         minEpoch = maxEpoch + 1;
                         maxEpoch = 0;
@@ -97,20 +98,34 @@ void Engine::scheduleAsyncFunc(unsigned tid) {
                 nodeManager.readEpochUpdates();
                 // block until minEpoch being updated
                 if (c.epoch > minEpoch + staleness)
-                    bs.sleep();
+                    waiter.wait();
                 continue;
             }
             // (4) Sync mode
             if (!async && block) {
                 // (4.1) Sync all chunks after a epoch
                 if (tid == 0 && schQueue.size() == numLambdasForward) {
+                    // Every chunk is between epochs, so bounds can move
+                    if (chunking == 2 && rebalanceChunks()) {
+                        std::vector<Chunk> chunks;
+                        while (!schQueue.empty()) {
+                            chunks.push_back(schQueue.top());
+                            schQueue.pop();
+                        }
+                        for (Chunk &ch : chunks) {
+                            ch.lowBound = chunkBounds[ch.localId];
+                            ch.upBound = chunkBounds[ch.localId + 1];
+                            schQueue.push(ch);
+                        }
+                        buildGhostDeps();
+                    }
                     schQueue.unlock();
                     // Only master thread will call barrier
                     nodeManager.barrier();
                     block = false;
                 } else { // Waiting all chunks finish or not master thd
                     schQueue.unlock();
-                    bs.sleep();
+                    waiter.wait();
                 }
                 continue;
             }
@@ -175,112 +190,218 @@ void Engine::scheduleAsyncFunc(unsigned tid) {
             abort();
         }
 
-        bs.reset();
+        waiter.reset();
     }
     schQueue.clear();
 }
 #pragma GCC diagnostic pop
 
-void Engine::gatherWorkFunc(unsigned tid) {
-    BackoffSleeper bs;
-    while (!pipelineHalt) {
-        GAQueue.lock();
-        if (GAQueue.empty()) {
-            GAQueue.unlock();
-            bs.sleep();
-            continue;
-        }
+// Wake every idle stage thread, e.g. to see pipelineHalt.
+void Engine::wakeStages() {
+    schSignal.ring();
+    SCSignal.ring();
+    executor.notify();
+}
 
-        Chunk c = GAQueue.top();
-        // printLog(nodeId, "GA: Got %s", c.str().c_str());
-        GAQueue.pop();
-        GAQueue.unlock();
+// Copy the top chunk of q, if any.
+static bool peekChunk(LockChunkQueue &q, Chunk &c) {
+    q.lock();
+    if (q.empty()) {
+        q.unlock();
+        return false;
+    }
+    c = q.top();
+    q.unlock();
+    return true;
+}
 
-        if (gnn_type == GNN::GCN) {
-            aggregateGCN(c);
-            // applyVertexGCN(c);
-            AVQueue.push_atomic(c);
-        } else if (gnn_type == GNN::GAT) {
-            aggregateGAT(c);
-            if (c.dir == PROP_TYPE::FORWARD &&
-                c.layer == numLayers) { // last forward layer
-                predictGAT(c);
+// Pop the top chunk of q, if any.
+static bool popChunk(LockChunkQueue &q, Chunk &c) {
+    q.lock();
+    if (q.empty()) {
+        q.unlock();
+        return false;
+    }
+    c = q.top();
+    q.pop();
+    q.unlock();
+    return true;
+}
 
-                c.dir = PROP_TYPE::BACKWARD; // switch direction
-                SCQueue.push_atomic(c);
-            } else {
-                AVQueue.push_atomic(c);
-            }
-        } else {
-            abort();
-        }
+/**
+ *
+ * Executor source: run the ready GA, AV or AE stage whose chunk comes first
+ * in Chunk order. Gathers take boundary rows first, as the next layer waits
+ * on them. AV and AE keep to one chunk at a time like their dedicated
+ * threads did. Returns false if there was nothing to run.
+ *
+ */
+bool Engine::stageTask(unsigned wid) {
+    if (pipelineHalt)
+        return false;
+
+    enum { NONE, GA, AV, AE } stage = NONE;
+    LockChunkQueue *gaQueue = NULL;
+    AggRows rows = AGG_ALL_ROWS;
+    Chunk best{}, c{};
+    if (peekChunk(GABoundaryQueue, best)) {
+        stage = GA;
+        gaQueue = &GABoundaryQueue;
+        rows = AGG_BOUNDARY_ROWS;
+    } else if (peekChunk(GAInteriorQueue, best)) {
+        stage = GA;
+        gaQueue = &GAInteriorQueue;
+        rows = AGG_INTERIOR_ROWS;
+    } else if (peekChunk(GAQueue, best)) {
+        stage = GA;
+        gaQueue = &GAQueue;
+    }
+    if (!avRunning && peekChunk(AVQueue, c) && (stage == NONE || best < c)) {
+        stage = AV;
+        best = c;
+    }
+    if (!aeRunning && peekChunk(AEQueue, c) && (stage == NONE || best < c)) {
+        stage = AE;
+        best = c;
+    }
 
-        bs.reset();
+    switch (stage) {
+        case GA:
+            // Another worker may have taken it; the caller retries
+            if (popChunk(*gaQueue, c))
+                gatherChunk(c, rows);
+            return true;
+        case AV:
+            if (!__sync_bool_compare_and_swap(&avRunning, 0, 1))
+                return true;
+            if (popChunk(AVQueue, c))
+                applyVertexChunk(c);
+            __sync_lock_release(&avRunning);
+            executor.notify();
+            return true;
+        case AE:
+            if (!__sync_bool_compare_and_swap(&aeRunning, 0, 1))
+                return true;
+            if (popChunk(AEQueue, c))
+                applyEdgeChunk(c);
+            __sync_lock_release(&aeRunning);
+            executor.notify();
+            return true;
+        default:
+            return false;
     }
-    GAQueue.clear();
 }
 
-// We could merge GA and AV since GA always calls AV
-void Engine::applyVertexWorkFunc(unsigned tid) {
-    BackoffSleeper bs;
-    while (!pipelineHalt) {
-        AVQueue.lock();
-        if (AVQueue.empty()) {
-            AVQueue.unlock();
-            bs.sleep();
-            continue;
-        }
+// Add a gather of c since stt to its time, see rebalanceChunks.
+void Engine::recordGatherTime(const Chunk &c, double stt) {
+    unsigned long long us = (getTimer() - stt) * 1000;
+    __sync_fetch_and_add(&chunkGatherTime[c.localId], us);
+}
 
-        Chunk c = AVQueue.top();
-        c.vertex = true;
-        // Note: here the chunk layer may be wrong for AVB, because AVB has a
-        // pre-barrier inside applyVertex[GCN|GAT] to update the chunk layer.
-        // printLog(nodeId, "AV: Got %s", c.str().c_str());
-        AVQueue.pop();
-        AVQueue.unlock();
-
-        if (gnn_type == GNN::GCN)
-            applyVertexGCN(c);
-        else if (gnn_type == GNN::GAT)
-            applyVertexGAT(c);
-        else
-            abort();
+// Add a call of stage on chunk key since stt to this thread's buffer.
+void Engine::recordStage(StageId stage, const Chunk &key, double stt) {
+    const size_t BUF_RESERVE = 4096;
+    static thread_local std::vector<StageSample> *buf = NULL;
+    if (buf == NULL) {
+        buf = new std::vector<StageSample>;
+        buf->reserve(BUF_RESERVE);
+        std::lock_guard<std::mutex> guard(stageBufLock);
+        stageBufs.push_back(buf);
+    }
+    buf->push_back(StageSample{key.epoch, key.layer, key.localId,
+                               (unsigned char)key.dir, (unsigned char)stage,
+                               (float)(getTimer() - stt)});
+}
 
-        bs.reset();
+void Engine::gatherChunk(Chunk &c, AggRows rows) {
+    // printLog(nodeId, "GA: Got %s", c.str().c_str());
+    double gaStt = getTimer();
+    if (gnn_type == GNN::GCN && rows != AGG_ALL_ROWS) {
+        aggregateGCN(c, rows);
+        recordGatherTime(c, gaStt);
+        recordStage(STAGE_GA, c, gaStt);
+        // Whichever of the two passes ends last moves the chunk on
+        if (__sync_sub_and_fetch(&aggPartsLeft[c.localId], 1) == 0) {
+            AVQueue.push_atomic(c);
+        }
+    } else if (gnn_type == GNN::GCN) {
+        // Layer-0 forward aggregation is cached, see cacheLayer0AggGCN
+        if (!layer0AggCached || c.layer != 0 ||
+            c.dir != PROP_TYPE::FORWARD) {
+            aggregateGCN(c);
+        }
+        recordGatherTime(c, gaStt);
+        recordStage(STAGE_GA, c, gaStt);
+        // applyVertexGCN(c);
+        AVQueue.push_atomic(c);
+    } else if (gnn_type == GNN::GAT) {
+        aggregateGAT(c);
+        recordGatherTime(c, gaStt);
+        recordStage(STAGE_GA, c, gaStt);
+        if (c.dir == PROP_TYPE::FORWARD &&
+            c.layer == numLayers) { // last forward layer
+            predictGAT(c);
+
+            c.dir = PROP_TYPE::BACKWARD; // switch direction
+            SCQueue.push_atomic(c);
+        } else {
+            AVQueue.push_atomic(c);
+        }
+    } else {
+        abort();
     }
-    AVQueue.clear();
+}
+
+// We could merge GA and AV since GA always calls AV
+void Engine::applyVertexChunk(Chunk &c) {
+    c.vertex = true;
+    // Note: here the chunk layer may be wrong for AVB, because AVB has a
+    // pre-barrier inside applyVertex[GCN|GAT] to update the chunk layer.
+    // printLog(nodeId, "AV: Got %s", c.str().c_str());
+    Chunk key = c;
+    double avStt = getTimer();
+    if (gnn_type == GNN::GCN)
+        applyVertexGCN(c);
+    else if (gnn_type == GNN::GAT)
+        applyVertexGAT(c);
+    else
+        abort();
+    recordStage(STAGE_AV, key, avStt);
 }
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-but-set-variable"
 void Engine::scatterWorkFunc(unsigned tid) {
-    BackoffSleeper bs;
+    StageWaiter waiter(SCSignal, stagePoll);
     const bool BLOCK = true;
     bool block = BLOCK;
     while (!pipelineHalt) {
+        waiter.arm();
         // Sync all nodes during scatter
         if (SCStashQueue.size() == numLambdasForward) {
             if (tid == 0) {
-                unsigned totalGhostCnt = currDir == PROP_TYPE::FORWARD
-                                       ? graph.srcGhostCnt
-                                       : graph.dstGhostCnt;
-                recvCntLock.lock();
-                while (recvCnt > 0 || ghostVtcsRecvd != totalGhostCnt) {
-                    recvCntCond.wait();
-                    // usleep(1000 * 1000);
-                }
-                recvCntLock.unlock();
-                nodeManager.barrier();
-                block = BLOCK;
-                recvCnt = 0;
-                ghostVtcsRecvd = 0;
+                // Every local chunk has scattered, so all local rows are
+                // final. Each chunk moves on as soon as the ghost rows its
+                // own in-edges read have landed, see chunkScattered. Split
+                // GCN gathers aggregate their interior rows meanwhile.
+                bool split = gnn_type == GNN::GCN && overlapInterior;
+                std::vector<Chunk> stashed;
+                SCStashQueue.lock();
                 while (!SCStashQueue.empty()) {
-                    Chunk sc = SCStashQueue.top();
+                    stashed.push_back(SCStashQueue.top());
                     SCStashQueue.pop();
-                    AEQueue.push_atomic(sc);
+                }
+                SCStashQueue.unlock();
+                block = BLOCK;
+                for (Chunk &sc : stashed) {
+                    if (split) {
+                        aggPartsLeft[sc.localId] = 2;
+                        GAInteriorQueue.push_atomic(sc);
+                    }
+                    chunkScattered(sc);
                 }
             } else {
-                bs.sleep();
+                waiter.wait();
                 continue; // other threads wait on SCQueue
             }
         }
@@ -288,14 +409,15 @@ void Engine::scatterWorkFunc(unsigned tid) {
         SCQueue.lock();
         if (SCQueue.empty()) {
             SCQueue.unlock();
-            bs.sleep();
+            waiter.wait();
             continue;
         }
-#if defined(_CPU_ENABLED_) || defined(_GPU_ENABLED_)
+#if defined(_GPU_ENABLED_)
         // A barrier for pipeline
-        // This barrier is for CPU/GPU only at the beginning of
+        // This barrier is for GPU only at the beginning of
         // the scatter phase to prevent someone send messages
-        // too early.
+        // too early. CPU NN runs per chunk, so like lambdas it
+        // scatters each chunk as soon as it is done.
         else if (block) {
             if (tid == 0 && SCQueue.size() == numLambdasForward) {
                 SCQueue.unlock();
@@ -304,7 +426,7 @@ void Engine::scatterWorkFunc(unsigned tid) {
                 SCQueue.lock();
             } else {
                 SCQueue.unlock();
-                bs.sleep();
+                waiter.wait();
                 continue;
             }
         }
@@ -320,6 +442,7 @@ void Engine::scatterWorkFunc(unsigned tid) {
         SCQueue.pop();
         SCQueue.unlock();
 
+        double scStt = getTimer();
         if (gnn_type == GNN::GCN) {
             scatterGCN(c);
         } else if (gnn_type == GNN::GAT) {
@@ -327,6 +450,7 @@ void Engine::scatterWorkFunc(unsigned tid) {
         } else {
             abort();
         }
+        recordStage(STAGE_SC, c, scStt);
 
         // Sync-Scatter for sync-pipeline and
         // the first epoch in asyn-pipeline only
@@ -336,7 +460,7 @@ void Engine::scatterWorkFunc(unsigned tid) {
             AEQueue.push_atomic(c);
         }
 
-        bs.reset();
+        waiter.reset();
     }
     SCQueue.clear();
 }
@@ -355,34 +479,20 @@ void Engine::ghostReceiverFunc(unsigned tid) {
     }
 }
 
-// Only for single thread because of the barrier
-void Engine::applyEdgeWorkFunc(unsigned tid) {
-    BackoffSleeper bs;
-    while (!pipelineHalt) {
-        AEQueue.lock();
-        if (AEQueue.empty()) {
-            AEQueue.unlock();
-            bs.sleep();
-            continue;
-        }
-
-        Chunk c = AEQueue.top();
-        c.vertex = false;
-        // printLog(nodeId, "AE: Got %s", c.str().c_str());
-        AEQueue.pop();
-        AEQueue.unlock();
-
-        if (gnn_type == GNN::GCN) {
-            applyEdgeGCN(c); // do nothing but push chunk to GAQueue
-        } else if (gnn_type == GNN::GAT) {
-            applyEdgeGAT(c);
-        } else {
-            abort();
-        }
-
-        bs.reset();
+// One chunk at a time, see stageTask
+void Engine::applyEdgeChunk(Chunk &c) {
+    c.vertex = false;
+    // printLog(nodeId, "AE: Got %s", c.str().c_str());
+    Chunk key = c;
+    double aeStt = getTimer();
+    if (gnn_type == GNN::GCN) {
+        applyEdgeGCN(c); // do nothing but push chunk to GAQueue
+    } else if (gnn_type == GNN::GAT) {
+        applyEdgeGAT(c);
+    } else {
+        abort();
     }
-    AEQueue.clear();
+    recordStage(STAGE_AE, key, aeStt);
 }
 
 // [Deprecated] Sync pipeline scheduler
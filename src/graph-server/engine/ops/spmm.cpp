@@ -0,0 +1,517 @@
+#include "spmm.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <immintrin.h>
+
+// Kernels are compiled for each ISA with target attributes and picked at
+// runtime, so one binary runs on every machine of a cluster.
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#define AVX512_TARGET __attribute__((target("avx512f")))
+
+// Columns accumulated per pass over a row's edges. Eight vector registers
+// hold the partial sums, leaving the rest for loads and the edge weight.
+static const unsigned AVX2_TILE = 64;
+static const unsigned AVX512_TILE = 128;
+
+// Source row of edge e, looked up through the dense operand.
+struct OperandSrc {
+    const unsigned *idxs;
+    const DenseOperand &in;
+
+    OperandSrc(const unsigned *_idxs, const DenseOperand &_in)
+        : idxs(_idxs), in(_in) {}
+    const FeatType *operator()(unsigned long long e) const {
+        return in.row(idxs[e]);
+    }
+};
+
+// Source row of edge e, from the row pointers gathered for a row-block.
+struct GatheredSrc {
+    const FeatType *const *rows;
+    unsigned long long base;
+
+    GatheredSrc(const FeatType *const *_rows, unsigned long long _base)
+        : rows(_rows), base(_base) {}
+    const FeatType *operator()(unsigned long long e) const {
+        return rows[e - base];
+    }
+};
+
+// Tile kernel: columns [colBegin, colEnd) of rows [start, end), with the
+// source rows gathered in srcRows (indexed by e - ptrs[start]).
+typedef void (*SpMMTileKernel)(const unsigned long long *ptrs,
+                               const EdgeType *vals,
+                               const FeatType *const *srcRows, FeatType *out,
+                               unsigned featDim, unsigned start, unsigned end,
+                               unsigned colBegin, unsigned colEnd);
+
+
+/////////////////////////////////// SCALAR ///////////////////////////////////
+template <class Src>
+static inline void
+rowRangeScalar(FeatType *dst, const Src &src, const EdgeType *vals,
+               unsigned long long eBegin, unsigned long long eEnd,
+               unsigned colBegin, unsigned colEnd) {
+    for (unsigned long long e = eBegin; e < eEnd; ++e) {
+        const FeatType *srcRow = src(e);
+        const EdgeType w = vals[e];
+        for (unsigned j = colBegin; j < colEnd; ++j) {
+            dst[j] += srcRow[j] * w;
+        }
+    }
+}
+
+template <unsigned DIM>
+static void spmmScalar(const SparseOperand &adj, const DenseOperand &in,
+                       FeatType *out, unsigned start, unsigned end) {
+    const unsigned featDim = DIM ? DIM : in.featDim;
+    OperandSrc src(adj.idxs, in);
+    for (unsigned v = start; v < end; ++v) {
+        rowRangeScalar(out + (size_t)v * featDim, src, adj.vals,
+                       adj.ptrs[v], adj.ptrs[v + 1], 0, featDim);
+    }
+}
+
+static void spmmTileScalar(const unsigned long long *ptrs, const EdgeType *vals,
+                           const FeatType *const *srcRows, FeatType *out,
+                           unsigned featDim, unsigned start, unsigned end,
+                           unsigned colBegin, unsigned colEnd) {
+    GatheredSrc src(srcRows, ptrs[start]);
+    for (unsigned v = start; v < end; ++v) {
+        rowRangeScalar(out + (size_t)v * featDim, src, vals,
+                       ptrs[v], ptrs[v + 1], colBegin, colEnd);
+    }
+}
+
+
+//////////////////////////////////// AVX2 ////////////////////////////////////
+// Accumulate NV vectors of dst starting at col over all edges of the row,
+// keeping the partial sums in registers.
+template <unsigned NV, class Src>
+AVX2_TARGET static inline void
+rowVecsAVX2(FeatType *dst, const Src &src, const EdgeType *vals,
+            unsigned long long eBegin, unsigned long long eEnd, unsigned col) {
+    __m256 acc[NV];
+    for (unsigned k = 0; k < NV; ++k) {
+        acc[k] = _mm256_loadu_ps(dst + col + 8 * k);
+    }
+    for (unsigned long long e = eBegin; e < eEnd; ++e) {
+        const FeatType *srcRow = src(e) + col;
+        const __m256 w = _mm256_set1_ps(vals[e]);
+        for (unsigned k = 0; k < NV; ++k) {
+            acc[k] = _mm256_fmadd_ps(_mm256_loadu_ps(srcRow + 8 * k), w, acc[k]);
+        }
+    }
+    for (unsigned k = 0; k < NV; ++k) {
+        _mm256_storeu_ps(dst + col + 8 * k, acc[k]);
+    }
+}
+
+// Fewer than one tile of whole vectors. nv is a constant for the fixed width
+// kernels, so the switch folds away.
+template <class Src>
+AVX2_TARGET static inline void
+rowRestAVX2(unsigned nv, FeatType *dst, const Src &src, const EdgeType *vals,
+            unsigned long long eBegin, unsigned long long eEnd, unsigned col) {
+    switch (nv) {
+        case 1: rowVecsAVX2<1>(dst, src, vals, eBegin, eEnd, col); break;
+        case 2: rowVecsAVX2<2>(dst, src, vals, eBegin, eEnd, col); break;
+        case 3: rowVecsAVX2<3>(dst, src, vals, eBegin, eEnd, col); break;
+        case 4: rowVecsAVX2<4>(dst, src, vals, eBegin, eEnd, col); break;
+        case 5: rowVecsAVX2<5>(dst, src, vals, eBegin, eEnd, col); break;
+        case 6: rowVecsAVX2<6>(dst, src, vals, eBegin, eEnd, col); break;
+        case 7: rowVecsAVX2<7>(dst, src, vals, eBegin, eEnd, col); break;
+        default: break;
+    }
+}
+
+// Last rem (< 8) columns of the row, through masked loads and stores.
+template <class Src>
+AVX2_TARGET static inline void
+rowTailAVX2(unsigned rem, FeatType *dst, const Src &src, const EdgeType *vals,
+            unsigned long long eBegin, unsigned long long eEnd, unsigned col) {
+    const __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(rem),
+                             _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256 acc = _mm256_maskload_ps(dst + col, mask);
+    for (unsigned long long e = eBegin; e < eEnd; ++e) {
+        const FeatType *srcRow = src(e) + col;
+        acc = _mm256_fmadd_ps(_mm256_maskload_ps(srcRow, mask),
+                              _mm256_set1_ps(vals[e]), acc);
+    }
+    _mm256_maskstore_ps(dst + col, mask, acc);
+}
+
+// Columns [colBegin, colEnd) of one output row: whole tiles first, then the
+// remaining vectors and the masked tail.
+template <class Src>
+AVX2_TARGET static inline void
+rowRangeAVX2(FeatType *dst, const Src &src, const EdgeType *vals,
+             unsigned long long eBegin, unsigned long long eEnd,
+             unsigned colBegin, unsigned colEnd) {
+    unsigned col = colBegin;
+    for (; col + AVX2_TILE <= colEnd; col += AVX2_TILE) {
+        rowVecsAVX2<AVX2_TILE / 8>(dst, src, vals, eBegin, eEnd, col);
+    }
+    const unsigned rest = (colEnd - col) / 8;
+    rowRestAVX2(rest, dst, src, vals, eBegin, eEnd, col);
+    col += rest * 8;
+    if (col < colEnd) {
+        rowTailAVX2(colEnd - col, dst, src, vals, eBegin, eEnd, col);
+    }
+}
+
+template <unsigned DIM>
+AVX2_TARGET static void
+spmmAVX2(const SparseOperand &adj, const DenseOperand &in, FeatType *out,
+         unsigned start, unsigned end) {
+    const unsigned featDim = DIM ? DIM : in.featDim;
+    OperandSrc src(adj.idxs, in);
+    for (unsigned v = start; v < end; ++v) {
+        const unsigned long long eBegin = adj.ptrs[v];
+        const unsigned long long eEnd = adj.ptrs[v + 1];
+        if (eBegin == eEnd) continue;
+
+        rowRangeAVX2(out + (size_t)v * featDim, src, adj.vals,
+                     eBegin, eEnd, 0, featDim);
+    }
+}
+
+AVX2_TARGET static void
+spmmTileAVX2(const unsigned long long *ptrs, const EdgeType *vals,
+             const FeatType *const *srcRows, FeatType *out, unsigned featDim,
+             unsigned start, unsigned end, unsigned colBegin, unsigned colEnd) {
+    GatheredSrc src(srcRows, ptrs[start]);
+    for (unsigned v = start; v < end; ++v) {
+        if (ptrs[v] == ptrs[v + 1]) continue;
+
+        rowRangeAVX2(out + (size_t)v * featDim, src, vals,
+                     ptrs[v], ptrs[v + 1], colBegin, colEnd);
+    }
+}
+
+
+/////////////////////////////////// AVX-512 //////////////////////////////////
+template <unsigned NV, class Src>
+AVX512_TARGET static inline void
+rowVecsAVX512(FeatType *dst, const Src &src, const EdgeType *vals,
+              unsigned long long eBegin, unsigned long long eEnd, unsigned col) {
+    __m512 acc[NV];
+    for (unsigned k = 0; k < NV; ++k) {
+        acc[k] = _mm512_loadu_ps(dst + col + 16 * k);
+    }
+    for (unsigned long long e = eBegin; e < eEnd; ++e) {
+        const FeatType *srcRow = src(e) + col;
+        const __m512 w = _mm512_set1_ps(vals[e]);
+        for (unsigned k = 0; k < NV; ++k) {
+            acc[k] = _mm512_fmadd_ps(_mm512_loadu_ps(srcRow + 16 * k), w, acc[k]);
+        }
+    }
+    for (unsigned k = 0; k < NV; ++k) {
+        _mm512_storeu_ps(dst + col + 16 * k, acc[k]);
+    }
+}
+
+template <class Src>
+AVX512_TARGET static inline void
+rowRestAVX512(unsigned nv, FeatType *dst, const Src &src, const EdgeType *vals,
+              unsigned long long eBegin, unsigned long long eEnd, unsigned col) {
+    switch (nv) {
+        case 1: rowVecsAVX512<1>(dst, src, vals, eBegin, eEnd, col); break;
+        case 2: rowVecsAVX512<2>(dst, src, vals, eBegin, eEnd, col); break;
+        case 3: rowVecsAVX512<3>(dst, src, vals, eBegin, eEnd, col); break;
+        case 4: rowVecsAVX512<4>(dst, src, vals, eBegin, eEnd, col); break;
+        case 5: rowVecsAVX512<5>(dst, src, vals, eBegin, eEnd, col); break;
+        case 6: rowVecsAVX512<6>(dst, src, vals, eBegin, eEnd, col); break;
+        case 7: rowVecsAVX512<7>(dst, src, vals, eBegin, eEnd, col); break;
+        default: break;
+    }
+}
+
+template <class Src>
+AVX512_TARGET static inline void
+rowTailAVX512(unsigned rem, FeatType *dst, const Src &src, const EdgeType *vals,
+              unsigned long long eBegin, unsigned long long eEnd, unsigned col) {
+    const __mmask16 mask = (__mmask16)((1u << rem) - 1);
+    __m512 acc = _mm512_maskz_loadu_ps(mask, dst + col);
+    for (unsigned long long e = eBegin; e < eEnd; ++e) {
+        const FeatType *srcRow = src(e) + col;
+        acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, srcRow),
+                              _mm512_set1_ps(vals[e]), acc);
+    }
+    _mm512_mask_storeu_ps(dst + col, mask, acc);
+}
+
+template <class Src>
+AVX512_TARGET static inline void
+rowRangeAVX512(FeatType *dst, const Src &src, const EdgeType *vals,
+               unsigned long long eBegin, unsigned long long eEnd,
+               unsigned colBegin, unsigned colEnd) {
+    unsigned col = colBegin;
+    for (; col + AVX512_TILE <= colEnd; col += AVX512_TILE) {
+        rowVecsAVX512<AVX512_TILE / 16>(dst, src, vals, eBegin, eEnd, col);
+    }
+    const unsigned rest = (colEnd - col) / 16;
+    rowRestAVX512(rest, dst, src, vals, eBegin, eEnd, col);
+    col += rest * 16;
+    if (col < colEnd) {
+        rowTailAVX512(colEnd - col, dst, src, vals, eBegin, eEnd, col);
+    }
+}
+
+template <unsigned DIM>
+AVX512_TARGET static void
+spmmAVX512(const SparseOperand &adj, const DenseOperand &in, FeatType *out,
+           unsigned start, unsigned end) {
+    const unsigned featDim = DIM ? DIM : in.featDim;
+    OperandSrc src(adj.idxs, in);
+    for (unsigned v = start; v < end; ++v) {
+        const unsigned long long eBegin = adj.ptrs[v];
+        const unsigned long long eEnd = adj.ptrs[v + 1];
+        if (eBegin == eEnd) continue;
+
+        rowRangeAVX512(out + (size_t)v * featDim, src, adj.vals,
+                       eBegin, eEnd, 0, featDim);
+    }
+}
+
+AVX512_TARGET static void
+spmmTileAVX512(const unsigned long long *ptrs, const EdgeType *vals,
+               const FeatType *const *srcRows, FeatType *out, unsigned featDim,
+               unsigned start, unsigned end, unsigned colBegin, unsigned colEnd) {
+    GatheredSrc src(srcRows, ptrs[start]);
+    for (unsigned v = start; v < end; ++v) {
+        if (ptrs[v] == ptrs[v + 1]) continue;
+
+        rowRangeAVX512(out + (size_t)v * featDim, src, vals,
+                       ptrs[v], ptrs[v + 1], colBegin, colEnd);
+    }
+}
+
+
+////////////////////////////////// DISPATCH //////////////////////////////////
+SpMMIsa detectSpMMIsa() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return SPMM_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return SPMM_AVX2;
+    }
+    return SPMM_SCALAR;
+}
+
+const char *spmmIsaName(SpMMIsa isa) {
+    switch (isa) {
+        case SPMM_AVX512: return "avx512";
+        case SPMM_AVX2:   return "avx2";
+        default:          return "scalar";
+    }
+}
+
+// Instantiate KERNEL for the common feature widths; 0 means generic.
+#define SELECT_BY_DIM(KERNEL, featDim)          \
+    switch (featDim) {                          \
+        case 16:  return KERNEL<16>;            \
+        case 32:  return KERNEL<32>;            \
+        case 64:  return KERNEL<64>;            \
+        case 128: return KERNEL<128>;           \
+        case 256: return KERNEL<256>;           \
+        case 602: return KERNEL<602>;           \
+        default:  return KERNEL<0>;             \
+    }
+
+SpMMKernel selectSpMMKernel(unsigned featDim, SpMMIsa isa) {
+    switch (isa) {
+        case SPMM_AVX512: SELECT_BY_DIM(spmmAVX512, featDim);
+        case SPMM_AVX2:   SELECT_BY_DIM(spmmAVX2, featDim);
+        default:          SELECT_BY_DIM(spmmScalar, featDim);
+    }
+}
+
+SpMMKernel selectSpMMKernel(unsigned featDim) {
+    static const SpMMIsa isa = detectSpMMIsa();
+    return selectSpMMKernel(featDim, isa);
+}
+
+static SpMMTileKernel selectSpMMTileKernel(SpMMIsa isa) {
+    switch (isa) {
+        case SPMM_AVX512: return spmmTileAVX512;
+        case SPMM_AVX2:   return spmmTileAVX2;
+        default:          return spmmTileScalar;
+    }
+}
+
+
+/////////////////////////////////// TILING ///////////////////////////////////
+// Narrowest tile worth a pass over a block's edges.
+static const unsigned MIN_TILE_COLS = 64;
+// Source slices a tile should keep resident, so that the sources shared by
+// the destinations of a block are read from memory once per block.
+static const unsigned MIN_BLOCK_ROWS = 4096;
+static const size_t DEFAULT_L2_SIZE = 256 * 1024;
+
+size_t detectL2CacheSize() {
+    static size_t l2Size = 0;
+    if (l2Size) {
+        return l2Size;
+    }
+
+    long sz = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (sz <= 0) { // Not reported by glibc; sysfs gives e.g. "1024K"
+        std::ifstream infile("/sys/devices/system/cpu/cpu0/cache/index2/size");
+        std::string str;
+        if (infile >> str) {
+            sz = std::strtol(str.c_str(), NULL, 10);
+            if (str.back() == 'K') sz *= 1024;
+            else if (str.back() == 'M') sz *= 1024 * 1024;
+        }
+    }
+    l2Size = sz > 0 ? (size_t)sz : DEFAULT_L2_SIZE;
+    return l2Size;
+}
+
+SpMMTiling selectSpMMTiling(unsigned featDim, unsigned tileCols) {
+    // Half of L2 holds the source slices of a block; the other half is left
+    // for the output rows, the edge arrays and the other hyperthread.
+    const size_t budget = detectL2CacheSize() / 2;
+    if (tileCols == 0) {
+        tileCols = budget / (sizeof(FeatType) * MIN_BLOCK_ROWS);
+        tileCols = std::max(tileCols / 16 * 16, MIN_TILE_COLS);
+    }
+    SpMMTiling tiling;
+    tiling.tileCols = std::min(tileCols, featDim);
+    tiling.blockRows = std::max(
+        (unsigned)(budget / (sizeof(FeatType) * tiling.tileCols)), 1u);
+    return tiling;
+}
+
+std::vector<unsigned> spmmRowBlocks(const SparseOperand &adj, unsigned start,
+                                    unsigned end, unsigned blockRows) {
+    // Grow each block until its distinct sources exceed blockRows. lastBlock
+    // remembers the block that last touched a source.
+    std::vector<unsigned> blocks;
+    std::vector<unsigned> lastBlock;
+    unsigned distinct = 0;
+    blocks.push_back(start);
+    for (unsigned v = start; v < end; ++v) {
+        unsigned degree = adj.ptrs[v + 1] - adj.ptrs[v];
+        if (v > blocks.back() && distinct + degree > blockRows) {
+            blocks.push_back(v);
+            distinct = 0;
+        }
+        const unsigned blockId = blocks.size();
+        for (unsigned long long e = adj.ptrs[v]; e < adj.ptrs[v + 1]; ++e) {
+            unsigned src = adj.idxs[e];
+            if (src >= lastBlock.size()) {
+                lastBlock.resize(std::max((size_t)src + 1, 2 * lastBlock.size()), 0);
+            }
+            if (lastBlock[src] != blockId) {
+                lastBlock[src] = blockId;
+                ++distinct;
+            }
+        }
+    }
+    blocks.push_back(end);
+    return blocks;
+}
+
+void spmmTiledBlock(const SparseOperand &adj, const DenseOperand &in,
+                    FeatType *out, unsigned start, unsigned end,
+                    unsigned tileCols) {
+    static const SpMMTileKernel kernel = selectSpMMTileKernel(detectSpMMIsa());
+    // Resolve local/ghost source rows once; every tile pass reuses them.
+    static thread_local std::vector<const FeatType *> srcRows;
+    const unsigned long long base = adj.ptrs[start];
+    srcRows.resize(adj.ptrs[end] - base);
+    for (unsigned long long e = base; e < adj.ptrs[end]; ++e) {
+        srcRows[e - base] = in.row(adj.idxs[e]);
+    }
+
+    for (unsigned col = 0; col < in.featDim; col += tileCols) {
+        kernel(adj.ptrs, adj.vals, srcRows.data(), out, in.featDim, start, end,
+               col, std::min(col + tileCols, in.featDim));
+    }
+}
+
+SpMMSplit spmmSplitByNnz(
+    const SparseOperand &adj,
+    const std::vector<std::pair<unsigned, unsigned>> &rowRanges,
+    unsigned long long nnzPerPart) {
+    SpMMSplit split;
+    nnzPerPart = std::max(nnzPerPart, 1ull);
+    auto addRows = [&](unsigned start, unsigned end) {
+        if (start < end)
+            split.parts.push_back(SpMMPart{start, end, 0, 0, SPMM_NO_PARTIAL});
+    };
+    for (const std::pair<unsigned, unsigned> &range : rowRanges) {
+        // Rows cost their edges plus one for the self term
+        unsigned runStart = range.first;
+        unsigned long long runCost = 0;
+        for (unsigned v = range.first; v < range.second; ++v) {
+            const unsigned long long degree = adj.ptrs[v + 1] - adj.ptrs[v];
+            if (degree > nnzPerPart) {
+                addRows(runStart, v);
+                unsigned long long numSegs =
+                    (degree + nnzPerPart - 1) / nnzPerPart;
+                unsigned long long segLen = (degree + numSegs - 1) / numSegs;
+                for (unsigned long long e = adj.ptrs[v]; e < adj.ptrs[v + 1];
+                     e += segLen) {
+                    unsigned long long segEnd =
+                        std::min(e + segLen, adj.ptrs[v + 1]);
+                    if (e == adj.ptrs[v]) {
+                        split.parts.push_back(
+                            SpMMPart{v, v + 1, e, segEnd, SPMM_NO_PARTIAL});
+                    } else {
+                        split.parts.push_back(SpMMPart{
+                            v, v, e, segEnd,
+                            (unsigned)split.partialRows.size()});
+                        split.partialRows.push_back(v);
+                    }
+                }
+                runStart = v + 1;
+                runCost = 0;
+                continue;
+            }
+            if (v > runStart && runCost + degree + 1 > nnzPerPart) {
+                addRows(runStart, v);
+                runStart = v;
+                runCost = 0;
+            }
+            runCost += degree + 1;
+        }
+        addRows(runStart, range.second);
+    }
+    return split;
+}
+
+void spmmRunPart(SpMMKernel kernel, const SparseOperand &adj,
+                 const DenseOperand &in, FeatType *out, FeatType *partials,
+                 const SpMMPart &part) {
+    if (part.edgeStart == part.edgeEnd) {
+        kernel(adj, in, out, part.rowStart, part.rowEnd);
+        return;
+    }
+    // One segment of a hub row, run as row 0 of a single-row operand
+    const unsigned long long ptrs[2] = {part.edgeStart, part.edgeEnd};
+    SparseOperand segment(ptrs, adj.idxs, adj.vals);
+    FeatType *dst;
+    if (part.partial == SPMM_NO_PARTIAL) {
+        dst = out + (size_t)part.rowStart * in.featDim;
+    } else {
+        dst = partials + (size_t)part.partial * in.featDim;
+        std::fill(dst, dst + in.featDim, (FeatType)0);
+    }
+    kernel(segment, in, dst, 0, 1);
+}
+
+void spmmAddPartials(const SpMMSplit &split, FeatType *out,
+                     const FeatType *partials, unsigned featDim) {
+    for (unsigned p = 0; p < split.partialRows.size(); ++p) {
+        FeatType *dst = out + (size_t)split.partialRows[p] * featDim;
+        const FeatType *src = partials + (size_t)p * featDim;
+        for (unsigned j = 0; j < featDim; ++j) {
+            dst[j] += src[j];
+        }
+    }
+}
@@ -0,0 +1,141 @@
+#ifndef __SPMM_HPP__
+#define __SPMM_HPP__
+
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+#include "../../../common/utils.hpp"
+
+
+/**
+ *
+ * Sparse operand of an aggregation. CSC columns and CSR rows share this
+ * layout: edges ptrs[v] .. ptrs[v + 1] - 1 feed output row v.
+ *
+ */
+struct SparseOperand {
+    const unsigned long long *ptrs;
+    const unsigned *idxs;
+    const EdgeType *vals;
+
+    SparseOperand(const unsigned long long *_ptrs, const unsigned *_idxs,
+                  const EdgeType *_vals)
+        : ptrs(_ptrs), idxs(_idxs), vals(_vals) {}
+};
+
+/**
+ *
+ * Dense operand of an aggregation: local vertex rows followed by ghost rows.
+ * Index i < localCnt reads local row i, otherwise ghost row i - localCnt.
+ *
+ */
+struct DenseOperand {
+    const FeatType *local;
+    const FeatType *ghost;
+    unsigned localCnt;
+    unsigned featDim;
+
+    DenseOperand(const FeatType *_local, const FeatType *_ghost,
+                 unsigned _localCnt, unsigned _featDim)
+        : local(_local), ghost(_ghost), localCnt(_localCnt), featDim(_featDim) {}
+
+    const FeatType *row(unsigned i) const {
+        return i < localCnt ? local + (size_t)i * featDim
+                            : ghost + (size_t)(i - localCnt) * featDim;
+    }
+};
+
+enum SpMMIsa { SPMM_SCALAR, SPMM_AVX2, SPMM_AVX512 };
+
+/**
+ *
+ * An SpMM kernel accumulates out[v] += sum_e vals[e] * in[idxs[e]] for every
+ * output row v in [start, end). Rows of out are featDim apart and must
+ * already hold their initial value (e.g. the normalized self term).
+ *
+ */
+typedef void (*SpMMKernel)(const SparseOperand &adj, const DenseOperand &in,
+                           FeatType *out, unsigned start, unsigned end);
+
+// Best ISA supported by the running CPU.
+SpMMIsa detectSpMMIsa();
+const char *spmmIsaName(SpMMIsa isa);
+
+// Kernel for the given feature width. Widths 16, 32, 64, 128, 256 and 602
+// get fully unrolled specializations, any other width a generic kernel.
+SpMMKernel selectSpMMKernel(unsigned featDim);
+SpMMKernel selectSpMMKernel(unsigned featDim, SpMMIsa isa);
+
+
+/**
+ *
+ * Cache-blocked aggregation. Output rows are grouped into row-blocks that
+ * read at most blockRows distinct source rows, and each block is swept one
+ * column tile at a time, so the tile slices of the block's sources stay in L2
+ * while all of its destinations consume them, instead of streaming whole wide
+ * rows for every edge.
+ *
+ */
+struct SpMMTiling {
+    unsigned tileCols;
+    unsigned blockRows;
+};
+
+size_t detectL2CacheSize();
+// Tile width and block size for featDim. tileCols == 0 sizes the tile from
+// the detected L2 cache.
+SpMMTiling selectSpMMTiling(unsigned featDim, unsigned tileCols = 0);
+// Row-block boundaries of [start, end): blocks[i] .. blocks[i + 1] - 1.
+std::vector<unsigned> spmmRowBlocks(const SparseOperand &adj, unsigned start,
+                                    unsigned end, unsigned blockRows);
+// Sweep all column tiles of one row-block; same contract as SpMMKernel.
+void spmmTiledBlock(const SparseOperand &adj, const DenseOperand &in,
+                    FeatType *out, unsigned start, unsigned end,
+                    unsigned tileCols);
+
+
+
+/**
+ *
+ * nnz-balanced split of output rows for parallel aggregation. Each part
+ * covers about nnzPerPart edges: a run of whole rows, or one edge segment of
+ * a hub row with more edges than that, so a hub no longer serializes onto
+ * one thread. A hub's first segment accumulates into its output row, the
+ * others into zeroed scratch rows that spmmAddPartials adds in once every
+ * part has run.
+ *
+ */
+#define SPMM_NO_PARTIAL ((unsigned)-1)
+// Smallest part worth a task of its own.
+#define SPMM_MIN_PART_NNZ 4096
+
+struct SpMMPart {
+    // Output rows the part owns, i.e. must set the initial value of before
+    // running it. Empty for a hub's later segments.
+    unsigned rowStart;
+    unsigned rowEnd;
+    // Edges of hub row rowStart for a segment; empty for whole rows.
+    unsigned long long edgeStart;
+    unsigned long long edgeEnd;
+    unsigned partial;    // scratch row of a later segment, or SPMM_NO_PARTIAL
+};
+
+struct SpMMSplit {
+    std::vector<SpMMPart> parts;
+    std::vector<unsigned> partialRows;  // output row of each scratch row
+};
+
+SpMMSplit spmmSplitByNnz(
+    const SparseOperand &adj,
+    const std::vector<std::pair<unsigned, unsigned>> &rowRanges,
+    unsigned long long nnzPerPart);
+// partials holds split.partialRows.size() rows of in.featDim.
+void spmmRunPart(SpMMKernel kernel, const SparseOperand &adj,
+                 const DenseOperand &in, FeatType *out, FeatType *partials,
+                 const SpMMPart &part);
+void spmmAddPartials(const SpMMSplit &split, FeatType *out,
+                     const FeatType *partials, unsigned featDim);
+
+
+#endif // __SPMM_HPP__
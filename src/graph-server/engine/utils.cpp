@@ -12,6 +12,7 @@
 #include <cmath>
 #include <cstdlib>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -156,42 +157,45 @@ void Engine::output()
     if (pipeline)
         avgDenom = static_cast<float>(numSyncEpochs * numLambdasForward);
 
-    sprintf(outBuf, "<EM>: Forward:  Time per stage:");
+    // vecTime* hold the time per epoch, summed over chunks
+    reportStageTimes();
+    reportGhostCodec();
+    sprintf(outBuf, "<EM>: Forward:  Time per stage and epoch:");
     outStream << outBuf << std::endl;
     for (unsigned i = 0; i < numLayers; ++i)
     {
         sprintf(outBuf, "<EM>    Aggregation   %2u  %.3lf ms", i,
-                vecTimeAggregate[i] / (float)avgDenom);
+                vecTimeAggregate[i]);
         outStream << outBuf << std::endl;
         sprintf(outBuf, "<EM>    ApplyVertex   %2u  %.3lf ms", i,
-                vecTimeApplyVtx[i] / (float)avgDenom);
+                vecTimeApplyVtx[i]);
         outStream << outBuf << std::endl;
         sprintf(outBuf, "<EM>    Scatter       %2u  %.3lf ms", i,
-                vecTimeScatter[i] / (float)avgDenom);
+                vecTimeScatter[i]);
         outStream << outBuf << std::endl;
         sprintf(outBuf, "<EM>    ApplyEdge     %2u  %.3lf ms", i,
-                vecTimeApplyEdg[i] / (float)avgDenom);
+                vecTimeApplyEdg[i]);
         outStream << outBuf << std::endl;
     }
     sprintf(outBuf, "<EM>: Total forward-prop time %.3lf ms",
             timeForwardProcess / (float)avgDenom);
     outStream << outBuf << std::endl;
 
-    sprintf(outBuf, "<EM>: Backward: Time per stage:");
+    sprintf(outBuf, "<EM>: Backward: Time per stage and epoch:");
     outStream << outBuf << std::endl;
     for (unsigned i = numLayers; i < 2 * numLayers; i++)
     {
         sprintf(outBuf, "<EM>    Aggregation   %2u  %.3lf ms", i,
-                vecTimeAggregate[i] / (float)avgDenom);
+                vecTimeAggregate[i]);
         outStream << outBuf << std::endl;
         sprintf(outBuf, "<EM>    ApplyVertex   %2u  %.3lf ms", i,
-                vecTimeApplyVtx[i] / (float)avgDenom);
+                vecTimeApplyVtx[i]);
         outStream << outBuf << std::endl;
         sprintf(outBuf, "<EM>    Scatter       %2u  %.3lf ms", i,
-                vecTimeScatter[i] / (float)avgDenom);
+                vecTimeScatter[i]);
         outStream << outBuf << std::endl;
         sprintf(outBuf, "<EM>    ApplyEdge     %2u  %.3lf ms", i,
-                vecTimeApplyEdg[i] / (float)avgDenom);
+                vecTimeApplyEdg[i]);
         outStream << outBuf << std::endl;
     }
     sprintf(outBuf, "<EM>: Total backward-prop time %.3lf ms",
@@ -253,43 +257,6 @@ void Engine::printEngineMetrics()
         printLog(nodeId, "<EM>: Using %u lambdas", numLambdasForward);
         printLog(nodeId, "<EM>: Initialization takes %.3lf ms", timeInit);
 
-        if (false)
-        {
-            float avgDenom = static_cast<float>(numSyncEpochs);
-            // if (pipeline) avgDenom = static_cast<float>(numSyncEpochs * numLambdasForward);
-            printLog(nodeId, "<EM>: Forward:  Time per stage:");
-            for (unsigned i = 0; i < numLayers; ++i)
-            {
-                printLog(nodeId, "<EM>    Aggregation   %2u  %.3lf ms", i,
-                         vecTimeAggregate[i] / (float)(avgDenom));
-                printLog(nodeId, "<EM>    ApplyVertex   %2u  %.3lf ms", i,
-                         vecTimeApplyVtx[i] / (float)avgDenom);
-                printLog(nodeId, "<EM>    Scatter       %2u  %.3lf ms", i,
-                         vecTimeScatter[i] / (float)avgDenom);
-                printLog(nodeId, "<EM>    ApplyEdge     %2u  %.3lf ms", i,
-                         vecTimeApplyEdg[i] / (float)avgDenom);
-            }
-            printLog(nodeId, "<EM>: Total forward-prop time %.3lf ms",
-                     timeForwardProcess / (float)avgDenom);
-
-            printLog(nodeId, "<EM>: Backward: Time per stage:");
-            for (unsigned i = numLayers; i < 2 * numLayers; i++)
-            {
-                printLog(nodeId, "<EM>    Aggregation   %2u  %.3lf ms", i,
-                         vecTimeAggregate[i] / (float)(avgDenom));
-                printLog(nodeId, "<EM>    ApplyVertex   %2u  %.3lf ms", i,
-                         vecTimeApplyVtx[i] / (float)avgDenom);
-                printLog(nodeId, "<EM>    Scatter       %2u  %.3lf ms", i,
-                         vecTimeScatter[i] / (float)avgDenom);
-                printLog(nodeId, "<EM>    ApplyEdge     %2u  %.3lf ms", i,
-                         vecTimeApplyEdg[i] / (float)avgDenom);
-            }
-            printLog(nodeId, "<EM>: Total backward-prop time %.3lf ms",
-                     timeBackwardProcess / (float)avgDenom);
-
-            printLog(nodeId, "<EM>: Final accuracy %.3lf", accuracy);
-        }
-
         printLog(nodeId, "Relaunched Lambda Cnt: %u", resComm->getRelaunchCnt());
     }
     nodeManager.barrier();
@@ -304,6 +271,160 @@ void Engine::printEngineMetrics()
     nodeManager.barrier();
     printLog(nodeId, "<EM>: Average async epoch time %.3lf ms",
              asyncAvgEpochTime);
+    nodeManager.barrier();
+    const char *stageNames[] = {"SCH", "GA", "GAI", "GAB", "AV", "SC", "AE"};
+    LockChunkQueue *stageQueues[] = {&schQueue, &GAQueue, &GAInteriorQueue,
+                                     &GABoundaryQueue, &AVQueue, &SCQueue,
+                                     &AEQueue};
+    for (unsigned i = 0; i < 7; ++i)
+    {
+        printLog(nodeId, "<EM>: %-3s queue wake time %.3lf ms over %u hops (%s)",
+                 stageNames[i], stageQueues[i]->avgWakeTime(),
+                 stageQueues[i]->wakeCount(), stagePoll ? "poll" : "park");
+    }
+}
+
+// Per-chunk time of one stage in one layer, see reportStageTimes
+struct StageSummary {
+    unsigned stage;
+    unsigned dir;
+    unsigned layer;
+    unsigned absLayer;
+    unsigned samples;
+    unsigned epochs;
+    double mean, p50, p99, max;
+    double perEpoch;
+};
+
+/**
+ *
+ * Merge the stage call times of all threads and report, per stage and
+ * layer, the mean, p50 and p99 time of one chunk in one epoch. Calls with
+ * the same (epoch, dir, layer, chunk), such as the interior and boundary
+ * passes of a split gather, count as one. Fills vecTime* with the time per
+ * epoch and writes the summary as JSON next to the output file.
+ *
+ */
+void Engine::reportStageTimes()
+{
+    std::vector<StageSample> samples;
+    stageBufLock.lock();
+    for (std::vector<StageSample> *buf : stageBufs)
+        samples.insert(samples.end(), buf->begin(), buf->end());
+    stageBufLock.unlock();
+
+    auto keyOf = [](const StageSample &s) {
+        return std::make_tuple(s.stage, s.dir, s.layer, s.epoch, s.chunk);
+    };
+    std::sort(samples.begin(), samples.end(),
+              [&](const StageSample &a, const StageSample &b) {
+                  return keyOf(a) < keyOf(b);
+              });
+    std::vector<StageSample> merged;
+    for (StageSample &s : samples) {
+        if (!merged.empty() && keyOf(merged.back()) == keyOf(s))
+            merged.back().ms += s.ms;
+        else
+            merged.push_back(s);
+    }
+
+    // Samples of one (stage, dir, layer) are contiguous, by epoch
+    std::vector<StageSummary> summaries;
+    for (size_t i = 0; i < merged.size();) {
+        const StageSample &first = merged[i];
+        StageSummary sum = {};
+        sum.stage = first.stage;
+        sum.dir = first.dir;
+        sum.layer = first.layer;
+        sum.absLayer = first.dir == PROP_TYPE::FORWARD
+                         ? first.layer : 2 * numLayers - 1 - first.layer;
+
+        std::vector<float> ms;
+        double total = 0.0;
+        size_t j = i;
+        for (; j < merged.size() && merged[j].stage == first.stage &&
+               merged[j].dir == first.dir && merged[j].layer == first.layer;
+             ++j) {
+            if (j == i || merged[j].epoch != merged[j - 1].epoch)
+                ++sum.epochs;
+            ms.push_back(merged[j].ms);
+            total += merged[j].ms;
+        }
+        i = j;
+
+        std::sort(ms.begin(), ms.end());
+        sum.samples = ms.size();
+        sum.mean = total / ms.size();
+        sum.p50 = ms[(ms.size() - 1) / 2];
+        sum.p99 = ms[(size_t)std::ceil(0.99 * ms.size()) - 1];
+        sum.max = ms.back();
+        sum.perEpoch = total / sum.epochs;
+        summaries.push_back(sum);
+    }
+    std::sort(summaries.begin(), summaries.end(),
+              [](const StageSummary &a, const StageSummary &b) {
+                  return a.absLayer != b.absLayer ? a.absLayer < b.absLayer
+                                                  : a.stage < b.stage;
+              });
+
+    std::vector<double> *stageVecs[NUM_STAGES] = {
+        &vecTimeAggregate, &vecTimeApplyVtx, &vecTimeScatter, &vecTimeApplyEdg};
+    const char *stageNames[NUM_STAGES] = {"GA", "AV", "SC", "AE"};
+    const char *dirNames[] = {"forward", "backward"};
+
+    std::string jsonFile = outFile + "_stages.json";
+    std::ofstream json(jsonFile.c_str());
+    if (!json.good())
+        printLog(nodeId, "Cannot open stage time file: %s [Reason: %s]",
+                 jsonFile.c_str(), std::strerror(errno));
+    json << "{\"node\": " << nodeId << ", \"stages\": [";
+
+    printLog(nodeId, "<EM>: Stage time per chunk and epoch "
+             "(layer, stage, chunks, mean, p50, p99, max, per epoch):");
+    char outBuf[512];
+    for (size_t i = 0; i < summaries.size(); ++i) {
+        const StageSummary &sum = summaries[i];
+        std::vector<double> &vec = *stageVecs[sum.stage];
+        if (sum.absLayer < vec.size())
+            vec[sum.absLayer] = sum.perEpoch;
+
+        printLog(nodeId, "<EM>    %2u  %s  %6u  %.3lf  %.3lf  %.3lf  %.3lf  "
+                 "%.3lf ms", sum.absLayer, stageNames[sum.stage], sum.samples,
+                 sum.mean, sum.p50, sum.p99, sum.max, sum.perEpoch);
+        sprintf(outBuf, "%s\n  {\"stage\": \"%s\", \"dir\": \"%s\", "
+                "\"layer\": %u, \"absLayer\": %u, \"samples\": %u, "
+                "\"epochs\": %u, \"meanMs\": %.3lf, \"p50Ms\": %.3lf, "
+                "\"p99Ms\": %.3lf, \"maxMs\": %.3lf, \"epochMs\": %.3lf}",
+                i ? "," : "", stageNames[sum.stage], dirNames[sum.dir],
+                sum.layer, sum.absLayer, sum.samples, sum.epochs, sum.mean,
+                sum.p50, sum.p99, sum.max, sum.perEpoch);
+        json << outBuf;
+    }
+    json << "\n]}" << std::endl;
+}
+
+/**
+ *
+ * Report, per ghost tensor sent in a reduced format, the relative RMS and
+ * max absolute error of the codec and the bytes it saved on the wire.
+ *
+ */
+void Engine::reportGhostCodec()
+{
+    std::lock_guard<std::mutex> lk(ghostStatsLock);
+    for (unsigned slot = 0; slot < ghostStats.size(); ++slot)
+    {
+        const GhostCodecStats &st = ghostStats[slot];
+        if (st.values == 0)
+            continue;
+        double relRms = st.valSq > 0.0 ? std::sqrt(st.errSq / st.valSq) : 0.0;
+        printLog(nodeId, "<EM>: Ghost tensor %s%u as %s: rel RMS error %.3e, "
+                 "max abs error %.3e, %.1lf of %.1lf MB on the wire",
+                 slot / (numLayers + 1) == PROP_TYPE::FORWARD ? "f" : "b",
+                 slot % (numLayers + 1), ghostFormatName(ghostFormats[slot]),
+                 relRms, st.maxErr, st.wireBytes / 1048576.0,
+                 st.rawBytes / 1048576.0);
+    }
 }
 
 /**
@@ -349,7 +470,16 @@ void Engine::parseArgs(int argc, char *argv[])
 
                         ("MODE", boost::program_options::value<unsigned>(), "0: Lambda, 1: GPU, 2: CPU")("pipeline", boost::program_options::value<bool>(), "0: Sequential, 1: Pipelined")("gnn", boost::program_options::value<std::string>(), "GNN type: [GCN | GAT]")("staleness", boost::program_options::value<unsigned>()->default_value(unsigned(UINT_MAX)),
                                                                                                                                                                                                                                                                          "Bound on staleness")("timeout_ratio", boost::program_options::value<unsigned>()->default_value(unsigned(1)),
-                                                                                                                                                                                                                                                                                               "How long to wait for relaunch");
+                                                                                                                                                                                                                                                                                               "How long to wait for relaunch")("aggtile", boost::program_options::value<unsigned>()->default_value(unsigned(0)),
+                                                                                                                                                                                                                                                                                               "Feature-tiled aggregation: 0: off, 1: tile width from L2 size, N: N columns per tile")("oporder", boost::program_options::value<unsigned>()->default_value(unsigned(1)),
+                                                                                                                                                                                                                                                                                               "GCN operation order: 0: always aggregate first, 1: per layer by cost")("aggcache", boost::program_options::value<unsigned>()->default_value(unsigned(1)),
+                                                                                                                                                                                                                                                                                               "Layer-0 aggregation: 0: every epoch, 1: once per run, 2: once, cached on disk across runs")("reorder", boost::program_options::value<std::string>()->default_value("none"),
+                                                                                                                                                                                                                                                                                               "Local vertex order: [none | degree | rcm | gorder]")("stagewait", boost::program_options::value<unsigned>()->default_value(unsigned(1)),
+                                                                                                                                                                                                                                                                                               "Idle pipeline stages: 0: poll with backoff, 1: park until woken")("chunking", boost::program_options::value<unsigned>()->default_value(unsigned(1)),
+                                                                                                                                                                                                                                                                                               "Chunk bounds: 0: equal vertices, 1: equal edges, 2: equal edges, rebalanced by gather time")("shmdata", boost::program_options::value<unsigned>()->default_value(unsigned(1)),
+                                                                                                                                                                                                                                                                                               "Ghost data to nodes, and weight pulls from a weight server (CPU), on the same host: 0: over TCP, 1: over shared memory")("ghostfmt", boost::program_options::value<std::string>()->default_value("fp32"),
+                                                                                                                                                                                                                                                                                               "Ghost row wire format [fp32 | fp16 | bf16 | int8], or per ghost tensor as a comma-separated list of [f|b][layer]:format")("hubtree", boost::program_options::value<unsigned>()->default_value(unsigned(0)),
+                                                                                                                                                                                                                                                                                               "Rows of vertices that are ghosts on every peer: 0: sent to each peer, N: relayed down a tree of fanout N");
 
     boost::program_options::variables_map vm;
     boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(desc).allow_unregistered().run(), vm);
@@ -403,6 +533,7 @@ void Engine::parseArgs(int argc, char *argv[])
     assert(vm.count("dataport"));
     unsigned data_port = vm["dataport"].as<unsigned>();
     commManager.setDataPort(data_port);
+    commManager.setDataLanes(dThreads); // A send lane per scatter thread
 
     assert(vm.count("ctrlport"));
     unsigned ctrl_port = vm["ctrlport"].as<unsigned>();
@@ -449,6 +580,39 @@ void Engine::parseArgs(int argc, char *argv[])
     assert(vm.count("timeout_ratio"));
     timeoutRatio = vm["timeout_ratio"].as<unsigned>();
 
+    assert(vm.count("aggtile"));
+    aggTile = vm["aggtile"].as<unsigned>();
+
+    assert(vm.count("oporder"));
+    opOrder = vm["oporder"].as<unsigned>();
+
+    assert(vm.count("aggcache"));
+    aggCache = vm["aggcache"].as<unsigned>();
+
+    assert(vm.count("chunking"));
+    chunking = vm["chunking"].as<unsigned>();
+
+    assert(vm.count("stagewait"));
+    stagePoll = vm["stagewait"].as<unsigned>() == 0;
+
+    assert(vm.count("shmdata"));
+    commManager.setShmData(vm["shmdata"].as<unsigned>() != 0);
+
+    assert(vm.count("hubtree"));
+    hubFanout = vm["hubtree"].as<unsigned>();
+
+    assert(vm.count("ghostfmt"));
+    ghostFormatSpec = vm["ghostfmt"].as<std::string>();
+
+    assert(vm.count("reorder"));
+    std::string reorder_name = vm["reorder"].as<std::string>();
+    reorder = parseReorderType(reorder_name);
+    if (reorder == (ReorderType)-1)
+    {
+        std::cerr << "Unsupported vertex order: " << reorder_name << std::endl;
+        exit(-1);
+    }
+
     printLog(404, "Parsed configuration: dThreads = %u, cThreads = %u, datasetDir = %s, featuresFile = %s, dshMachinesFile = %s, "
                   "myPrIpFile = %s, undirected = %s, data port set -> %u, control port set -> %u, node port set -> %u",
              dThreads, cThreads, datasetDir.c_str(), featuresFile.c_str(), dshMachinesFile.c_str(),
@@ -493,9 +657,11 @@ void Engine::readLayerConfigFile(std::string &layerConfigFileName)
 void Engine::readFeaturesFile(std::string &featuresFileName)
 {
     bool cache = true;
+    // Cached rows are in local ID order, which depends on the vertex order.
+    std::string reorderTag = graph.reorder == REORDER_NONE ? "" : std::string(".") + reorderTypeName(graph.reorder);
     if (cache)
     {
-        std::string cacheFeatsFile = datasetDir + "feats" + std::to_string(layerConfig[0]) + "." + std::to_string(nodeId) + ".bin";
+        std::string cacheFeatsFile = datasetDir + "feats" + std::to_string(layerConfig[0]) + reorderTag + "." + std::to_string(nodeId) + ".bin";
         std::ifstream infile(cacheFeatsFile.c_str());
         if (!infile.good())
         {
@@ -520,38 +686,50 @@ void Engine::readFeaturesFile(std::string &featuresFileName)
     infile.read((char *)&fHeader, sizeof(FeaturesHeaderType));
     assert(fHeader.numFeatures == layerConfig[0]);
 
-    unsigned gvid = 0;
-
     unsigned featDim = fHeader.numFeatures;
-    std::vector<FeatType> feature_vec;
-
-    feature_vec.resize(featDim);
-    while (infile.read(reinterpret_cast<char *>(&feature_vec[0]),
-                       sizeof(FeatType) * featDim))
+    const std::streamoff rowBytes = sizeof(FeatType) * featDim;
+    infile.seekg(0, std::ios::end);
+    assert(infile.tellg() == (std::streamoff)sizeof(FeaturesHeaderType) + rowBytes * graph.globalVtxCnt);
+
+    // Both ID tables are sorted by global ID, so one merged sweep visits my
+    // local / ghost vertices in file order. Rows of other vertices are
+    // skipped over instead of read and looked up.
+    unsigned ghostPos = 0;
+    unsigned localPos = 0;
+    unsigned filePos = UINT_MAX;
+    while (ghostPos < graph.srcGhostCnt || localPos < graph.localVtxCnt)
     {
-        // Set the vertex's initial values, if it is one of my local vertices /
-        // ghost vertices.
-        if (graph.containsSrcGhostVtx(gvid))
+        unsigned gvid;
+        FeatType *actDataPtr;
+        if (localPos == graph.localVtxCnt ||
+            (ghostPos < graph.srcGhostCnt &&
+             graph.srcGhostVtcs.gvidAt(ghostPos) < graph.globaltoLocalId.gvidAt(localPos)))
         { // Ghost vertex.
-            FeatType *actDataPtr = getVtxFeat(
-                forwardGhostInitData,
-                graph.srcGhostVtcs[gvid] - graph.localVtxCnt, featDim);
-            memcpy(actDataPtr, feature_vec.data(), featDim * sizeof(FeatType));
+            gvid = graph.srcGhostVtcs.gvidAt(ghostPos);
+            actDataPtr = getVtxFeat(forwardGhostInitData,
+                                    graph.srcGhostVtcs.idAt(ghostPos) - graph.localVtxCnt, featDim);
+            ++ghostPos;
         }
-        else if (graph.containsVtx(gvid))
+        else
         { // Local vertex.
-            FeatType *actDataPtr = getVtxFeat(
-                forwardVerticesInitData, graph.globaltoLocalId[gvid], featDim);
-            memcpy(actDataPtr, feature_vec.data(), featDim * sizeof(FeatType));
+            gvid = graph.globaltoLocalId.gvidAt(localPos);
+            actDataPtr = getVtxFeat(forwardVerticesInitData,
+                                    graph.globaltoLocalId.idAt(localPos), featDim);
+            ++localPos;
         }
-        ++gvid;
+        if (gvid != filePos)
+        {
+            infile.seekg(sizeof(FeaturesHeaderType) + rowBytes * gvid);
+        }
+        infile.read(reinterpret_cast<char *>(actDataPtr), rowBytes);
+        assert(infile.good());
+        filePos = gvid + 1;
     }
     infile.close();
-    assert(gvid == graph.globalVtxCnt);
 
     if (cache)
     {
-        std::string cacheFeatsFile = datasetDir + "feats" + std::to_string(layerConfig[0]) + "." + std::to_string(nodeId) + ".bin";
+        std::string cacheFeatsFile = datasetDir + "feats" + std::to_string(layerConfig[0]) + reorderTag + "." + std::to_string(nodeId) + ".bin";
         std::ifstream infile(cacheFeatsFile.c_str());
         if (infile.good())
         {
@@ -595,11 +773,13 @@ void Engine::readLabelsFile(std::string &labelsFileName)
     unsigned curr;
     FeatType one_hot_arr[lKinds] = {0};
 
+    // Local global IDs are sorted, so a cursor replaces per-vertex lookups.
+    unsigned localPos = 0;
     while (infile.read(reinterpret_cast<char *>(&curr), sizeof(unsigned)))
     {
         // Set the vertex's label values, if it is one of my local vertices & is
         // labeled.
-        if (graph.containsVtx(gvid))
+        if (localPos < graph.localVtxCnt && graph.globaltoLocalId.gvidAt(localPos) == gvid)
         {
             // Convert into a one-hot array.
             assert(curr < lKinds);
@@ -607,8 +787,9 @@ void Engine::readLabelsFile(std::string &labelsFileName)
             one_hot_arr[curr] = 1.0;
 
             FeatType *labelPtr =
-                localVertexLabelsPtr(graph.globaltoLocalId[gvid]);
+                localVertexLabelsPtr(graph.globaltoLocalId.idAt(localPos));
             memcpy(labelPtr, one_hot_arr, lKinds * sizeof(FeatType));
+            ++localPos;
         }
 
         ++gvid;
@@ -619,19 +800,133 @@ void Engine::readLabelsFile(std::string &labelsFileName)
     assert(gvid == graph.globalVtxCnt);
 }
 
-void Engine::loadChunks()
+// Cost of a local vertex relative to one in-edge in chunk balancing: its own
+// row in the gather plus its share of the per-chunk NN.
+#define CHUNK_VTX_COST 2.0
+// Rebalance once the slowest chunk gathers this much slower than the mean.
+#define CHUNK_REBALANCE_SLACK 1.1
+
+/**
+ *
+ * Static cost of local vertices [0, lvid): their in-edges from the forward
+ * adjacency's column pointers, plus CHUNK_VTX_COST per vertex.
+ *
+ */
+double Engine::chunkCost(unsigned lvid)
+{
+    return (double)graph.forwardAdj.columnPtrs[lvid] + CHUNK_VTX_COST * lvid;
+}
+
+/**
+ *
+ * Cut the local vertices into numLambdasForward ranges of about equal cost.
+ * costPrefix(v) is the cost of vertices [0, v) and must not decrease. Every
+ * chunk keeps at least one vertex if there are enough.
+ *
+ */
+void Engine::cutChunks(const std::function<double(unsigned)> &costPrefix)
 {
     unsigned vtcsCnt = graph.localVtxCnt;
-    for (unsigned cid = 0; cid < numLambdasForward; ++cid)
+    unsigned numChunks = numLambdasForward;
+    double total = costPrefix(vtcsCnt);
+    std::vector<unsigned> bounds(1, 0);
+    for (unsigned cid = 1; cid < numChunks; ++cid)
+    {
+        // First vertex at which the prefix reaches the cid-th share
+        double target = total * cid / numChunks;
+        unsigned lo = bounds.back(), hi = vtcsCnt;
+        while (lo < hi)
+        {
+            unsigned mid = lo + (hi - lo) / 2;
+            if (costPrefix(mid) < target)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        unsigned minCut = std::min(bounds.back() + 1, vtcsCnt);
+        unsigned maxCut = vtcsCnt > numChunks - cid
+                        ? vtcsCnt - (numChunks - cid) : vtcsCnt;
+        maxCut = std::max(maxCut, minCut);
+        bounds.push_back(std::min(std::max(lo, minCut), maxCut));
+    }
+    bounds.push_back(vtcsCnt);
+    chunkBounds.swap(bounds);
+}
+
+/**
+ *
+ * Cut the local vertices into numLambdasForward chunks, by vertex count or
+ * by static cost, see chunking.
+ *
+ */
+void Engine::computeChunkBounds()
+{
+    if (chunking == 0)
+    {
+        cutChunks([](unsigned lvid) { return (double)lvid; });
+    }
+    else
+    {
+        cutChunks([this](unsigned lvid) { return chunkCost(lvid); });
+    }
+    chunkGatherTime.assign(numLambdasForward, 0);
+}
+
+/**
+ *
+ * Move chunk boundaries so measured gather time evens out: each chunk's
+ * time is spread over its vertices by static cost, and the local vertices
+ * are recut at equal shares of the total. Chunk IDs and count stay, so do
+ * the weight servers and lambdas each chunk maps to. Only valid while every
+ * chunk sits between epochs. Returns whether the bounds moved.
+ *
+ */
+bool Engine::rebalanceChunks()
+{
+    unsigned numChunks = numLambdasForward;
+    std::vector<double> timeBefore(numChunks + 1, 0.0);
+    std::vector<double> rate(numChunks, 0.0);
+    double maxTime = 0.0;
+    for (unsigned cid = 0; cid < numChunks; ++cid)
     {
-        unsigned chunkSize =
-            (vtcsCnt + numLambdasForward - 1) / numLambdasForward;
-        unsigned lowBound = cid * chunkSize;
-        unsigned upBound = std::min(lowBound + chunkSize, vtcsCnt);
+        double time = (double)chunkGatherTime[cid];
+        chunkGatherTime[cid] = 0;
+        double cost = chunkCost(chunkBounds[cid + 1]) -
+                      chunkCost(chunkBounds[cid]);
+        rate[cid] = cost > 0.0 ? time / cost : 0.0;
+        timeBefore[cid + 1] = timeBefore[cid] + time;
+        maxTime = std::max(maxTime, time);
+    }
+    double total = timeBefore[numChunks];
+    if (total == 0.0 || maxTime * numChunks < total * CHUNK_REBALANCE_SLACK)
+        return false;
+
+    std::vector<unsigned> oldBounds = chunkBounds;
+    cutChunks([&](unsigned lvid)
+              {
+                  unsigned cid = std::upper_bound(oldBounds.begin(),
+                                                  oldBounds.end(), lvid) -
+                                 oldBounds.begin() - 1;
+                  cid = std::min(cid, numChunks - 1);
+                  return timeBefore[cid] +
+                         rate[cid] * (chunkCost(lvid) -
+                                      chunkCost(oldBounds[cid]));
+              });
+    if (chunkBounds == oldBounds)
+        return false;
+
+    printLog(nodeId, "Rebalanced chunks, slowest gathered %.2lfx the mean",
+             maxTime * numChunks / total);
+    return true;
+}
 
+void Engine::loadChunks()
+{
+    for (unsigned cid = 0; cid < numLambdasForward; ++cid)
+    {
         schQueue.push(Chunk{cid, nodeId * numLambdasForward + cid,
-                            lowBound, upBound, 0, PROP_TYPE::FORWARD,
-                            START_EPOCH + 1, true});
+                            chunkBounds[cid], chunkBounds[cid + 1], 0,
+                            PROP_TYPE::FORWARD, START_EPOCH + 1, true});
     }
 
     currEpoch = START_EPOCH;
@@ -646,108 +941,643 @@ void Engine::loadChunks()
 }
 
 /********************************* SC utils *********************************/
-void Engine::verticesPushOut(unsigned receiver, unsigned totCnt,
-                             unsigned *lvids, FeatType *inputTensor,
-                             unsigned featDim, Chunk &c)
-{
-    zmq::message_t msg(DATA_HEADER_SIZE +
-                       (sizeof(unsigned) + sizeof(FeatType) * featDim) *
-                           totCnt);
-    char *msgPtr = (char *)(msg.data());
-    sprintf(msgPtr, NODE_ID_HEADER, receiver);
-    msgPtr += NODE_ID_DIGITS;
-    unsigned featLayer = 0;
-    if (gnn_type == GNN::GCN)
-    { // YIFAN: fix this
-        featLayer = c.dir == PROP_TYPE::FORWARD
-                        ? c.layer
-                        : c.layer - 1;
+/**
+ *
+ * Build the forward and backward send plans of every remote node: the local
+ * vertices scattered to it and their rows in its ghost tensors, so scatter
+ * sends ghost IDs instead of global IDs and receivers copy rows in without
+ * a lookup. Each node sends every peer the global IDs it will send it, in
+ * plan order, and answers the peers' requests from its own ghost tables.
+ *
+ */
+void Engine::buildSendPlans()
+{
+    forwardSendPlans.assign(numNodes, SendPlan());
+    backwardSendPlans.assign(numNodes, SendPlan());
+    peerGhostRows[0].assign(numNodes, 0);
+    peerGhostRows[1].assign(numNodes, 0);
+    if (numNodes == 1)
+        return;
+
+    std::vector<SendPlan> *plans[2] = {&forwardSendPlans, &backwardSendPlans};
+    VertexNodesMap *ghostMaps[2] = {&graph.forwardGhostMap,
+                                    &graph.backwardGhostMap};
+    // Forward sends land in the receiver's src ghosts, backward in its dst.
+    SortedIdMap *ghostTables[2] = {&graph.srcGhostVtcs, &graph.dstGhostVtcs};
+
+    for (unsigned d = 0; d < 2; ++d)
+    {
+        for (unsigned lvid = 0; lvid < graph.localVtxCnt; ++lvid)
+        {
+            for (unsigned nid : (*ghostMaps[d])[lvid])
+            {
+                (*plans[d])[nid].lvids.push_back(lvid);
+            }
+        }
     }
-    else if (gnn_type == GNN::GAT)
+
+    // Request: forward count, backward count, then the global IDs.
+    for (unsigned nid = 0; nid < numNodes; ++nid)
     {
-        featLayer = c.layer - 1;
+        if (nid == nodeId)
+            continue;
+        std::vector<unsigned> &fwd = forwardSendPlans[nid].lvids;
+        std::vector<unsigned> &bwd = backwardSendPlans[nid].lvids;
+        std::vector<unsigned> msg;
+        msg.reserve(2 + fwd.size() + bwd.size());
+        msg.push_back(fwd.size());
+        msg.push_back(bwd.size());
+        for (unsigned lvid : fwd)
+            msg.push_back(graph.localToGlobalId[lvid]);
+        for (unsigned lvid : bwd)
+            msg.push_back(graph.localToGlobalId[lvid]);
+        commManager.controlPushOut(nid, msg.data(),
+                                   sizeof(unsigned) * msg.size());
     }
-    populateHeader(msgPtr, nodeId, totCnt, featDim, featLayer, c.dir);
-    msgPtr += sizeof(unsigned) * 5;
 
-    for (unsigned i = 0; i < totCnt; ++i)
+    // A peer's request always reaches us before its reply, which it only
+    // sends after getting ours.
+    std::vector<bool> requestSeen(numNodes, false);
+    unsigned remaining = 2 * (numNodes - 1);
+    BackoffSleeper bs;
+    while (remaining > 0)
     {
-        *(unsigned *)msgPtr = graph.localToGlobalId[lvids[i]];
-        msgPtr += sizeof(unsigned);
-        FeatType *dataPtr = getVtxFeat(inputTensor, lvids[i], featDim);
-        memcpy(msgPtr, dataPtr, sizeof(FeatType) * featDim);
-        msgPtr += sizeof(FeatType) * featDim;
+        bool got = false;
+        for (unsigned nid = 0; nid < numNodes; ++nid)
+        {
+            zmq::message_t msg;
+            if (nid == nodeId || !commManager.controlPullIn(nid, msg))
+                continue;
+            unsigned *vals =
+                (unsigned *)((char *)msg.data() + sizeof(ControlMessage));
+            if (!requestSeen[nid])
+            {
+                requestSeen[nid] = true;
+                unsigned fwdCnt = vals[0];
+                // What the peer sends us is what it asks ghost IDs for
+                peerGhostRows[0][nid] = fwdCnt;
+                peerGhostRows[1][nid] = vals[1];
+                std::vector<unsigned> reply(vals + 2,
+                                            vals + 2 + fwdCnt + vals[1]);
+                for (unsigned i = 0; i < reply.size(); ++i)
+                {
+                    SortedIdMap &table = *ghostTables[i < fwdCnt ? 0 : 1];
+                    assert(table.contains(reply[i]));
+                    reply[i] = table[reply[i]] - graph.localVtxCnt;
+                }
+                commManager.controlPushOut(nid, reply.data(),
+                                           sizeof(unsigned) * reply.size());
+            }
+            else
+            {
+                SendPlan &fwd = forwardSendPlans[nid];
+                SendPlan &bwd = backwardSendPlans[nid];
+                assert(msg.size() - sizeof(ControlMessage) ==
+                       sizeof(unsigned) *
+                           (fwd.lvids.size() + bwd.lvids.size()));
+                fwd.ghostIds.assign(vals, vals + fwd.lvids.size());
+                bwd.ghostIds.assign(vals + fwd.lvids.size(),
+                                    vals + fwd.lvids.size() +
+                                        bwd.lvids.size());
+            }
+            --remaining;
+            got = true;
+        }
+        if (got)
+            bs.reset();
+        else
+            bs.sleep();
     }
-    commManager.rawMsgPushOut(msg);
+
+    printLog(nodeId, "Built send plans for %u remote nodes", numNodes - 1);
 }
-/********************************* AE utils *********************************/
-// reshape vtcs tensor to edgs tensor. Each element in edgsTensor is a reference
-// to a vertex feature. Both src vtx features and dst vtx features included in
-// edgsTensor. [srcV Feats (local inEdge cnt); dstV Feats (local inEdge cnt)]
-FeatType **Engine::srcVFeats2eFeats(FeatType *vtcsTensor, FeatType *ghostTensor,
-                                    unsigned vtcsCnt, unsigned featDim)
-{
-    FeatType **eVtxFeatsBuf = new FeatType *[2 * graph.localInEdgeCnt];
-    FeatType **eSrcVtxFeats = eVtxFeatsBuf;
-    FeatType **eDstVtxFeats = eSrcVtxFeats + graph.localInEdgeCnt;
 
-    unsigned long long edgeItr = 0;
-    for (unsigned lvid = 0; lvid < graph.localVtxCnt; ++lvid)
+/**
+ *
+ * Mark the local vertices that aggregate from a ghost row: a ghost source in
+ * the forward CSC column, or a ghost destination in the backward CSR row.
+ * Only the CPU aggregation can work on a subset of a chunk's rows.
+ *
+ */
+void Engine::buildBoundarySets()
+{
+    overlapInterior = gnn_type == GNN::GCN && mode != GPU;
+    aggPartsLeft.assign(numLambdasForward, 0);
+    if (!overlapInterior)
+        return;
+
+    unsigned vtxCnt = graph.localVtxCnt;
+    forwardBoundary.assign(vtxCnt, false);
+    backwardBoundary.assign(vtxCnt, false);
+    unsigned fwdCnt = 0;
+    unsigned bwdCnt = 0;
+    for (unsigned lvid = 0; lvid < vtxCnt; ++lvid)
     {
         for (unsigned long long eid = graph.forwardAdj.columnPtrs[lvid];
              eid < graph.forwardAdj.columnPtrs[lvid + 1]; ++eid)
         {
-            unsigned srcVid = graph.forwardAdj.rowIdxs[eid];
-            if (srcVid < graph.localVtxCnt)
+            if (graph.forwardAdj.rowIdxs[eid] >= vtxCnt)
             {
-                eSrcVtxFeats[edgeItr] = getVtxFeat(vtcsTensor, srcVid, featDim);
+                forwardBoundary[lvid] = true;
+                ++fwdCnt;
+                break;
             }
-            else
+        }
+        for (unsigned long long eid = graph.backwardAdj.rowPtrs[lvid];
+             eid < graph.backwardAdj.rowPtrs[lvid + 1]; ++eid)
+        {
+            if (graph.backwardAdj.columnIdxs[eid] >= vtxCnt)
             {
-                eSrcVtxFeats[edgeItr] = getVtxFeat(
-                    ghostTensor, srcVid - graph.localVtxCnt, featDim);
+                backwardBoundary[lvid] = true;
+                ++bwdCnt;
+                break;
             }
-            eDstVtxFeats[edgeItr] = getVtxFeat(vtcsTensor, lvid, featDim);
-            ++edgeItr;
         }
     }
 
-    return eVtxFeatsBuf;
+    printLog(nodeId, "Boundary vertices: %u forward, %u backward of %u",
+             fwdCnt, bwdCnt, vtxCnt);
 }
 
-// similar to srcVFeats2eFeats, but based on outEdges of local vertices.
-// [dstV Feats (local outEdge cnt); srcV Feats (local outEdge cnt)]
-FeatType **Engine::dstVFeats2eFeats(FeatType *vtcsTensor, FeatType *ghostTensor,
-                                    unsigned vtcsCnt, unsigned featDim)
+/**
+ *
+ * Record, per direction, which chunks read each ghost row through their
+ * in-edges (forward CSC sources, backward CSR destinations). A chunk then
+ * moves on from the sync scatter as soon as its own ghost rows have landed,
+ * instead of waiting for the whole exchange and a cluster-wide barrier.
+ *
+ */
+void Engine::buildGhostDeps()
 {
-    FeatType **eVtxFeatsBuf = new FeatType *[2 * graph.localOutEdgeCnt];
-    FeatType **eSrcVtxFeats = eVtxFeatsBuf;
-    FeatType **eDstVtxFeats = eSrcVtxFeats + graph.localOutEdgeCnt;
+    unsigned numChunks = chunkBounds.size() - 1;
+    unsigned vtxCnt = graph.localVtxCnt;
+    const unsigned long long *ptrs[2] = {graph.forwardAdj.columnPtrs,
+                                         graph.backwardAdj.rowPtrs};
+    const unsigned *idxs[2] = {graph.forwardAdj.rowIdxs,
+                               graph.backwardAdj.columnIdxs};
+    unsigned ghostCnts[2] = {graph.srcGhostCnt, graph.dstGhostCnt};
+
+    for (unsigned d = 0; d < 2; ++d)
+    {
+        std::vector<unsigned long long> &gPtrs = ghostChunkPtrs[d];
+        std::vector<unsigned> &gChunks = ghostChunks[d];
+        // Visit each (ghost, chunk) pair once. Chunks are swept in order,
+        // so the last chunk seen per ghost tells whether it is a repeat.
+        std::vector<unsigned> lastChunk(ghostCnts[d], UINT_MAX);
+        auto forEachChunkGhost = [&](std::function<void(unsigned, unsigned)> fn)
+        {
+            std::fill(lastChunk.begin(), lastChunk.end(), UINT_MAX);
+            for (unsigned cid = 0; cid < numChunks; ++cid)
+            {
+                for (unsigned long long eid = ptrs[d][chunkBounds[cid]];
+                     eid < ptrs[d][chunkBounds[cid + 1]]; ++eid)
+                {
+                    unsigned idx = idxs[d][eid];
+                    if (idx < vtxCnt || lastChunk[idx - vtxCnt] == cid)
+                        continue;
+                    lastChunk[idx - vtxCnt] = cid;
+                    fn(idx - vtxCnt, cid);
+                }
+            }
+        };
+
+        chunkGhostDeps[d].assign(numChunks, 0);
+        gPtrs.assign(ghostCnts[d] + 1, 0);
+        forEachChunkGhost([&](unsigned ghost, unsigned cid)
+                          {
+                              ++gPtrs[ghost + 1];
+                              ++chunkGhostDeps[d][cid];
+                          });
+        for (unsigned g = 0; g < ghostCnts[d]; ++g)
+        {
+            gPtrs[g + 1] += gPtrs[g];
+        }
+        gChunks.resize(gPtrs[ghostCnts[d]]);
+        std::vector<unsigned long long> fill(gPtrs.begin(), gPtrs.end() - 1);
+        forEachChunkGhost([&](unsigned ghost, unsigned cid)
+                          { gChunks[fill[ghost]++] = cid; });
+    }
+
+    resetGhostDeps();
+}
 
-    unsigned long long edgeItr = 0;
-    for (unsigned lvid = 0; lvid < graph.localVtxCnt; ++lvid)
+void Engine::resetGhostDeps()
+{
+    unsigned numChunks = chunkGhostDeps[0].size();
+    ghostDepsLeft.assign(2 * (numLayers + 1) * numChunks, 0);
+    for (unsigned d = 0; d < 2; ++d)
     {
-        for (unsigned long long eid = graph.backwardAdj.rowPtrs[lvid];
-             eid < graph.backwardAdj.rowPtrs[lvid + 1]; ++eid)
+        for (unsigned layer = 0; layer <= numLayers; ++layer)
         {
-            unsigned srcVid = graph.backwardAdj.columnIdxs[eid];
-            if (srcVid < graph.localVtxCnt)
+            for (unsigned cid = 0; cid < numChunks; ++cid)
             {
-                eSrcVtxFeats[edgeItr] = getVtxFeat(vtcsTensor, srcVid, featDim);
+                ghostDepsLeft[ghostSlot(d, layer) * numChunks + cid] =
+                    chunkGhostDeps[d][cid] + 1;
             }
-            else
+        }
+    }
+    waitingChunks.resize(numChunks);
+
+    peerRowsLeft.assign(2 * (numLayers + 1) * numNodes, 0);
+    for (unsigned d = 0; d < 2; ++d)
+    {
+        for (unsigned layer = 0; layer <= numLayers; ++layer)
+        {
+            std::copy(peerGhostRows[d].begin(), peerGhostRows[d].end(),
+                      peerRowsLeft.begin() + ghostSlot(d, layer) * numNodes);
+        }
+    }
+}
+
+/**
+ *
+ * Resolve the ghostfmt spec into a wire format per ghost tensor. Entries
+ * are a bare format, or [f|b][layer]:format to narrow it to a direction,
+ * a ghost tensor layer or both; later entries override earlier ones.
+ *
+ */
+void Engine::buildGhostFormats()
+{
+    ghostFormats.assign(2 * (numLayers + 1), GHOST_FP32);
+    ghostStats.assign(ghostFormats.size(), GhostCodecStats());
+
+    std::vector<std::string> entries;
+    boost::split(entries, ghostFormatSpec, boost::is_any_of(","));
+    for (std::string &entry : entries)
+    {
+        boost::algorithm::trim(entry);
+        std::string scope, name = entry;
+        size_t colon = entry.find(':');
+        if (colon != std::string::npos)
+        {
+            scope = entry.substr(0, colon);
+            name = entry.substr(colon + 1);
+        }
+
+        int dir = -1, layer = -1;
+        size_t pos = 0;
+        if (pos < scope.size() && (scope[pos] == 'f' || scope[pos] == 'b'))
+        {
+            dir = scope[pos] == 'f' ? PROP_TYPE::FORWARD : PROP_TYPE::BACKWARD;
+            ++pos;
+        }
+        if (pos < scope.size())
+        {
+            char *end;
+            unsigned long l = strtoul(scope.c_str() + pos, &end, 10);
+            if (*end != '\0' || end == scope.c_str() + pos || l > numLayers)
+            {
+                std::cerr << "Bad ghost format scope: " << entry << std::endl;
+                exit(-1);
+            }
+            layer = l;
+        }
+        GhostFormat fmt;
+        if (!parseGhostFormat(name, fmt))
+        {
+            std::cerr << "Unsupported ghost format: " << entry << std::endl;
+            exit(-1);
+        }
+
+        for (unsigned d = 0; d < 2; ++d)
+        {
+            for (unsigned l = 0; l <= numLayers; ++l)
+            {
+                if ((dir < 0 || (unsigned)dir == d) &&
+                    (layer < 0 || (unsigned)layer == l))
+                    ghostFormats[ghostSlot(d, l)] = fmt;
+            }
+        }
+    }
+
+    for (unsigned slot = 0; slot < ghostFormats.size(); ++slot)
+    {
+        if (ghostFormats[slot] != GHOST_FP32)
+            printLog(nodeId, "Ghost tensor %s%u sent as %s",
+                     slot / (numLayers + 1) == PROP_TYPE::FORWARD ? "f" : "b",
+                     slot % (numLayers + 1), ghostFormatName(ghostFormats[slot]));
+    }
+}
+
+/**
+ *
+ * Move the hubs, local vertices that are ghosts on every peer, out of the
+ * per-peer send plans into hubPlans. Peers still count hub rows in what
+ * they expect from us: relays keep us as the sender. Hubs fall out of the
+ * ghost maps the partitioner already wrote, so they are found here rather
+ * than stored with the partitions.
+ *
+ */
+void Engine::buildHubPlans()
+{
+    hubPlans[0] = SendPlan();
+    hubPlans[1] = SendPlan();
+    if (hubFanout == 0 || numNodes - 1 <= hubFanout)
+        return;
+
+    std::vector<SendPlan> *plans[2] = {&forwardSendPlans, &backwardSendPlans};
+    VertexNodesMap *ghostMaps[2] = {&graph.forwardGhostMap,
+                                    &graph.backwardGhostMap};
+    for (unsigned d = 0; d < 2; ++d)
+    {
+        std::vector<bool> isHub(graph.localVtxCnt, false);
+        for (unsigned lvid = 0; lvid < graph.localVtxCnt; ++lvid)
+        {
+            if ((*ghostMaps[d])[lvid].size() == numNodes - 1)
             {
-                eSrcVtxFeats[edgeItr] = getVtxFeat(
-                    ghostTensor, srcVid - graph.localVtxCnt, featDim);
+                isHub[lvid] = true;
+                hubPlans[d].lvids.push_back(lvid);
+                hubPlans[d].ghostIds.push_back(graph.localToGlobalId[lvid]);
             }
-            eDstVtxFeats[edgeItr] = getVtxFeat(vtcsTensor, lvid, featDim);
-            ++edgeItr;
         }
+        if (hubPlans[d].lvids.empty())
+            continue;
+
+        for (unsigned nid = 0; nid < numNodes; ++nid)
+        {
+            SendPlan &plan = (*plans[d])[nid];
+            unsigned kept = 0;
+            for (unsigned i = 0; i < plan.lvids.size(); ++i)
+            {
+                if (isHub[plan.lvids[i]])
+                    continue;
+                plan.lvids[kept] = plan.lvids[i];
+                plan.ghostIds[kept] = plan.ghostIds[i];
+                ++kept;
+            }
+            plan.lvids.resize(kept);
+            plan.ghostIds.resize(kept);
+        }
+    }
+
+    printLog(nodeId, "Relaying %zu forward and %zu backward hub rows down "
+             "trees of fanout %u", hubPlans[0].lvids.size(),
+             hubPlans[1].lvids.size(), hubFanout);
+}
+
+/**
+ *
+ * My children in origin's relay tree: nodes ranked by distance after the
+ * origin, rank r feeding ranks r * hubFanout + 1 to r * hubFanout +
+ * hubFanout. Every node derives the same tree from the origin alone.
+ *
+ */
+std::vector<unsigned> Engine::hubChildren(unsigned origin)
+{
+    std::vector<unsigned> children;
+    unsigned rank = (nodeId + numNodes - origin) % numNodes;
+    for (unsigned r = rank * hubFanout + 1;
+         r <= rank * hubFanout + hubFanout && r < numNodes; ++r)
+    {
+        children.push_back((origin + r) % numNodes);
+    }
+    return children;
+}
+
+// Row of a hub, by global ID, in our ghost tensors of the direction.
+unsigned Engine::hubGhostRow(unsigned dir, unsigned gvid)
+{
+    SortedIdMap &table = dir == PROP_TYPE::FORWARD ? graph.srcGhostVtcs
+                                                   : graph.dstGhostVtcs;
+    assert(table.contains(gvid));
+    return table[gvid] - graph.localVtxCnt;
+}
+
+/**
+ *
+ * Layer of the ghost tensor a chunk's scatter writes, and its gather reads.
+ *
+ */
+unsigned Engine::ghostTensorLayer(const Chunk &c)
+{
+    if (gnn_type == GNN::GCN)
+    { // YIFAN: fix this
+        return c.dir == PROP_TYPE::FORWARD ? c.layer : c.layer - 1;
     }
+    return c.layer - 1;
+}
 
-    return eVtxFeatsBuf;
+// Last dependency of a chunk is in; rearm it for the next epoch and move on.
+static void releaseWaitingChunk(Engine *e, unsigned slot, unsigned cid)
+{
+    unsigned numChunks = e->waitingChunks.size();
+    unsigned d = slot / (e->numLayers + 1);
+    e->ghostDepsLeft[slot * numChunks + cid] = e->chunkGhostDeps[d][cid] + 1;
+    Chunk c = e->waitingChunks[cid];
+    if (e->gnn_type == GNN::GCN && e->overlapInterior)
+    {
+        e->GABoundaryQueue.push_atomic(c);
+    }
+    else
+    {
+        e->AEQueue.push_atomic(c);
+    }
 }
 
+/**
+ *
+ * Ghost rows of the given tensor landed; chunkHits[cid] counts those chunk
+ * cid reads, and is cleared.
+ *
+ */
+void Engine::ghostRowsLanded(unsigned slot, std::vector<unsigned> &chunkHits)
+{
+    unsigned numChunks = chunkHits.size();
+    for (unsigned cid = 0; cid < numChunks; ++cid)
+    {
+        if (chunkHits[cid] == 0)
+            continue;
+        if (__sync_sub_and_fetch(&ghostDepsLeft[slot * numChunks + cid],
+                                 chunkHits[cid]) == 0)
+        {
+            releaseWaitingChunk(this, slot, cid);
+        }
+        chunkHits[cid] = 0;
+    }
+}
+
+/**
+ *
+ * A sync message brought rows of the given ghost tensor from sender. Count
+ * them against the sender's manifest, and rearm it for the next exchange
+ * once the last one is in; a peer sending more than it announced is a
+ * broken exchange, not something to wait out. The rearm adds rather than
+ * stores, so rows of the next exchange another receiver counted first (the
+ * manifest dipping below zero) stay counted.
+ *
+ */
+void Engine::peerRowsLanded(unsigned slot, unsigned sender, unsigned rows)
+{
+    int &left = peerRowsLeft[slot * numNodes + sender];
+    int full = peerGhostRows[slot / (numLayers + 1)][sender];
+    int due = __sync_fetch_and_sub(&left, (int)rows);
+    if ((due > 0 && due < (int)rows) || due - (int)rows < -full)
+    {
+        printLog(nodeId, "RECEIVER: node %u sent %u ghost rows, %d were due",
+                 sender, rows, due);
+        abort();
+    }
+    if (due == (int)rows)
+    {
+        // Early rows may already make up the whole next exchange
+        while (__sync_add_and_fetch(&left, full) == 0 && full > 0)
+            ;
+    }
+}
+
+/**
+ *
+ * Every local chunk has scattered c's layer, so the local rows c gathers
+ * from are final; c moves on once its ghost rows are in too.
+ *
+ */
+void Engine::chunkScattered(Chunk &c)
+{
+    unsigned numChunks = waitingChunks.size();
+    unsigned slot = ghostSlot(c.dir, ghostTensorLayer(c));
+    waitingChunks[c.localId] = c;
+    if (__sync_sub_and_fetch(&ghostDepsLeft[slot * numChunks + c.localId],
+                             1) == 0)
+    {
+        releaseWaitingChunk(this, slot, c.localId);
+    }
+}
+
+/**
+ *
+ * Pack the rows of lvids into a ghost data message to receiver, each after
+ * its key: the receiver's ghost ID, or for hub rows the global ID.
+ *
+ */
+void Engine::packGhostRows(zmq::message_t &msg, unsigned receiver,
+                           unsigned totCnt, unsigned *lvids, unsigned *keys,
+                           FeatType *inputTensor, unsigned featDim, Chunk &c,
+                           bool hub)
+{
+    unsigned featLayer = ghostTensorLayer(c);
+    unsigned slot = ghostSlot(c.dir, featLayer);
+    GhostFormat fmt = ghostFormats[slot];
+    size_t rowBytes = ghostRowBytes(fmt, featDim);
+    msg.rebuild(DATA_HEADER_SIZE + (sizeof(unsigned) + rowBytes) * totCnt);
+    readdressGhostRows(msg, receiver);
+    char *msgPtr = (char *)(msg.data()) + NODE_ID_DIGITS;
+    populateHeader(msgPtr, nodeId, totCnt, featDim, featLayer, c.dir);
+    serialize<unsigned>(msgPtr, 5, fmt);
+    serialize<unsigned>(msgPtr, 6, hub);
+    msgPtr += sizeof(unsigned) * 7;
+
+    char *firstRow = msgPtr + sizeof(unsigned);
+    for (unsigned i = 0; i < totCnt; ++i)
+    {
+        *(unsigned *)msgPtr = keys[i];
+        msgPtr += sizeof(unsigned);
+        FeatType *dataPtr = getVtxFeat(inputTensor, lvids[i], featDim);
+        ghostEncodeRow(fmt, dataPtr, featDim, msgPtr);
+        msgPtr += rowBytes;
+    }
+
+    // Sample the codec error on the first row, as the receiver decodes it
+    if (fmt != GHOST_FP32 && totCnt > 0)
+    {
+        std::vector<FeatType> decoded(featDim);
+        ghostDecodeRow(fmt, firstRow, featDim, decoded.data());
+        FeatType *dataPtr = getVtxFeat(inputTensor, lvids[0], featDim);
+        double errSq = 0.0, valSq = 0.0, maxErr = 0.0;
+        for (unsigned j = 0; j < featDim; ++j)
+        {
+            double err = std::fabs((double)decoded[j] - dataPtr[j]);
+            errSq += err * err;
+            valSq += (double)dataPtr[j] * dataPtr[j];
+            maxErr = std::max(maxErr, err);
+        }
+        std::lock_guard<std::mutex> lk(ghostStatsLock);
+        GhostCodecStats &st = ghostStats[slot];
+        st.errSq += errSq;
+        st.valSq += valSq;
+        st.maxErr = std::max(st.maxErr, maxErr);
+        st.values += featDim;
+        st.wireBytes += rowBytes * totCnt;
+        st.rawBytes += sizeof(FeatType) * featDim * totCnt;
+    }
+}
+
+/**
+ *
+ * Write the receiver ID at the front of a ghost data message: its digits
+ * only, as the sender ID follows right after them.
+ *
+ */
+void Engine::readdressGhostRows(zmq::message_t &msg, unsigned receiver)
+{
+    char digits[NODE_ID_DIGITS + 1];
+    snprintf(digits, sizeof(digits), NODE_ID_HEADER, receiver);
+    memcpy(msg.data(), digits, NODE_ID_DIGITS);
+}
+
+void Engine::verticesPushOut(unsigned receiver, unsigned totCnt,
+                             unsigned *lvids, unsigned *ghostIds,
+                             FeatType *inputTensor, unsigned featDim,
+                             Chunk &c)
+{
+    zmq::message_t msg;
+    packGhostRows(msg, receiver, totCnt, lvids, ghostIds, inputTensor,
+                  featDim, c, false);
+    commManager.rawMsgPushOut(receiver, msg);
+}
+
+/**
+ *
+ * Send hub rows to my children in my own relay tree; the message is packed
+ * once and copied per child.
+ *
+ */
+void Engine::hubVerticesPushOut(unsigned totCnt, unsigned *lvids,
+                                unsigned *globalIds, FeatType *inputTensor,
+                                unsigned featDim, Chunk &c)
+{
+    zmq::message_t msg;
+    packGhostRows(msg, nodeId, totCnt, lvids, globalIds, inputTensor,
+                  featDim, c, true);
+    for (unsigned child : hubChildren(nodeId))
+    {
+        zmq::message_t copy(msg.size());
+        memcpy(copy.data(), msg.data(), msg.size());
+        readdressGhostRows(copy, child);
+        commManager.rawMsgPushOut(child, copy);
+    }
+}
+
+/**
+ *
+ * Pass a hub row message from origin on to my children in its relay tree.
+ * Runs on a receiver thread, so it never waits for room at a child: what
+ * does not go out now is queued in relays for flushHubRelays to retry.
+ *
+ */
+void Engine::relayHubRows(zmq::message_t &msg, unsigned origin,
+                          RelayQueue &relays)
+{
+    for (unsigned child : hubChildren(origin))
+    {
+        zmq::message_t copy(msg.size());
+        memcpy(copy.data(), msg.data(), msg.size());
+        readdressGhostRows(copy, child);
+        if (!commManager.rawMsgTryPushOut(child, copy))
+            relays.emplace_back(child, std::move(copy));
+    }
+}
+
+void Engine::flushHubRelays(RelayQueue &relays)
+{
+    for (size_t n = relays.size(); n > 0; --n)
+    {
+        std::pair<unsigned, zmq::message_t> relay = std::move(relays.front());
+        relays.pop_front();
+        if (!commManager.rawMsgTryPushOut(relay.first, relay.second))
+            relays.push_back(std::move(relay));
+    }
+}
+/********************************* AE utils *********************************/
 unsigned Engine::getAbsLayer(const Chunk &chunk)
 {
     return chunk.dir == PROP_TYPE::FORWARD
@@ -1,48 +1,59 @@
 #include <cerrno>
+#include <cstdio>
 #include <cmath>
 #include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unistd.h>
 #include "dataloader.hpp"
 #include "../../common/utils.hpp"
 
 
-DataLoader::DataLoader(std::string datasetDir, unsigned _nodeId, unsigned _numNodes, bool _undirected) :
+/** Run work(tid) on numThreads threads and wait for all of them. */
+template<typename Work>
+static void runThreads(unsigned numThreads, Work work) {
+    std::vector<std::thread> threads;
+    for (unsigned tid = 0; tid < numThreads; ++tid) {
+        threads.push_back(std::thread(work, tid));
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+}
+
+/** Normalization factor of a vertex with the given in degree. */
+static float normOf(unsigned long long inDegree) {
+    return std::pow(inDegree + 1, -.5);
+}
+
+
+DataLoader::DataLoader(std::string datasetDir, unsigned _nodeId, unsigned _numNodes, bool _undirected,
+                       ReorderType _reorder) :
                         graphFile(datasetDir + RAWGRAPH_EXT + EDGES_EXT), partsFile(datasetDir + RAWGRAPH_EXT + PARTS_EXT),
-                        nodeId(_nodeId), numNodes(_numNodes), undirected(_undirected),
-                        forwardDstTables(NULL), backwardDstTables(NULL) {
+                        nodeId(_nodeId), numNodes(_numNodes), undirected(_undirected), reorder(_reorder),
+                        localVtxCnt(0), globalVtxCnt(0), globalEdgeCnt(0), numBuckets(0), bucketSize(1),
+                        inRecords(NULL), outRecords(NULL) {
     char outfileName[50];
     sprintf(outfileName, "graph.%u.bin", nodeId);
     processedGraphFile = datasetDir + std::string(outfileName);
 
-    rawGraph.forwardGhostsList = new std::vector<unsigned>[numNodes];
-    rawGraph.backwardGhostsList = new std::vector<unsigned> [numNodes];
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    forwardGhostsList = new std::vector<unsigned>[numNodes];
+    backwardGhostsList = new std::vector<unsigned>[numNodes];
 }
 
 DataLoader::~DataLoader() {
-    if (forwardDstTables) {
-        for (unsigned i = 0; i < numNodes; ++i) {
-            if (i == nodeId) {
-                continue;
-            }
-            if (forwardDstTables[i]) {
-                delete[] forwardDstTables[i];
-            }
-        }
-        delete[] forwardDstTables;
+    if (inRecords) {
+        delete[] inRecords;
     }
-    if (backwardDstTables) {
-        for (unsigned i = 0; i < numNodes; ++i) {
-            if (i == nodeId) {
-                continue;
-            }
-            if (backwardDstTables[i]) {
-                delete[] backwardDstTables[i];
-            }
-        }
-        delete[] backwardDstTables;
+    if (outRecords) {
+        delete[] outRecords;
     }
 
-    delete[] rawGraph.forwardGhostsList;
-    delete[] rawGraph.backwardGhostsList;
+    delete[] forwardGhostsList;
+    delete[] backwardGhostsList;
 }
 
 /**
@@ -59,7 +70,6 @@ void DataLoader::readPartsFile() {
     assert(infile.good());
 
     short partId;
-    unsigned lvid = 0;
     unsigned gvid = 0;
 
     std::string line;
@@ -71,260 +81,500 @@ void DataLoader::readPartsFile() {
         if (!(iss >> partId))
             break;
 
-        rawGraph.appendVertexPartitionId(partId);
-
+        partIds.push_back(partId);
         if (partId == nodeId) {
-            rawGraph.localToGlobalId[lvid] = gvid;
-            rawGraph.globalToLocalId[gvid] = lvid;
-
-            ++lvid;
+            localToGlobalId.push_back(gvid);
         }
         ++gvid;
     }
 
-    rawGraph.setNumGlobalVertices(gvid);
-    rawGraph.setNumLocalVertices(lvid);
+    globalVtxCnt = gvid;
+    localVtxCnt = localToGlobalId.size();
+
+    // Local vertices are numbered in global ID order. Entries of remote
+    // vertices are filled with ghost IDs while the CSC / CSR are built.
+    localIds.resize(globalVtxCnt);
+    for (unsigned lvid = 0; lvid < localVtxCnt; ++lvid) {
+        localIds[localToGlobalId[lvid]] = lvid;
+    }
 }
 
 /**
  *
- * Process an edge read from the binary snap file.
+ * Record one directed edge, for its source if local (outgoing) and for its
+ * destination if local (incoming).
  *
  */
-void DataLoader::processEdge(unsigned &from, unsigned &to) {
-    if (rawGraph.getVertexPartitionId(from) == nodeId) {
-        unsigned lFromId = rawGraph.globalToLocalId[from];
-        unsigned toId;
-        EdgeLocationType eLocation;
-
-        unsigned toPartition = rawGraph.getVertexPartitionId(to);
-        if (toPartition == nodeId) {
-            toId = rawGraph.globalToLocalId[to];
-            eLocation = LOCAL_EDGE_TYPE;
-        } else {
-            toId = to;
-            eLocation = REMOTE_EDGE_TYPE;
-            rawGraph.getVertex(lFromId).setVertexLocation(BOUNDARY_VERTEX);
-
-            if (!rawGraph.containsOutEdgeGhostVertex(to)) {
-                rawGraph.getOutEdgeGhostVertices()[to] = GhostVertex();
-            }
-            rawGraph.getOutEdgeGhostVertex(to).addAssocEdge(lFromId);
-
-            forwardDstTables[toPartition][lFromId] = true;
+void DataLoader::processEdge(unsigned tid, unsigned from, unsigned to) {
+    if (partIds[from] == nodeId) {
+        unsigned lFromId = localIds[from];
+        outRecords[tid * numBuckets + bucketOf(lFromId)].push_back(EdgeRecord{lFromId, to});
+        if (partIds[to] != nodeId) {
+            __atomic_store_n(&outGhostFlags[to], 1, __ATOMIC_RELAXED);
         }
+    }
 
-        rawGraph.getVertex(lFromId)
-                .addOutEdge(OutEdge(toId, eLocation, EdgeType()));
-        rawGraph.incrementNumLocalOutEdges();
+    if (partIds[to] == nodeId) {
+        unsigned lToId = localIds[to];
+        inRecords[tid * numBuckets + bucketOf(lToId)].push_back(EdgeRecord{lToId, from});
+        if (partIds[from] != nodeId) {
+            __atomic_store_n(&inGhostFlags[from], 1, __ATOMIC_RELAXED);
+        }
     }
+}
 
-    if (rawGraph.getVertexPartitionId(to) == nodeId) {
-        unsigned lToId = rawGraph.globalToLocalId[to];
-        unsigned fromId;
-        EdgeLocationType eLocation;
-
-        unsigned fromPartition = rawGraph.getVertexPartitionId(from);
-        if (fromPartition == nodeId) {
-            fromId = rawGraph.globalToLocalId[from];
-            eLocation = LOCAL_EDGE_TYPE;
-        } else {
-            fromId = from;
-            eLocation = REMOTE_EDGE_TYPE;
-
-            if (!rawGraph.containsInEdgeGhostVertex(from)) {
-                rawGraph.getInEdgeGhostVertices()[from] = GhostVertex();
-            }
-            rawGraph.getInEdgeGhostVertex(from).addAssocEdge(lToId);
+/**
+ *
+ * Read the binary snap edge file in a single pass. Every thread reads its
+ * own contiguous range of edges, EDGE_BLOCK_SIZE edges at a time, keeps the
+ * edges of local vertices and counts the in degree of every vertex (which
+ * the ghost vertices' norms need).
+ *
+ */
+void DataLoader::readEdgesFile() {
+    std::ifstream infile(graphFile.c_str(), std::ios::binary);
+    if (!infile.good())
+        printLog(nodeId, "Cannot open BinarySnap file: %s", graphFile.c_str());
+
+    assert(infile.good());
+
+    BSHeaderType bSHeader;
+    infile.read((char *)&bSHeader, sizeof(bSHeader));
+    assert(bSHeader.sizeOfVertexType == sizeof(unsigned));
+    infile.seekg(0, std::ios::end);
+    const unsigned long long fileEdgeCnt =
+        ((unsigned long long)infile.tellg() - sizeof(BSHeaderType)) / (2 * sizeof(unsigned));
+    infile.close();
 
-            backwardDstTables[fromPartition][lToId] = true;
+    numBuckets = 4 * numThreads;
+    bucketSize = std::max(1u, (localVtxCnt + numBuckets - 1) / numBuckets);
+    inRecords = new std::vector<EdgeRecord>[numThreads * numBuckets];
+    outRecords = new std::vector<EdgeRecord>[numThreads * numBuckets];
+    globalInDegrees.assign(globalVtxCnt, 0);
+    inGhostFlags.assign(globalVtxCnt, 0);
+    outGhostFlags.assign(globalVtxCnt, 0);
+
+    std::vector<unsigned long long> edgeCnts(numThreads, 0);
+    runThreads(numThreads, [&](unsigned tid) {
+        const unsigned long long begin = fileEdgeCnt * tid / numThreads;
+        const unsigned long long end = fileEdgeCnt * (tid + 1) / numThreads;
+        std::ifstream tfile(graphFile.c_str(), std::ios::binary);
+        tfile.seekg(sizeof(BSHeaderType) + begin * 2 * sizeof(unsigned));
+
+        unsigned long long edgeCnt = 0;
+        std::vector<unsigned> srcdst(2 * EDGE_BLOCK_SIZE);
+        for (unsigned long long blk = begin; blk < end; blk += EDGE_BLOCK_SIZE) {
+            unsigned blkCnt = std::min((unsigned long long)EDGE_BLOCK_SIZE, end - blk);
+            tfile.read((char *)srcdst.data(), sizeof(unsigned) * 2 * blkCnt);
+            assert(tfile.good());
+            for (unsigned i = 0; i < blkCnt; ++i) {
+                unsigned src = srcdst[2 * i];
+                unsigned dst = srcdst[2 * i + 1];
+                if (src == dst)
+                    continue;
+
+                __sync_fetch_and_add(&globalInDegrees[dst], 1);
+                processEdge(tid, src, dst);
+                if (undirected)
+                    processEdge(tid, dst, src);
+                ++edgeCnt;
+            }
         }
+        edgeCnts[tid] = edgeCnt;
+    });
 
-        rawGraph.getVertex(lToId).addInEdge(InEdge(fromId, eLocation, EdgeType()));
-        rawGraph.incrementNumLocalInEdges();
+    for (unsigned tid = 0; tid < numThreads; ++tid) {
+        globalEdgeCnt += edgeCnts[tid];
     }
 }
 
 /**
  *
- * Set the normalization factors on all edges.
+ * List the flagged ghost vertices in global ID order and give each its
+ * ghost ID, localVtxCnt + position, in localIds.
  *
  */
-void DataLoader::setEdgeNormalizations() {
-    for (Vertex &vertex : rawGraph.getVertices()) {
-        unsigned vtxDeg = vertex.getNumInEdges() + 1;
-        float vtxNorm = std::pow(vtxDeg, -.5);
-        vertex.setNormFactor(vtxNorm * vtxNorm);
-        for (unsigned i = 0; i < vertex.getNumInEdges(); ++i) {
-            InEdge &e = vertex.getInEdge(i);
-            unsigned vid = e.getSourceId();
-            if (e.getEdgeLocation() == LOCAL_EDGE_TYPE) {
-                unsigned srcDeg = rawGraph.getVertex(vid).getNumInEdges() + 1;
-                float srcNorm = std::pow(srcDeg, -.5);
-                e.setData(srcNorm * vtxNorm);
-            } else {
-                unsigned ghostDeg = rawGraph.getInEdgeGhostVertex(vid).getDegree() + 1;
-                float ghostNorm = std::pow(ghostDeg, -.5);
-                e.setData(ghostNorm * vtxNorm);
-            }
-        }
-        for (unsigned i = 0; i < vertex.getNumOutEdges(); ++i) {
-            OutEdge &e = vertex.getOutEdge(i);
-            unsigned vid = e.getDestId();
-            if (e.getEdgeLocation() == LOCAL_EDGE_TYPE) {
-                unsigned dstDeg = rawGraph.getVertex(vid).getNumInEdges() + 1;
-                float dstNorm = std::pow(dstDeg, -.5);
-                e.setData(vtxNorm * dstNorm);
-            } else {
-                unsigned ghostDeg = rawGraph.getOutEdgeGhostVertex(vid).getDegree() + 1;
-                float ghostNorm = std::pow(ghostDeg, -.5);
-                e.setData(vtxNorm * ghostNorm);
-            }
+void DataLoader::buildGhostTable(std::vector<char> &ghostFlags, std::vector<unsigned> &ghostGvids) {
+    ghostGvids.clear();
+    for (unsigned gvid = 0; gvid < globalVtxCnt; ++gvid) {
+        if (ghostFlags[gvid]) {
+            localIds[gvid] = localVtxCnt + ghostGvids.size();
+            ghostGvids.push_back(gvid);
         }
     }
+    std::vector<char>().swap(ghostFlags);
 }
 
 /**
  *
- * Finds the in degree of all ghost vertices.
+ * Second half of the counting sort: place each bucket's records at their
+ * vertex's next free slot, walking the bucket's vectors in thread order so
+ * every vertex keeps its edges in file order. Edge values are the product
+ * of both endpoints' norms. Also collects, per remote node, the local
+ * vertices with an edge to one of its ghosts.
  *
  */
-void DataLoader::findGhostDegrees() {
-    std::ifstream infile(graphFile.c_str(), std::ios::binary);
-    if (!infile.good())
-        printLog(nodeId, "Cannot open BinarySnap file: %s", graphFile.c_str());
-
-    assert(infile.good());
-
-    BSHeaderType bsHeader;
-    infile.read((char *)&bsHeader, sizeof(bsHeader));
+void DataLoader::fillBuckets(std::vector<EdgeRecord> *records, std::vector<unsigned> &ghostGvids,
+                             std::vector<float> &localNorms, unsigned long long *ptrs,
+                             unsigned *idxs, EdgeType *values, std::vector<unsigned> *ghostsList) {
+    std::vector<unsigned> *bucketGhostsLists = new std::vector<unsigned>[numBuckets * numNodes];
+    std::atomic<unsigned> nextBucket(0);
+    runThreads(numThreads, [&](unsigned tid) {
+        std::vector<unsigned> lastLvid(numNodes);
+        for (unsigned b = nextBucket++; b < numBuckets; b = nextBucket++) {
+            const unsigned lo = std::min(b * bucketSize, localVtxCnt);
+            const unsigned hi = std::min(lo + bucketSize, localVtxCnt);
+            std::vector<unsigned long long> cursor(ptrs + lo, ptrs + hi);
+            for (unsigned t = 0; t < numThreads; ++t) {
+                std::vector<EdgeRecord> &bucket = records[t * numBuckets + b];
+                for (EdgeRecord &rec : bucket) {
+                    unsigned long long pos = cursor[rec.lvid - lo]++;
+                    unsigned id = localIds[rec.gvid];
+                    idxs[pos] = id;
+                    values[pos] = localNorms[rec.lvid] *
+                                  (id < localVtxCnt ? localNorms[id] : normOf(globalInDegrees[rec.gvid]));
+                }
+                std::vector<EdgeRecord>().swap(bucket);
+            }
 
-    unsigned srcdst[2];
-    while (infile.read((char *)srcdst, bsHeader.sizeOfVertexType * 2)) {
-        if (srcdst[0] == srcdst[1]) {
-            continue;
+            std::fill(lastLvid.begin(), lastLvid.end(), MAX_IDTYPE);
+            for (unsigned lvid = lo; lvid < hi; ++lvid) {
+                for (unsigned long long e = ptrs[lvid]; e < ptrs[lvid + 1]; ++e) {
+                    if (idxs[e] < localVtxCnt) {
+                        continue;
+                    }
+                    unsigned nid = partIds[ghostGvids[idxs[e] - localVtxCnt]];
+                    if (lastLvid[nid] != lvid) {
+                        lastLvid[nid] = lvid;
+                        bucketGhostsLists[b * numNodes + nid].push_back(lvid);
+                    }
+                }
+            }
         }
+    });
 
-        // YIFAN: we count in degree for both outEdgeGhosts and inEdgeGhosts
-        if (rawGraph.containsOutEdgeGhostVertex(srcdst[1])) {
-            rawGraph.getOutEdgeGhostVertex(srcdst[1]).incrementDegree();
+    for (unsigned nid = 0; nid < numNodes; ++nid) {
+        for (unsigned b = 0; b < numBuckets; ++b) {
+            std::vector<unsigned> &lvids = bucketGhostsLists[b * numNodes + nid];
+            ghostsList[nid].insert(ghostsList[nid].end(), lvids.begin(), lvids.end());
         }
-        if (rawGraph.containsInEdgeGhostVertex(srcdst[1])) {
-            rawGraph.getInEdgeGhostVertex(srcdst[1]).incrementDegree();
+    }
+    delete[] bucketGhostsLists;
+}
+
+/**
+ *
+ * Build the CSC (incoming edges, forward) and CSR (outgoing edges, backward)
+ * from the edge records by a parallel counting sort, and set the norms.
+ *
+ */
+void DataLoader::buildAdjacency() {
+    unsigned long long inEdgeCnt = 0;
+    unsigned long long outEdgeCnt = 0;
+    for (unsigned i = 0; i < numThreads * numBuckets; ++i) {
+        inEdgeCnt += inRecords[i].size();
+        outEdgeCnt += outRecords[i].size();
+    }
+
+    forwardAdj.columnCnt = localVtxCnt;
+    forwardAdj.nnz = inEdgeCnt;
+    forwardAdj.columnPtrs = new unsigned long long[localVtxCnt + 1];
+    forwardAdj.rowIdxs = new unsigned[inEdgeCnt];
+    forwardAdj.values = new EdgeType[inEdgeCnt];
+    backwardAdj.rowCnt = localVtxCnt;
+    backwardAdj.nnz = outEdgeCnt;
+    backwardAdj.rowPtrs = new unsigned long long[localVtxCnt + 1];
+    backwardAdj.columnIdxs = new unsigned[outEdgeCnt];
+    backwardAdj.values = new EdgeType[outEdgeCnt];
+
+    // Count the edges of every vertex. Buckets cover disjoint vertex ranges,
+    // so threads never touch the same counter.
+    std::fill(forwardAdj.columnPtrs, forwardAdj.columnPtrs + localVtxCnt + 1, 0);
+    std::fill(backwardAdj.rowPtrs, backwardAdj.rowPtrs + localVtxCnt + 1, 0);
+    std::atomic<unsigned> nextBucket(0);
+    runThreads(numThreads, [&](unsigned tid) {
+        for (unsigned b = nextBucket++; b < numBuckets; b = nextBucket++) {
+            for (unsigned t = 0; t < numThreads; ++t) {
+                for (EdgeRecord &rec : inRecords[t * numBuckets + b]) {
+                    ++forwardAdj.columnPtrs[rec.lvid + 1];
+                }
+                for (EdgeRecord &rec : outRecords[t * numBuckets + b]) {
+                    ++backwardAdj.rowPtrs[rec.lvid + 1];
+                }
+            }
         }
+    });
+    for (unsigned lvid = 0; lvid < localVtxCnt; ++lvid) {
+        forwardAdj.columnPtrs[lvid + 1] += forwardAdj.columnPtrs[lvid];
+        backwardAdj.rowPtrs[lvid + 1] += backwardAdj.rowPtrs[lvid];
     }
 
-    infile.close();
+    // Local in degrees are the CSC column lengths.
+    std::vector<float> localNorms(localVtxCnt);
+    normFactors.resize(localVtxCnt);
+    for (unsigned lvid = 0; lvid < localVtxCnt; ++lvid) {
+        localNorms[lvid] = normOf(forwardAdj.columnPtrs[lvid + 1] - forwardAdj.columnPtrs[lvid]);
+        normFactors[lvid] = localNorms[lvid] * localNorms[lvid];
+    }
+
+    buildGhostTable(inGhostFlags, inGhostGvids);
+    fillBuckets(inRecords, inGhostGvids, localNorms, forwardAdj.columnPtrs,
+                forwardAdj.rowIdxs, forwardAdj.values, backwardGhostsList);
+    buildGhostTable(outGhostFlags, outGhostGvids);
+    fillBuckets(outRecords, outGhostGvids, localNorms, backwardAdj.rowPtrs,
+                backwardAdj.columnIdxs, backwardAdj.values, forwardGhostsList);
+
+    delete[] inRecords;
+    delete[] outRecords;
+    inRecords = NULL;
+    outRecords = NULL;
+    std::vector<unsigned>().swap(globalInDegrees);
+    std::vector<unsigned>().swap(localIds);
 }
 
 /**
  *
- * Read and parse the graph from the graph binary snap file.
+ * Move every vertex's edges to its new position and renumber local
+ * endpoints. Edges of a vertex keep their order.
  *
  */
-void DataLoader::preprocess() {
-    printLog(nodeId, "Preprocessing... Output to %s", processedGraphFile.c_str());
+template<typename T>
+static void permuteAdjacency(const std::vector<unsigned> &newId, unsigned long long *&ptrs,
+                             unsigned *&idxs, T *&values, unsigned long long nnz) {
+    const unsigned vtxCnt = newId.size();
+    unsigned long long *newPtrs = new unsigned long long[vtxCnt + 1];
+    unsigned *newIdxs = new unsigned[nnz];
+    T *newValues = new T[nnz];
+
+    newPtrs[0] = 0;
+    for (unsigned lvid = 0; lvid < vtxCnt; ++lvid) {
+        newPtrs[newId[lvid] + 1] = ptrs[lvid + 1] - ptrs[lvid];
+    }
+    for (unsigned lvid = 0; lvid < vtxCnt; ++lvid) {
+        newPtrs[lvid + 1] += newPtrs[lvid];
+    }
+    for (unsigned lvid = 0; lvid < vtxCnt; ++lvid) {
+        unsigned long long pos = newPtrs[newId[lvid]];
+        for (unsigned long long e = ptrs[lvid]; e < ptrs[lvid + 1]; ++e, ++pos) {
+            newIdxs[pos] = idxs[e] < vtxCnt ? newId[idxs[e]] : idxs[e];
+            newValues[pos] = values[e];
+        }
+    }
 
-    // Read in the partition file.
-    readPartsFile();
+    delete[] ptrs;
+    delete[] idxs;
+    delete[] values;
+    ptrs = newPtrs;
+    idxs = newIdxs;
+    values = newValues;
+}
 
-    // Initialize the graph based on the partition info.
-    rawGraph.getVertices().resize(rawGraph.getNumLocalVertices());
-    for (unsigned i = 0; i < rawGraph.getNumLocalVertices(); ++i) {
-        rawGraph.getVertex(i).setLocalId(i);
-        rawGraph.getVertex(i).setGlobalId(rawGraph.localToGlobalId[i]);
-        rawGraph.getVertex(i).setVertexLocation(INTERNAL_VERTEX);
-        rawGraph.getVertex(i).setGraphPtr(&rawGraph);
+/**
+ *
+ * Renumber local vertices so that neighbors get nearby local IDs. Ghost
+ * vertices keep their block after the local ones and are not reordered.
+ *
+ */
+void DataLoader::reorderVertices() {
+    if (reorder == REORDER_NONE) {
+        return;
     }
 
-    // Read in the binary snap edge file.
-    std::ifstream infile(graphFile.c_str(), std::ios::binary);
-    if (!infile.good())
-        printLog(nodeId, "Cannot open BinarySnap file: %s", graphFile.c_str());
+    // Local neighbors of every vertex, in either direction.
+    std::vector<unsigned long long> ptrs(localVtxCnt + 1, 0);
+    std::vector<unsigned> nbrs;
+    for (unsigned lvid = 0; lvid < localVtxCnt; ++lvid) {
+        for (unsigned long long e = forwardAdj.columnPtrs[lvid]; e < forwardAdj.columnPtrs[lvid + 1]; ++e) {
+            if (forwardAdj.rowIdxs[e] < localVtxCnt) {
+                nbrs.push_back(forwardAdj.rowIdxs[e]);
+            }
+        }
+        for (unsigned long long e = backwardAdj.rowPtrs[lvid]; e < backwardAdj.rowPtrs[lvid + 1]; ++e) {
+            if (backwardAdj.columnIdxs[e] < localVtxCnt) {
+                nbrs.push_back(backwardAdj.columnIdxs[e]);
+            }
+        }
+        ptrs[lvid + 1] = nbrs.size();
+    }
+    std::vector<unsigned> newId = computeVertexOrder(reorder, localVtxCnt, ptrs, nbrs);
+    std::vector<unsigned>().swap(nbrs);
 
-    assert(infile.good());
+    permuteAdjacency(newId, forwardAdj.columnPtrs, forwardAdj.rowIdxs, forwardAdj.values, forwardAdj.nnz);
+    permuteAdjacency(newId, backwardAdj.rowPtrs, backwardAdj.columnIdxs, backwardAdj.values, backwardAdj.nnz);
 
-    BSHeaderType bSHeader;
-    infile.read((char *)&bSHeader, sizeof(bSHeader));
-    assert(bSHeader.sizeOfVertexType == sizeof(unsigned));
+    std::vector<unsigned> oldToGlobalId(localToGlobalId);
+    std::vector<EdgeType> oldNormFactors(normFactors);
+    for (unsigned lvid = 0; lvid < localVtxCnt; ++lvid) {
+        localToGlobalId[newId[lvid]] = oldToGlobalId[lvid];
+        normFactors[newId[lvid]] = oldNormFactors[lvid];
+    }
 
-    forwardDstTables = new bool *[numNodes];
-    backwardDstTables = new bool *[numNodes];
     for (unsigned i = 0; i < numNodes; ++i) {
-        if (i == nodeId) {
-            continue;
+        for (unsigned &lvid : forwardGhostsList[i]) {
+            lvid = newId[lvid];
+        }
+        std::sort(forwardGhostsList[i].begin(), forwardGhostsList[i].end());
+        for (unsigned &lvid : backwardGhostsList[i]) {
+            lvid = newId[lvid];
         }
-        forwardDstTables[i] = new bool[rawGraph.getNumLocalVertices()];
-        memset(forwardDstTables[i], 0,
-                     sizeof(bool) * rawGraph.getNumLocalVertices());
-        backwardDstTables[i] = new bool[rawGraph.getNumLocalVertices()];
-        memset(backwardDstTables[i], 0,
-                     sizeof(bool) * rawGraph.getNumLocalVertices());
+        std::sort(backwardGhostsList[i].begin(), backwardGhostsList[i].end());
     }
 
-    // Loop through all edges and process them.
-    unsigned srcdst[2];
-    while (infile.read((char *)srcdst, bSHeader.sizeOfVertexType * 2)) {
-        if (srcdst[0] == srcdst[1])
-            continue;
+    reorderedIds.swap(newId);
+    printLog(nodeId, "Reordered %u local vertices (%s)", localVtxCnt, reorderTypeName(reorder));
+}
 
-        processEdge(srcdst[0], srcdst[1]);
-        if (undirected)
-            processEdge(srcdst[1], srcdst[0]);
-        rawGraph.incrementNumGlobalEdges();
+/**
+ *
+ * Write graph.<n>.bin. See GraphFileHeader / GraphSection for the layout.
+ * The file is written aside and renamed into place once complete, so an
+ * interrupted run never leaves one that looks preprocessed.
+ *
+ */
+void DataLoader::dump() {
+    std::string tmpFile = processedGraphFile + ".tmp";
+    std::ofstream outfile(tmpFile, std::ofstream::binary);
+    if (!outfile.good()) {
+        std::cout << "Cannot open output file:" << tmpFile << ", [Reason: " << std::strerror(errno) << "]" << std::endl;
+        return;
     }
 
-    for (unsigned i = 0; i < numNodes; ++i) {
-        if (i == nodeId) {
-            continue;
+    GraphFileHeader header;
+    memset(&header, 0, sizeof(GraphFileHeader));
+    strncpy(header.magic, GRAPH_FILE_MAGIC, sizeof(header.magic));
+    header.version = GRAPH_FILE_VERSION;
+    header.reorder = reorder;
+    // vertex count (local/global/incoming ghost/outgoing ghost)
+    header.localVtxCnt = localVtxCnt;
+    header.globalVtxCnt = globalVtxCnt;
+    header.srcGhostCnt = inGhostGvids.size();
+    header.dstGhostCnt = outGhostGvids.size();
+    header.numNodes = numNodes;
+    // edge count (local incoming/local outgoing/global)
+    header.localInEdgeCnt = forwardAdj.nnz;
+    header.localOutEdgeCnt = backwardAdj.nnz;
+    header.globalEdgeCnt = globalEdgeCnt;
+    header.forwardNnz = forwardAdj.nnz;
+    header.backwardNnz = backwardAdj.nnz;
+    // Header first; it is rewritten with the section table at the end.
+    outfile.write(reinterpret_cast<const char *>(&header), sizeof(GraphFileHeader));
+
+    auto writeSection = [&](GraphSection sec, const void *data, size_t bytes) {
+        static const char zeros[GRAPH_FILE_ALIGN] = { 0 };
+        unsigned long long offset = outfile.tellp();
+        unsigned long long padding = (GRAPH_FILE_ALIGN - offset % GRAPH_FILE_ALIGN) % GRAPH_FILE_ALIGN;
+        outfile.write(zeros, padding);
+        header.sectionOffsets[sec] = offset + padding;
+        header.sectionSizes[sec] = bytes;
+        outfile.write(reinterpret_cast<const char *>(data), bytes);
+    };
+
+    // global IDs, normFactors and reordered IDs of local vertices
+    std::vector<unsigned> ids(localVtxCnt);
+    for (unsigned i = 0; i < localVtxCnt; ++i) {
+        ids[i] = reorderedIds.empty() ? i : reorderedIds[i];
+    }
+    writeSection(SEC_LOCAL_TO_GLOBAL, localToGlobalId.data(), sizeof(unsigned) * localVtxCnt);
+    writeSection(SEC_VTX_DATA, normFactors.data(), sizeof(EdgeType) * localVtxCnt);
+    writeSection(SEC_REORDERED_IDS, ids.data(), sizeof(unsigned) * localVtxCnt);
+
+    // sorted global ID tables of local, incoming ghost and outgoing ghost
+    // vertices; local vertices were numbered in global ID order before
+    // reordering
+    std::vector<unsigned> gvids(localVtxCnt);
+    for (unsigned i = 0; i < localVtxCnt; ++i) {
+        gvids[i] = localToGlobalId[ids[i]];
+    }
+    writeSection(SEC_LOCAL_GVIDS, gvids.data(), sizeof(unsigned) * localVtxCnt);
+    writeSection(SEC_LOCAL_IDS, ids.data(), sizeof(unsigned) * localVtxCnt);
+    for (std::vector<unsigned> *ghostGvids : { &inGhostGvids, &outGhostGvids }) {
+        ids.resize(ghostGvids->size());
+        for (unsigned i = 0; i < ids.size(); ++i) {
+            ids[i] = localVtxCnt + i;
         }
-        rawGraph.forwardGhostsList[i].reserve(rawGraph.getNumLocalVertices());
-        rawGraph.backwardGhostsList[i].reserve(rawGraph.getNumLocalVertices());
-        for (unsigned j = 0; j < rawGraph.getNumLocalVertices(); ++j) {
-            if (forwardDstTables[i][j]) {
-                rawGraph.forwardGhostsList[i].push_back(j);
+        bool in = ghostGvids == &inGhostGvids;
+        writeSection(in ? SEC_SRC_GHOST_GVIDS : SEC_DST_GHOST_GVIDS, ghostGvids->data(), sizeof(unsigned) * ids.size());
+        writeSection(in ? SEC_SRC_GHOST_IDS : SEC_DST_GHOST_IDS, ids.data(), sizeof(unsigned) * ids.size());
+    }
+
+    // local vertices send out destinations, both per node and per vertex
+    auto writeDsts = [&](GraphSection ptrSec, GraphSection dstSec,
+                         GraphSection mapPtrSec, GraphSection mapSec,
+                         std::vector<unsigned> *ghostsList) {
+        std::vector<unsigned long long> ptrs(numNodes + 1, 0);
+        std::vector<unsigned> dsts;
+        std::vector<unsigned long long> mapPtrs(localVtxCnt + 1, 0);
+        for (unsigned i = 0; i < numNodes; ++i) {
+            dsts.insert(dsts.end(), ghostsList[i].begin(), ghostsList[i].end());
+            ptrs[i + 1] = dsts.size();
+            for (unsigned lvid : ghostsList[i]) {
+                ++mapPtrs[lvid + 1];
             }
-            if (backwardDstTables[i][j]) {
-                rawGraph.backwardGhostsList[i].push_back(j);
+        }
+        for (unsigned lvid = 0; lvid < localVtxCnt; ++lvid) {
+            mapPtrs[lvid + 1] += mapPtrs[lvid];
+        }
+        std::vector<unsigned> nodes(dsts.size());
+        std::vector<unsigned long long> fill(mapPtrs.begin(), mapPtrs.end() - 1);
+        for (unsigned i = 0; i < numNodes; ++i) {
+            for (unsigned lvid : ghostsList[i]) {
+                nodes[fill[lvid]++] = i;
             }
         }
-        rawGraph.forwardGhostsList[i].shrink_to_fit();
-        rawGraph.backwardGhostsList[i].shrink_to_fit();
-        delete[] forwardDstTables[i];
-        delete[] backwardDstTables[i];
-        forwardDstTables[i] = NULL;
-        backwardDstTables[i] = NULL;
+        writeSection(ptrSec, ptrs.data(), sizeof(unsigned long long) * ptrs.size());
+        writeSection(dstSec, dsts.data(), sizeof(unsigned) * dsts.size());
+        writeSection(mapPtrSec, mapPtrs.data(), sizeof(unsigned long long) * mapPtrs.size());
+        writeSection(mapSec, nodes.data(), sizeof(unsigned) * nodes.size());
+    };
+    writeDsts(SEC_FWD_DSTS_PTRS, SEC_FWD_DSTS, SEC_FWD_GHOST_MAP_PTRS, SEC_FWD_GHOST_MAP, forwardGhostsList);
+    writeDsts(SEC_BWD_DSTS_PTRS, SEC_BWD_DSTS, SEC_BWD_GHOST_MAP_PTRS, SEC_BWD_GHOST_MAP, backwardGhostsList);
+
+    // CSC representation of graph
+    writeSection(SEC_CSC_PTRS, forwardAdj.columnPtrs, sizeof(unsigned long long) * (localVtxCnt + 1));
+    writeSection(SEC_CSC_IDXS, forwardAdj.rowIdxs, sizeof(unsigned) * forwardAdj.nnz);
+    writeSection(SEC_CSC_VALUES, forwardAdj.values, sizeof(EdgeType) * forwardAdj.nnz);
+
+    // CSR representation of graph
+    writeSection(SEC_CSR_PTRS, backwardAdj.rowPtrs, sizeof(unsigned long long) * (localVtxCnt + 1));
+    writeSection(SEC_CSR_IDXS, backwardAdj.columnIdxs, sizeof(unsigned) * backwardAdj.nnz);
+    writeSection(SEC_CSR_VALUES, backwardAdj.values, sizeof(EdgeType) * backwardAdj.nnz);
+
+    outfile.seekp(0);
+    outfile.write(reinterpret_cast<const char *>(&header), sizeof(GraphFileHeader));
+    outfile.close();
+    if (outfile.fail()) {
+        std::cout << "Cannot write output file:" << tmpFile << ", [Reason: " << std::strerror(errno) << "]" << std::endl;
+        unlink(tmpFile.c_str());
+        return;
     }
-    delete[] forwardDstTables;
-    delete[] backwardDstTables;
-    forwardDstTables = NULL;
-    backwardDstTables = NULL;
+    // set file permission to 777 to allow accesses from other users
+    chmod(tmpFile.c_str(), S_IRWXU | S_IRWXG | S_IRWXO);
+    if (rename(tmpFile.c_str(), processedGraphFile.c_str()) != 0) {
+        std::cout << "Cannot rename " << tmpFile << " to " << processedGraphFile << ", [Reason: " << std::strerror(errno) << "]" << std::endl;
+        unlink(tmpFile.c_str());
+    }
+}
 
-    infile.close();
+/**
+ *
+ * Read and parse the graph from the graph binary snap file.
+ *
+ */
+void DataLoader::preprocess() {
+    printLog(nodeId, "Preprocessing with %u threads... Output to %s", numThreads, processedGraphFile.c_str());
 
-    // Extra works added.
-    rawGraph.setNumInEdgeGhostVertices(rawGraph.getInEdgeGhostVertices().size());
-    rawGraph.setNumOutEdgeGhostVertices(rawGraph.getOutEdgeGhostVertices().size());
-    findGhostDegrees();
-    setEdgeNormalizations();
-
-    // Set a local index for all ghost vertices along the way. This index is used
-    // for indexing within the ghost data arrays.
-    unsigned ghostCount = rawGraph.getNumLocalVertices();
-    for (auto it = rawGraph.getInEdgeGhostVertices().begin();
-             it != rawGraph.getInEdgeGhostVertices().end(); it++) {
-        it->second.setLocalId(ghostCount++);
-    }
-    ghostCount = rawGraph.getNumLocalVertices();
-    for (auto it = rawGraph.getOutEdgeGhostVertices().begin();
-             it != rawGraph.getOutEdgeGhostVertices().end(); it++) {
-        it->second.setLocalId(ghostCount++);
-    }
+    // Read in the partition file.
+    readPartsFile();
+
+    // Keep the edges of local vertices, in one parallel pass.
+    readEdgesFile();
+
+    // Counting-sort them into the CSC / CSR.
+    buildAdjacency();
 
-    rawGraph.forwardAdj.init(rawGraph);
-    rawGraph.backwardAdj.init(rawGraph);
+    reorderVertices();
 
-    rawGraph.dump(processedGraphFile, numNodes);
+    dump();
 
     printLog(nodeId, "Finish preprocessing!");
 }
@@ -14,30 +14,90 @@ struct BSHeaderType {
     unsigned long long numEdges;
 };
 
+/** Edges read per thread per file access; bounds the read buffers. */
+#define EDGE_BLOCK_SIZE (1 << 20)
 
+/** A local vertex and the global ID of one of its neighbors. */
+struct EdgeRecord {
+    unsigned lvid;
+    unsigned gvid;
+};
+
+
+/**
+ *
+ * Turns the binary snap edge list and partition file into this node's
+ * graph.<n>.bin. The edge list is read once, by all threads in parallel,
+ * keeping only the edges of local vertices; CSC / CSR are then built from
+ * them by a parallel, stable counting sort.
+ *
+ */
 class DataLoader {
 public:
-    DataLoader(std::string datasetDir, unsigned _nodeId, unsigned _numNodes, bool _undirected);
+    DataLoader(std::string datasetDir, unsigned _nodeId, unsigned _numNodes, bool _undirected,
+               ReorderType _reorder = REORDER_NONE);
     ~DataLoader();
 
     void readPartsFile();
-    void processEdge(unsigned &from, unsigned &to);
-    void findGhostDegrees();
-    void setEdgeNormalizations();
+    void readEdgesFile();
+    void buildAdjacency();
+    void reorderVertices();
+    void dump();
     void preprocess();
 
 private:
+    void processEdge(unsigned tid, unsigned from, unsigned to);
+    unsigned bucketOf(unsigned lvid) { return lvid / bucketSize; }
+    void buildGhostTable(std::vector<char> &ghostFlags, std::vector<unsigned> &ghostGvids);
+    void fillBuckets(std::vector<EdgeRecord> *records, std::vector<unsigned> &ghostGvids,
+                     std::vector<float> &localNorms, unsigned long long *ptrs,
+                     unsigned *idxs, EdgeType *values, std::vector<unsigned> *ghostsList);
+
     unsigned nodeId;
     unsigned numNodes;
+    unsigned numThreads;
 
     std::string graphFile;
     std::string partsFile;
     bool undirected;
+    ReorderType reorder;
 
     std::string processedGraphFile;
 
-    RawGraph rawGraph;
+    // vertices
+    unsigned localVtxCnt;
+    unsigned globalVtxCnt;
+    std::vector<short> partIds;             // partition of each global vertex
+    // local ID of each local global vertex; remote vertices hold their ghost
+    // ID in the CSC / CSR being built
+    std::vector<unsigned> localIds;
+    std::vector<unsigned> localToGlobalId;
+    std::vector<unsigned> reorderedIds;
+    std::vector<EdgeType> normFactors;
+    // in degree of every global vertex in the edge file, for ghost norms
+    std::vector<unsigned> globalInDegrees;
+    // ghost vertices, flagged per global vertex and then listed in global ID
+    // order; a ghost's ID is localVtxCnt + its position in the list
+    std::vector<char> inGhostFlags;
+    std::vector<char> outGhostFlags;
+    std::vector<unsigned> inGhostGvids;
+    std::vector<unsigned> outGhostGvids;
+
+    // edges
+    unsigned long long globalEdgeCnt;
+    // Edge records bucketed by local vertex range, one vector per
+    // (thread, bucket), at records[tid * numBuckets + bucket]. Each thread
+    // reads a contiguous range of the edge file, so walking a bucket's
+    // vectors in thread order yields its edges in file order.
+    unsigned numBuckets;
+    unsigned bucketSize;
+    std::vector<EdgeRecord> *inRecords;     // (dst lvid, src gvid)
+    std::vector<EdgeRecord> *outRecords;    // (src lvid, dst gvid)
+
+    // local vertices send out destinations during forward / backward
+    std::vector<unsigned> *forwardGhostsList;
+    std::vector<unsigned> *backwardGhostsList;
 
-    bool **forwardDstTables;
-    bool **backwardDstTables;
+    CSCMatrix<EdgeType> forwardAdj;
+    CSRMatrix<EdgeType> backwardAdj;
 };
@@ -2,128 +2,188 @@
 #include "graph.hpp"
 #include <fstream>
 #include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
-void Graph::init(std::string graphFile) {
-    std::ifstream infile(graphFile.c_str(), std::ios::binary);
-    if (!infile.good()) {
-        std::cout << "Cannot open input file: " << graphFile << ", [Reason: " << std::strerror(errno) << "]" << std::endl;
-        return;
+Graph::~Graph() {
+    if (mapAddr) {
+        munmap(mapAddr, mapSize);
     }
-    assert(infile.good());
-    // vertex count
-    infile.read(reinterpret_cast<char *>(&localVtxCnt), sizeof(unsigned));
-    infile.read(reinterpret_cast<char *>(&globalVtxCnt), sizeof(unsigned));
-    infile.read(reinterpret_cast<char *>(&srcGhostCnt), sizeof(unsigned));
-    infile.read(reinterpret_cast<char *>(&dstGhostCnt), sizeof(unsigned));
-    // edge count
-    infile.read(reinterpret_cast<char *>(&localInEdgeCnt), sizeof(unsigned long long));
-    infile.read(reinterpret_cast<char *>(&localOutEdgeCnt), sizeof(unsigned long long));
-    infile.read(reinterpret_cast<char *>(&globalEdgeCnt), sizeof(unsigned long long));
+}
 
-    localToGlobalId.resize(localVtxCnt);
-    // local vertex global IDs
-    infile.read(reinterpret_cast<char *>(localToGlobalId.data()), sizeof(unsigned) * localVtxCnt);
-    // construct mapping of local vertex global IDs to local IDs
-    for (unsigned lvid = 0; lvid < localVtxCnt; ++lvid) {
-        globaltoLocalId[localToGlobalId[lvid]] = lvid;
-    }
-    vtxDataVec.resize(localVtxCnt);
-    // vertex data (normFactor for GCN)
-    infile.read(reinterpret_cast<char *>(vtxDataVec.data()), sizeof(EdgeType) * localVtxCnt);
-    // mapping of src ghost vertex global IDs to local IDs
-    for (unsigned i = 0; i < srcGhostCnt; ++i) {
-        unsigned gvid = 0;
-        unsigned lvid = 0;
-        infile.read(reinterpret_cast<char *>(&gvid), sizeof(unsigned));
-        infile.read(reinterpret_cast<char *>(&lvid), sizeof(unsigned));
-        srcGhostVtcs[gvid] = lvid;
-    }
-    // mapping of dst ghost vertex global IDs to local IDs
-    for (unsigned i = 0; i < dstGhostCnt; ++i) {
-        unsigned gvid = 0;
-        unsigned lvid = 0;
-        infile.read(reinterpret_cast<char *>(&gvid), sizeof(unsigned));
-        infile.read(reinterpret_cast<char *>(&lvid), sizeof(unsigned));
-        dstGhostVtcs[gvid] = lvid;
-    }
-    // destination of local vertices during forward
-    unsigned numNodes = 0;
-    infile.read(reinterpret_cast<char *>(&numNodes), sizeof(unsigned));
-    for (unsigned i = 0; i < numNodes; ++i) {
-        unsigned size = 0;
-        infile.read(reinterpret_cast<char *>(&size), sizeof(unsigned));
-        forwardLocalVtxDsts.push_back(std::vector<unsigned>(size));
-        infile.read(reinterpret_cast<char *>(forwardLocalVtxDsts[i].data()), sizeof(unsigned) * size);
-    }
-    // destination of local vertices during backward
-    for (unsigned i = 0; i < numNodes; ++i) {
-        unsigned size = 0;
-        infile.read(reinterpret_cast<char *>(&size), sizeof(unsigned));
-        backwardLocalVtxDsts.push_back(std::vector<unsigned>(size));
-        infile.read(reinterpret_cast<char *>(backwardLocalVtxDsts[i].data()), sizeof(unsigned) * size);
+/**
+ *
+ * Whether a header describes a complete file of fileSize bytes in the
+ * current layout: the right magic and version, and every section aligned
+ * and within the file.
+ *
+ */
+static bool validHeader(const GraphFileHeader &header, unsigned long long fileSize) {
+    if (std::strncmp(header.magic, GRAPH_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != GRAPH_FILE_VERSION) {
+        return false;
+    }
+    for (unsigned sec = 0; sec < NUM_GRAPH_SECTIONS; ++sec) {
+        unsigned long long offset = header.sectionOffsets[sec];
+        unsigned long long size = header.sectionSizes[sec];
+        if (offset < sizeof(GraphFileHeader) || offset % GRAPH_FILE_ALIGN != 0 ||
+            offset > fileSize || size > fileSize - offset) {
+            return false;
+        }
     }
+    return true;
+}
 
-    // Create alternate representation of local vertex destinations for pipelined version
-    for (unsigned nid = 0; nid < numNodes; ++nid) {
-        std::vector<unsigned>& vids = forwardLocalVtxDsts[nid];
-        for (unsigned i = 0; i < vids.size(); ++i) {
-            if (forwardGhostMap.find(vids[i]) == forwardGhostMap.end()) {
-                forwardGhostMap[vids[i]] = std::vector<unsigned>();
-            }
-
-            forwardGhostMap[vids[i]].push_back(nid);
-        }
+/**
+ *
+ * Read a graph file's header. Returns false if the file is missing, not in
+ * the current layout or incomplete, i.e. it has to be preprocessed again.
+ *
+ */
+bool Graph::readHeader(std::string graphFile, GraphFileHeader &header) {
+    std::ifstream infile(graphFile.c_str(), std::ios::binary | std::ios::ate);
+    if (!infile.good()) {
+        return false;
+    }
+    unsigned long long fileSize = infile.tellg();
+    infile.seekg(0);
+    if (!infile.read(reinterpret_cast<char *>(&header), sizeof(GraphFileHeader))) {
+        return false;
     }
+    return validHeader(header, fileSize);
+}
 
-    for (unsigned nid = 0; nid < numNodes; ++nid) {
-        std::vector<unsigned>& vids = backwardLocalVtxDsts[nid];
-        for (unsigned i = 0; i < vids.size(); ++i) {
-            if (backwardGhostMap.find(vids[i]) == backwardGhostMap.end()) {
-                backwardGhostMap[vids[i]] = std::vector<unsigned>();
-            }
+/**
+ *
+ * Map the graph file and point all members at their sections. Nothing is
+ * copied or parsed, so startup cost does not grow with the partition size.
+ * Returns false if the file cannot be mapped or is incomplete.
+ *
+ */
+bool Graph::init(std::string graphFile) {
+    int fd = open(graphFile.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cout << "Cannot open input file: " << graphFile << ", [Reason: " << std::strerror(errno) << "]" << std::endl;
+        return false;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    mapSize = st.st_size;
+    if (mapSize < sizeof(GraphFileHeader)) {
+        std::cout << "Truncated graph file: " << graphFile << std::endl;
+        close(fd);
+        return false;
+    }
+    mapAddr = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapAddr == MAP_FAILED) {
+        std::cout << "Cannot map input file: " << graphFile << ", [Reason: " << std::strerror(errno) << "]" << std::endl;
+        mapAddr = NULL;
+        return false;
+    }
+
+    char *base = reinterpret_cast<char *>(mapAddr);
+    const GraphFileHeader &header = *reinterpret_cast<GraphFileHeader *>(base);
+    if (!validHeader(header, mapSize)) {
+        std::cout << "Bad or incomplete graph file: " << graphFile << std::endl;
+        munmap(mapAddr, mapSize);
+        mapAddr = NULL;
+        return false;
+    }
+    auto section = [&](GraphSection sec) { return base + header.sectionOffsets[sec]; };
 
-            backwardGhostMap[vids[i]].push_back(nid);
-        }
-    }
+    // vertex count
+    localVtxCnt = header.localVtxCnt;
+    globalVtxCnt = header.globalVtxCnt;
+    srcGhostCnt = header.srcGhostCnt;
+    dstGhostCnt = header.dstGhostCnt;
+    // edge count
+    localInEdgeCnt = header.localInEdgeCnt;
+    localOutEdgeCnt = header.localOutEdgeCnt;
+    globalEdgeCnt = header.globalEdgeCnt;
+
+    // local vertex global IDs, vertex data (normFactor for GCN) and order
+    localToGlobalId = ArrayView<unsigned>(reinterpret_cast<unsigned *>(section(SEC_LOCAL_TO_GLOBAL)), localVtxCnt);
+    vtxDataVec = ArrayView<EdgeType>(reinterpret_cast<EdgeType *>(section(SEC_VTX_DATA)), localVtxCnt);
+    reorder = (ReorderType)header.reorder;
+    reorderedIds = ArrayView<unsigned>(reinterpret_cast<unsigned *>(section(SEC_REORDERED_IDS)), localVtxCnt);
+    // mapping of local / src ghost / dst ghost global IDs to local IDs
+    globaltoLocalId.init(reinterpret_cast<unsigned *>(section(SEC_LOCAL_GVIDS)),
+                         reinterpret_cast<unsigned *>(section(SEC_LOCAL_IDS)), localVtxCnt);
+    srcGhostVtcs.init(reinterpret_cast<unsigned *>(section(SEC_SRC_GHOST_GVIDS)),
+                      reinterpret_cast<unsigned *>(section(SEC_SRC_GHOST_IDS)), srcGhostCnt);
+    dstGhostVtcs.init(reinterpret_cast<unsigned *>(section(SEC_DST_GHOST_GVIDS)),
+                      reinterpret_cast<unsigned *>(section(SEC_DST_GHOST_IDS)), dstGhostCnt);
+    // ghost lookups happen per received vertex
+    srcGhostVtcs.buildIndex();
+    dstGhostVtcs.buildIndex();
+
+    // destination of local vertices during forward / backward
+    unsigned long long *fwdDstPtrs = reinterpret_cast<unsigned long long *>(section(SEC_FWD_DSTS_PTRS));
+    unsigned long long *bwdDstPtrs = reinterpret_cast<unsigned long long *>(section(SEC_BWD_DSTS_PTRS));
+    unsigned *fwdDsts = reinterpret_cast<unsigned *>(section(SEC_FWD_DSTS));
+    unsigned *bwdDsts = reinterpret_cast<unsigned *>(section(SEC_BWD_DSTS));
+    for (unsigned i = 0; i < header.numNodes; ++i) {
+        forwardLocalVtxDsts.push_back(ArrayView<unsigned>(fwdDsts + fwdDstPtrs[i], fwdDstPtrs[i + 1] - fwdDstPtrs[i]));
+        backwardLocalVtxDsts.push_back(ArrayView<unsigned>(bwdDsts + bwdDstPtrs[i], bwdDstPtrs[i + 1] - bwdDstPtrs[i]));
+    }
+    // the same, per local vertex, for pipelined scatter
+    forwardGhostMap.init(reinterpret_cast<unsigned long long *>(section(SEC_FWD_GHOST_MAP_PTRS)),
+                         reinterpret_cast<unsigned *>(section(SEC_FWD_GHOST_MAP)), localVtxCnt);
+    backwardGhostMap.init(reinterpret_cast<unsigned long long *>(section(SEC_BWD_GHOST_MAP_PTRS)),
+                          reinterpret_cast<unsigned *>(section(SEC_BWD_GHOST_MAP)), localVtxCnt);
 
     // CSC representation of graph
-    infile.read(reinterpret_cast<char *>(&forwardAdj.columnCnt), sizeof(unsigned));
-    infile.read(reinterpret_cast<char *>(&forwardAdj.nnz), sizeof(unsigned long long));
-    forwardAdj.values = new EdgeType[forwardAdj.nnz];
-    forwardAdj.locations = new char[forwardAdj.nnz];
-    forwardAdj.columnPtrs = new unsigned long long[localVtxCnt + 1];
-    forwardAdj.rowIdxs = new unsigned[forwardAdj.nnz];
-    infile.read(reinterpret_cast<char *>(forwardAdj.values), sizeof(EdgeType) * forwardAdj.nnz);
-    // infile.read(reinterpret_cast<char *>(forwardAdj.locations), sizeof(char) * forwardAdj.nnz);
-    infile.read(reinterpret_cast<char *>(forwardAdj.columnPtrs), sizeof(unsigned long long) * (localVtxCnt + 1));
-    infile.read(reinterpret_cast<char *>(forwardAdj.rowIdxs), sizeof(unsigned) * forwardAdj.nnz);
+    forwardAdj.columnCnt = localVtxCnt;
+    forwardAdj.nnz = header.forwardNnz;
+    forwardAdj.columnPtrs = reinterpret_cast<unsigned long long *>(section(SEC_CSC_PTRS));
+    forwardAdj.rowIdxs = reinterpret_cast<unsigned *>(section(SEC_CSC_IDXS));
+    forwardAdj.values = reinterpret_cast<EdgeType *>(section(SEC_CSC_VALUES));
+    forwardAdj.mapped = true;
 
-    // CSR representation of grpah
-    infile.read(reinterpret_cast<char *>(&backwardAdj.rowCnt), sizeof(unsigned));
-    infile.read(reinterpret_cast<char *>(&backwardAdj.nnz), sizeof(unsigned long long));
-    backwardAdj.values = new EdgeType[backwardAdj.nnz];
-    backwardAdj.locations = new char[backwardAdj.nnz];
-    backwardAdj.rowPtrs = new unsigned long long[localVtxCnt + 1];
-    backwardAdj.columnIdxs = new unsigned[backwardAdj.nnz];
-    infile.read(reinterpret_cast<char *>(backwardAdj.values), sizeof(EdgeType) * backwardAdj.nnz);
-    // infile.read(reinterpret_cast<char *>(backwardAdj.locations), sizeof(char) * backwardAdj.nnz);
-    infile.read(reinterpret_cast<char *>(backwardAdj.rowPtrs), sizeof(unsigned long long) * (localVtxCnt + 1));
-    infile.read(reinterpret_cast<char *>(backwardAdj.columnIdxs), sizeof(unsigned) * backwardAdj.nnz);
+    // CSR representation of graph
+    backwardAdj.rowCnt = localVtxCnt;
+    backwardAdj.nnz = header.backwardNnz;
+    backwardAdj.rowPtrs = reinterpret_cast<unsigned long long *>(section(SEC_CSR_PTRS));
+    backwardAdj.columnIdxs = reinterpret_cast<unsigned *>(section(SEC_CSR_IDXS));
+    backwardAdj.values = reinterpret_cast<EdgeType *>(section(SEC_CSR_VALUES));
+    backwardAdj.mapped = true;
+    return true;
+}
 
-    infile.close();
+/**
+ *
+ * Build the hash index: a power-of-two table at most half full, linear
+ * probing on a multiplicative hash of the global ID.
+ *
+ */
+void SortedIdMap::buildIndex() {
+    unsigned slotCnt = 16;
+    while (slotCnt < 2 * (unsigned long long)cnt) {
+        slotCnt *= 2;
+    }
+    slotMask = slotCnt - 1;
+    Slot empty = { EMPTY_SLOT, 0 };
+    slots.assign(slotCnt, empty);
+    for (unsigned i = 0; i < cnt; ++i) {
+        assert(gvids[i] != EMPTY_SLOT);
+        Slot &slot = slots[probe(gvids[i])];
+        slot.gvid = gvids[i];
+        slot.id = ids[i];
+    }
 }
 
 bool Graph::containsVtx(unsigned gvid) {
-    return globaltoLocalId.find(gvid) != globaltoLocalId.end();
+    return globaltoLocalId.contains(gvid);
 }
 
 bool Graph::containsSrcGhostVtx(unsigned gvid) {
-    return srcGhostVtcs.find(gvid) != srcGhostVtcs.end();
+    return srcGhostVtcs.contains(gvid);
 }
 
 bool Graph::containsDstGhostVtx(unsigned gvid) {
-    return dstGhostVtcs.find(gvid) != dstGhostVtcs.end();
+    return dstGhostVtcs.contains(gvid);
 }
 
 void Graph::print() {
@@ -132,142 +192,3 @@ void Graph::print() {
             localInEdgeCnt, localOutEdgeCnt, globalEdgeCnt,
             forwardAdj.nnz, backwardAdj.nnz);
 }
-
-Vertex&
-RawGraph::getVertex(unsigned lvid) {
-    assert(lvid < vertices.size());
-    return vertices[lvid];
-}
-
-Vertex&
-RawGraph::getVertexByGlobal(unsigned gvid) {
-    assert(globalToLocalId.find(gvid) != globalToLocalId.end());
-    return vertices[globalToLocalId[gvid]];
-}
-
-bool
-RawGraph::containsVertex(unsigned gvid) {
-    return globalToLocalId.find(gvid) != globalToLocalId.end();
-}
-
-GhostVertex&
-RawGraph::getInEdgeGhostVertex(unsigned gvid) {
-    assert(inEdgeGhostVertices.find(gvid) != inEdgeGhostVertices.end());
-    return inEdgeGhostVertices[gvid];
-}
-
-GhostVertex&
-RawGraph::getOutEdgeGhostVertex(unsigned gvid) {
-    assert(outEdgeGhostVertices.find(gvid) != outEdgeGhostVertices.end());
-    return outEdgeGhostVertices[gvid];
-}
-
-bool
-RawGraph::containsInEdgeGhostVertex(unsigned gvid) {
-    return inEdgeGhostVertices.find(gvid) != inEdgeGhostVertices.end();
-}
-
-bool
-RawGraph::containsOutEdgeGhostVertex(unsigned gvid) {
-    return outEdgeGhostVertices.find(gvid) != outEdgeGhostVertices.end();
-}
-
-
-/**
- *
- * Compact a graph's data. Mainly does the following things:
- *     1. Shrink all the vertices' edges vector.
- *     2. Shrink all the ghost vertices' edges vector.
- *     3. Shrink the vertices and partitions vector.
- *
- */
-void
-RawGraph::compactGraph() {
-    vertexPartitionIds.shrink_to_fit();
-    vertices.shrink_to_fit();
-
-    for (unsigned i = 0; i < vertices.size(); ++i)
-        vertices[i].compactVertex();
-
-    for (auto it = inEdgeGhostVertices.begin(); it != inEdgeGhostVertices.end(); ++it) {
-        it->second.compactVertex();
-    }
-    for (auto it = outEdgeGhostVertices.begin(); it != outEdgeGhostVertices.end(); ++it) {
-        it->second.compactVertex();
-    }
-}
-
-void
-RawGraph::dump(std::string filename, unsigned numNodes) {
-    std::ofstream outfile(filename, std::ofstream::binary);
-    if (!outfile.good()) {
-        std::cout << "Cannot open output file:" << filename << ", [Reason: " << std::strerror(errno) << "]" << std::endl;
-        return;
-    }
-    // vertex count (local/global/incoming ghost/outgoing ghost)
-    outfile.write(reinterpret_cast<const char*>(&numLocalVertices), sizeof(numLocalVertices));
-    outfile.write(reinterpret_cast<const char*>(&numGlobalVertices), sizeof(numGlobalVertices));
-    outfile.write(reinterpret_cast<const char *>(&numInEdgeGhostVertices), sizeof(numInEdgeGhostVertices));
-    outfile.write(reinterpret_cast<const char *>(&numOutEdgeGhostVertices), sizeof(numOutEdgeGhostVertices));
-    // edge count (local incoming/local outgoing/global)
-    outfile.write(reinterpret_cast<const char*>(&numLocalInEdges), sizeof(numLocalInEdges));
-    outfile.write(reinterpret_cast<const char*>(&numLocalOutEdges), sizeof(numLocalOutEdges));
-    outfile.write(reinterpret_cast<const char*>(&numGlobalEdges), sizeof(numGlobalEdges));
-    // global IDs of local vertices
-    for (unsigned i = 0; i < numLocalVertices; ++i) {
-        unsigned gvid = localToGlobalId[i];
-        outfile.write(reinterpret_cast<const char *>(&gvid), sizeof(unsigned));
-    }
-    // normFactors of local vertices
-    for (unsigned i = 0; i < numLocalVertices; ++i) {
-        EdgeType normFactor = vertices[i].getNormFactor();
-        outfile.write(reinterpret_cast<const char *>(&normFactor), sizeof(normFactor));
-    }
-    // mapping of incoming ghost's global ID to local ID
-    for (auto &itr: inEdgeGhostVertices) {
-        unsigned gvid = itr.first;
-        unsigned lvid = itr.second.getLocalId();
-        outfile.write(reinterpret_cast<const char *>(&gvid), sizeof(unsigned));
-        outfile.write(reinterpret_cast<const char *>(&lvid), sizeof(unsigned));
-    }
-    // mapping of outgoing ghost's global ID to local ID
-    for (auto &itr : outEdgeGhostVertices) {
-        unsigned gvid = itr.first;
-        unsigned lvid = itr.second.getLocalId();
-        outfile.write(reinterpret_cast<const char *>(&gvid), sizeof(unsigned));
-        outfile.write(reinterpret_cast<const char *>(&lvid), sizeof(unsigned));
-    }
-    outfile.write(reinterpret_cast<const char *>(&numNodes), sizeof(unsigned));
-    // local vertices send out destinations during forward
-    for (unsigned i = 0; i < numNodes; ++i) {
-        unsigned size = forwardGhostsList[i].size();
-        outfile.write(reinterpret_cast<const char *>(&size), sizeof(unsigned));
-        outfile.write(reinterpret_cast<const char *>(forwardGhostsList[i].data()), sizeof(unsigned) * size);
-    }
-    // local vertices send out destinations during backward
-    for (unsigned i = 0; i < numNodes; ++i) {
-        unsigned size = backwardGhostsList[i].size();
-        outfile.write(reinterpret_cast<const char *>(&size), sizeof(unsigned));
-        outfile.write(reinterpret_cast<const char *>(backwardGhostsList[i].data()), sizeof(unsigned) * size);
-    }
-
-    // CSC representation of graph
-    outfile.write(reinterpret_cast<const char *>(&forwardAdj.columnCnt), sizeof(unsigned));
-    outfile.write(reinterpret_cast<const char *>(&forwardAdj.nnz), sizeof(unsigned long long));
-    outfile.write(reinterpret_cast<const char *>(forwardAdj.values), sizeof(EdgeType) * forwardAdj.nnz);
-    // outfile.write(reinterpret_cast<const char *>(forwardAdj.locations), sizeof(char) * forwardAdj.nnz);
-    outfile.write(reinterpret_cast<const char *>(forwardAdj.columnPtrs), sizeof(unsigned long long) * (numLocalVertices + 1));
-    outfile.write(reinterpret_cast<const char *>(forwardAdj.rowIdxs), sizeof(unsigned) * forwardAdj.nnz);
-
-    // CSR representation of graph
-    outfile.write(reinterpret_cast<const char *>(&backwardAdj.rowCnt), sizeof(unsigned));
-    outfile.write(reinterpret_cast<const char *>(&backwardAdj.nnz), sizeof(unsigned long long));
-    outfile.write(reinterpret_cast<const char *>(backwardAdj.values), sizeof(EdgeType) * backwardAdj.nnz);
-    // outfile.write(reinterpret_cast<const char *>(backwardAdj.locations), sizeof(char) * backwardAdj.nnz);
-    outfile.write(reinterpret_cast<const char *>(backwardAdj.rowPtrs), sizeof(unsigned long long) * (numLocalVertices + 1));
-    outfile.write(reinterpret_cast<const char *>(backwardAdj.columnIdxs), sizeof(unsigned) * backwardAdj.nnz);
-
-    outfile.close();
-    // set file permission to 777 to allow accesses from other users
-    chmod(filename.c_str(), S_IRWXU | S_IRWXG | S_IRWXO);
-}
@@ -2,27 +2,26 @@
 #define __GRAPH_HPP__
 
 
+#include <algorithm>
+#include <cassert>
+#include <climits>
 #include <vector>
 #include <map>
 #include "../parallel/lock.hpp"
 #include "../utils/utils.hpp"
-#include "vertex.hpp"
-#include "edge.hpp"
-
-class Graph;
-class RawGraph;
+#include "reorder.hpp"
 
 template<typename T>
 class CSCMatrix {
 public:
-    CSCMatrix() : columnCnt(0), nnz(0), values(NULL), locations(NULL), columnPtrs(NULL), rowIdxs(NULL) {};
+    CSCMatrix() : columnCnt(0), nnz(0), values(NULL), locations(NULL), columnPtrs(NULL), rowIdxs(NULL), mapped(false) {};
     ~CSCMatrix() {
+        if (mapped)     { return; }
         if (values)     { delete[] values; }
         if (locations)  { delete[] locations; }
         if (columnPtrs) { delete[] columnPtrs; }
         if (rowIdxs)    { delete[] rowIdxs; }
     };
-    void init(RawGraph &rgraph);
 
     unsigned columnCnt;
     unsigned long long nnz;         // number of non-zero elements
@@ -30,19 +29,20 @@ public:
     char *locations;                // edge locations vector
     unsigned long long *columnPtrs; // pointers to the start of each column
     unsigned *rowIdxs;              // indices of nz elements in each column
+    bool mapped;                    // arrays live in a mapped graph file
 };
 
 template<typename T>
 class CSRMatrix {
 public:
-    CSRMatrix() : rowCnt(0), nnz(0), values(NULL), locations(NULL), rowPtrs(NULL), columnIdxs(NULL) {};
+    CSRMatrix() : rowCnt(0), nnz(0), values(NULL), locations(NULL), rowPtrs(NULL), columnIdxs(NULL), mapped(false) {};
     ~CSRMatrix() {
+        if (mapped)     { return; }
         if (values)     { delete[] values; }
         if (locations)  { delete[] locations; }
         if (rowPtrs)    { delete[] rowPtrs; }
         if (columnIdxs) { delete[] columnIdxs; }
     };
-    void init(RawGraph &rgraph);
 
     unsigned rowCnt;
     unsigned long long nnz;      // number of non-zero elements
@@ -50,16 +50,180 @@ public:
     char *locations;             // edge locations vector
     unsigned long long *rowPtrs; // pointers to the start of each row
     unsigned *columnIdxs;        // indices of nz elements in each row
+    bool mapped;                 // arrays live in a mapped graph file
+};
+
+/** Layout of graph.<n>.bin. Bump the version on any change. */
+#define GRAPH_FILE_MAGIC "DORYGRF"
+#define GRAPH_FILE_VERSION 2
+#define GRAPH_FILE_ALIGN 4096
+
+/** Sections of a graph file, each starting on a GRAPH_FILE_ALIGN boundary. */
+enum GraphSection {
+    SEC_LOCAL_TO_GLOBAL,                        // unsigned[localVtxCnt]
+    SEC_VTX_DATA,                               // EdgeType[localVtxCnt]
+    SEC_REORDERED_IDS,                          // unsigned[localVtxCnt]
+    SEC_LOCAL_GVIDS, SEC_LOCAL_IDS,             // sorted global IDs and their local IDs
+    SEC_SRC_GHOST_GVIDS, SEC_SRC_GHOST_IDS,     // sorted global IDs and their ghost IDs
+    SEC_DST_GHOST_GVIDS, SEC_DST_GHOST_IDS,
+    SEC_FWD_DSTS_PTRS, SEC_FWD_DSTS,            // node -> local vertices sent to it
+    SEC_BWD_DSTS_PTRS, SEC_BWD_DSTS,
+    SEC_FWD_GHOST_MAP_PTRS, SEC_FWD_GHOST_MAP,  // local vertex -> nodes it is sent to
+    SEC_BWD_GHOST_MAP_PTRS, SEC_BWD_GHOST_MAP,
+    SEC_CSC_PTRS, SEC_CSC_IDXS, SEC_CSC_VALUES,
+    SEC_CSR_PTRS, SEC_CSR_IDXS, SEC_CSR_VALUES,
+    NUM_GRAPH_SECTIONS
+};
+
+struct GraphFileHeader {
+    char magic[8];
+    unsigned version;
+    unsigned reorder;
+    unsigned localVtxCnt;
+    unsigned globalVtxCnt;
+    unsigned srcGhostCnt;
+    unsigned dstGhostCnt;
+    unsigned numNodes;
+    unsigned padding;
+    unsigned long long localInEdgeCnt;
+    unsigned long long localOutEdgeCnt;
+    unsigned long long globalEdgeCnt;
+    unsigned long long forwardNnz;
+    unsigned long long backwardNnz;
+    unsigned long long sectionOffsets[NUM_GRAPH_SECTIONS];
+    unsigned long long sectionSizes[NUM_GRAPH_SECTIONS];    // in bytes
+};
+
+/**
+ *
+ * Fixed-size array over memory the view does not own.
+ *
+ */
+template<typename T>
+class ArrayView {
+public:
+    ArrayView() : ptr(NULL), cnt(0) {}
+    ArrayView(T *_ptr, size_t _cnt) : ptr(_ptr), cnt(_cnt) {}
+
+    T &operator[](size_t i) const { return ptr[i]; }
+    T *data() const { return ptr; }
+    size_t size() const { return cnt; }
+    bool empty() const { return cnt == 0; }
+    T *begin() const { return ptr; }
+    T *end() const { return ptr + cnt; }
+
+private:
+    T *ptr;
+    size_t cnt;
+};
+
+/**
+ *
+ * Global ID -> ID lookup over a sorted global ID array and the matching ID
+ * array, used in place. Lookups binary search the table unless buildIndex()
+ * added an open-addressing hash index, which answers a lookup with a single
+ * cache line on the common path; tables on per-message hot paths get one.
+ *
+ */
+class SortedIdMap {
+public:
+    SortedIdMap() : gvids(NULL), ids(NULL), cnt(0), slotMask(0) {}
+    void init(const unsigned *_gvids, const unsigned *_ids, unsigned _cnt) {
+        gvids = _gvids;
+        ids = _ids;
+        cnt = _cnt;
+        slots.clear();
+    }
+    void buildIndex();
+
+    unsigned size() const { return cnt; }
+    // Position of gvid in the table, or size() if absent.
+    unsigned find(unsigned gvid) const {
+        const unsigned *it = std::lower_bound(gvids, gvids + cnt, gvid);
+        return (it != gvids + cnt && *it == gvid) ? it - gvids : cnt;
+    }
+    bool contains(unsigned gvid) const {
+        if (!slots.empty()) {
+            return slots[probe(gvid)].gvid == gvid;
+        }
+        return find(gvid) != cnt;
+    }
+    unsigned operator[](unsigned gvid) const {
+        if (!slots.empty()) {
+            const Slot &slot = slots[probe(gvid)];
+            assert(slot.gvid == gvid);
+            return slot.id;
+        }
+        unsigned i = find(gvid);
+        assert(i < cnt);
+        return ids[i];
+    }
+    unsigned gvidAt(unsigned i) const { return gvids[i]; }
+    unsigned idAt(unsigned i) const { return ids[i]; }
+
+private:
+    struct Slot {
+        unsigned gvid;
+        unsigned id;
+    };
+    static const unsigned EMPTY_SLOT = UINT_MAX;
+
+    // Slot holding gvid, or the empty slot where it would go.
+    unsigned probe(unsigned gvid) const {
+        unsigned s = (gvid * 0x9E3779B1u) & slotMask;
+        while (slots[s].gvid != gvid && slots[s].gvid != EMPTY_SLOT) {
+            s = (s + 1) & slotMask;
+        }
+        return s;
+    }
+
+    const unsigned *gvids;
+    const unsigned *ids;
+    unsigned cnt;
+    std::vector<Slot> slots;
+    unsigned slotMask;
 };
 
 /**
  *
- * Class of a graph, composed of vertices and directed edges.
+ * Local vertex -> remote nodes it is sent to, CSR style.
+ *
+ */
+class VertexNodesMap {
+public:
+    VertexNodesMap() : ptrs(NULL), nodes(NULL), vtxCnt(0) {}
+    void init(const unsigned long long *_ptrs, const unsigned *_nodes, unsigned _vtxCnt) {
+        ptrs = _ptrs;
+        nodes = _nodes;
+        vtxCnt = _vtxCnt;
+    }
+
+    ArrayView<const unsigned> operator[](unsigned lvid) const {
+        assert(lvid < vtxCnt);
+        return ArrayView<const unsigned>(nodes + ptrs[lvid], ptrs[lvid + 1] - ptrs[lvid]);
+    }
+
+private:
+    const unsigned long long *ptrs;
+    const unsigned *nodes;
+    unsigned vtxCnt;
+};
+
+/**
+ *
+ * Class of a graph, composed of vertices and directed edges. All arrays are
+ * used in place from the memory-mapped graph file. The mapping is private,
+ * so pages are shared with the page cache (and other processes mapping the
+ * same file) until written; only GAT writes, to forwardAdj.values.
  *
  */
 class Graph {
 public:
-    void init(std::string graphFile);
+    Graph() : mapAddr(NULL), mapSize(0) {}
+    ~Graph();
+
+    bool init(std::string graphFile);
+    static bool readHeader(std::string graphFile, GraphFileHeader &header);
     bool containsVtx(unsigned gvid);
     bool containsSrcGhostVtx(unsigned gvid);
     bool containsDstGhostVtx(unsigned gvid);
@@ -76,142 +240,32 @@ public:
     unsigned long long localOutEdgeCnt = 0;
     unsigned long long globalEdgeCnt = 0;
     // local vertices
-    std::vector<unsigned> localToGlobalId;
-    std::map<unsigned, unsigned> globaltoLocalId;
-    std::vector<EdgeType> vtxDataVec;
+    ArrayView<unsigned> localToGlobalId;
+    SortedIdMap globaltoLocalId;
+    ArrayView<EdgeType> vtxDataVec;
+    // local vertex order; reorderedIds[i] is the local ID of the partition's
+    // i-th vertex in global ID order
+    ReorderType reorder = REORDER_NONE;
+    ArrayView<unsigned> reorderedIds;
     // local vertex outgoing destinations
-    std::vector<std::vector<unsigned>> forwardLocalVtxDsts;
-    std::vector<std::vector<unsigned>> backwardLocalVtxDsts;
+    std::vector<ArrayView<unsigned>> forwardLocalVtxDsts;
+    std::vector<ArrayView<unsigned>> backwardLocalVtxDsts;
 
     // Outoing dests for pipelining
-    std::map<unsigned, std::vector<unsigned>> forwardGhostMap;
-    std::map<unsigned, std::vector<unsigned>> backwardGhostMap;
+    VertexNodesMap forwardGhostMap;
+    VertexNodesMap backwardGhostMap;
 
     // incoming edge ghost vertices
-    std::map<unsigned, unsigned> srcGhostVtcs;
-    // std::vector<unsigned> srcGhostDataVec;
+    SortedIdMap srcGhostVtcs;
     // outgoing edge ghost vertices
-    std::map<unsigned, unsigned> dstGhostVtcs;
-    // std::vector<unsigned> dstGhostDataVec;
+    SortedIdMap dstGhostVtcs;
     // ajacency matrices
     CSCMatrix<EdgeType> forwardAdj;
     CSRMatrix<EdgeType> backwardAdj;
-};
-
-class RawGraph {
-public:
-
-    std::vector<Vertex>& getVertices() { return vertices; }
-    Vertex& getVertex(unsigned lvid);
-    Vertex& getVertexByGlobal(unsigned gvid);
-    bool containsVertex(unsigned gvid);   // Contain searches with global ID.
-
-    std::map<unsigned, GhostVertex>& getInEdgeGhostVertices()  { return inEdgeGhostVertices; }
-    std::map<unsigned, GhostVertex>& getOutEdgeGhostVertices() { return outEdgeGhostVertices; }
-    GhostVertex& getInEdgeGhostVertex(unsigned gvid);
-    GhostVertex& getOutEdgeGhostVertex(unsigned gvid);
-    bool containsInEdgeGhostVertex(unsigned gvid);
-    bool containsOutEdgeGhostVertex(unsigned gvid);
-
-    unsigned getNumLocalVertices() { return numLocalVertices; }
-    void setNumLocalVertices(unsigned num) { numLocalVertices = num; }
-    unsigned getNumGlobalVertices() { return numGlobalVertices; }
-    void setNumGlobalVertices(unsigned num) { numGlobalVertices = num; }
-    unsigned getNumInEdgeGhostVertices()  { return numInEdgeGhostVertices; }
-    unsigned getNumOutEdgeGhostVertices() { return numOutEdgeGhostVertices; }
-    void setNumInEdgeGhostVertices(unsigned num)  { numInEdgeGhostVertices = num; }
-    void setNumOutEdgeGhostVertices(unsigned num) { numOutEdgeGhostVertices = num; }
-
-    unsigned long long getNumLocalInEdges() { return numLocalInEdges; }
-    void incrementNumLocalInEdges() { ++numLocalInEdges; }
-    unsigned long long getNumLocalOutEdges() { return numLocalOutEdges; }
-    void incrementNumLocalOutEdges() { ++numLocalOutEdges; }
-    unsigned long long getNumGlobalEdges() { return numGlobalEdges; }
-    void incrementNumGlobalEdges() { ++numGlobalEdges; }
-
-    short getVertexPartitionId(unsigned vid) { return vertexPartitionIds[vid]; }
-    void appendVertexPartitionId(short pid) { vertexPartitionIds.push_back(pid); }
-
-    void compactGraph();
-    void dump(std::string filename, unsigned numNodes);
-
-    std::map<unsigned, unsigned> globalToLocalId;
-    std::map<unsigned, unsigned> localToGlobalId;
-
-    std::vector<unsigned> *forwardGhostsList;
-    std::vector<unsigned> *backwardGhostsList;
-
-    CSCMatrix<EdgeType> forwardAdj;
-    CSRMatrix<EdgeType> backwardAdj;
 
 private:
-
-    std::vector<Vertex> vertices;
-    std::map<unsigned, GhostVertex> inEdgeGhostVertices;
-    std::map<unsigned, GhostVertex> outEdgeGhostVertices;
-
-    unsigned numLocalVertices;
-    unsigned numGlobalVertices;
-    unsigned numInEdgeGhostVertices;
-    unsigned numOutEdgeGhostVertices;
-
-    // Local Edge: the src vertex locates on the local machine.
-    unsigned long long numLocalInEdges = 0;
-    unsigned long long numLocalOutEdges = 0;
-    unsigned long long numGlobalEdges = 0;
-
-    std::vector<short> vertexPartitionIds;
+    void *mapAddr;
+    size_t mapSize;
 };
 
-
-template<typename T>
-void CSCMatrix<T>::init(RawGraph &rgraph) {
-    columnCnt = rgraph.getNumLocalVertices();
-    nnz = rgraph.getNumLocalInEdges();
-
-    values = new T[nnz];
-    locations = new char[nnz];
-    columnPtrs = new unsigned long long[columnCnt + 1];
-    rowIdxs = new unsigned [nnz];
-
-    columnPtrs[0] = 0;
-    unsigned long long edgItr = 0;
-    for (unsigned lvid = 0; lvid < columnCnt; ++lvid) {
-        Vertex &v = rgraph.getVertex(lvid);
-        const unsigned edgsCnt = v.getNumInEdges();
-        columnPtrs[lvid + 1] = columnPtrs[lvid] + edgsCnt;
-        for (unsigned veItr = 0; veItr < edgsCnt; ++veItr) {
-            InEdge &vie = v.getInEdge(veItr);
-            values[edgItr] = static_cast<T>(vie.getData());
-            rowIdxs[edgItr] = v.getSourceVertexLocalId(veItr);
-            ++edgItr;
-        }
-    }
-}
-
-template<typename T>
-void CSRMatrix<T>::init(RawGraph &rgraph) {
-    rowCnt = rgraph.getNumLocalVertices();
-    nnz = rgraph.getNumLocalOutEdges();
-
-    values = new T[nnz];
-    locations = new char[nnz];
-    rowPtrs = new unsigned long long[rowCnt + 1];
-    columnIdxs = new unsigned[nnz];
-
-    rowPtrs[0] = 0;
-    unsigned long long edgItr = 0;
-    for (unsigned lvid = 0; lvid < rowCnt; ++lvid) {
-        Vertex &v = rgraph.getVertex(lvid);
-        const unsigned edgsCnt = v.getNumOutEdges();
-        rowPtrs[lvid + 1] = rowPtrs[lvid] + edgsCnt;
-        for (unsigned veItr = 0; veItr < edgsCnt; ++veItr) {
-            OutEdge &voe = v.getOutEdge(veItr);
-            values[edgItr] = static_cast<T>(voe.getData());
-            columnIdxs[edgItr] = v.getDestVertexLocalId(veItr);
-            ++edgItr;
-        }
-    }
-}
-
 #endif //__GRAPH_HPP__
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include "reorder.hpp"
+
+
+/** Gorder window: a vertex is placed next to the last GORDER_WINDOW ones. */
+#define GORDER_WINDOW 5
+
+static const unsigned NO_VTX = (unsigned)-1;
+
+
+ReorderType
+parseReorderType(const std::string &name) {
+    if (name == "none")   return REORDER_NONE;
+    if (name == "degree") return REORDER_DEGREE;
+    if (name == "rcm")    return REORDER_RCM;
+    if (name == "gorder") return REORDER_GORDER;
+    return (ReorderType)-1;
+}
+
+const char *
+reorderTypeName(ReorderType type) {
+    switch (type) {
+        case REORDER_NONE:   return "none";
+        case REORDER_DEGREE: return "degree";
+        case REORDER_RCM:    return "rcm";
+        case REORDER_GORDER: return "gorder";
+    }
+    return "unknown";
+}
+
+
+/**
+ *
+ * Vertices bucketed by an integer score, supporting O(1) increment,
+ * decrement and pop-max. This is the priority queue Gorder is built on:
+ * scores only ever move by one.
+ *
+ */
+class UnitHeap {
+public:
+    UnitHeap(unsigned n) : key(n, 0), prev(n, NO_VTX), next(n, NO_VTX),
+                           removed(n, false), head(1, NO_VTX), top(0) { }
+
+    // Append v to the score-0 bucket. The last vertex pushed pops first.
+    void push(unsigned v) { link(v); }
+
+    void remove(unsigned v) {
+        unlink(v);
+        removed[v] = true;
+    }
+
+    void increment(unsigned v) {
+        if (removed[v]) return;
+        unlink(v);
+        if (++key[v] >= head.size()) {
+            head.push_back(NO_VTX);
+        }
+        link(v);
+        top = std::max(top, key[v]);
+    }
+
+    void decrement(unsigned v) {
+        if (removed[v]) return;
+        assert(key[v] > 0);
+        unlink(v);
+        --key[v];
+        link(v);
+    }
+
+    unsigned popMax() {
+        while (top > 0 && head[top] == NO_VTX) {
+            --top;
+        }
+        unsigned v = head[top];
+        if (v != NO_VTX) {
+            remove(v);
+        }
+        return v;
+    }
+
+private:
+    void link(unsigned v) {
+        unsigned first = head[key[v]];
+        prev[v] = NO_VTX;
+        next[v] = first;
+        if (first != NO_VTX) {
+            prev[first] = v;
+        }
+        head[key[v]] = v;
+    }
+
+    void unlink(unsigned v) {
+        if (prev[v] != NO_VTX) {
+            next[prev[v]] = next[v];
+        } else {
+            head[key[v]] = next[v];
+        }
+        if (next[v] != NO_VTX) {
+            prev[next[v]] = prev[v];
+        }
+    }
+
+    std::vector<unsigned> key;
+    std::vector<unsigned> prev;
+    std::vector<unsigned> next;
+    std::vector<bool> removed;
+    std::vector<unsigned> head;     // first vertex of each score bucket
+    unsigned top;                   // upper bound on the highest score
+};
+
+
+/**
+ *
+ * Hub sorting: vertices in descending degree, ties kept in original order.
+ * Packs the rows gathered most often into a dense prefix.
+ *
+ */
+static std::vector<unsigned>
+degreeOrder(unsigned vtxCnt, const std::vector<unsigned long long> &ptrs) {
+    std::vector<unsigned> order(vtxCnt);
+    for (unsigned v = 0; v < vtxCnt; ++v) {
+        order[v] = v;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+        return ptrs[a + 1] - ptrs[a] > ptrs[b + 1] - ptrs[b];
+    });
+    return order;
+}
+
+/**
+ *
+ * Reverse Cuthill-McKee: BFS from a minimum-degree vertex of every component,
+ * visiting each frontier in ascending degree, then reversed. Keeps neighbors
+ * within a small bandwidth of each other.
+ *
+ */
+static std::vector<unsigned>
+rcmOrder(unsigned vtxCnt, const std::vector<unsigned long long> &ptrs,
+         const std::vector<unsigned> &nbrs) {
+    auto byDegree = [&](unsigned a, unsigned b) {
+        unsigned long long degA = ptrs[a + 1] - ptrs[a];
+        unsigned long long degB = ptrs[b + 1] - ptrs[b];
+        return degA < degB || (degA == degB && a < b);
+    };
+
+    std::vector<unsigned> starts(vtxCnt);
+    for (unsigned v = 0; v < vtxCnt; ++v) {
+        starts[v] = v;
+    }
+    std::sort(starts.begin(), starts.end(), byDegree);
+
+    std::vector<unsigned> order;
+    order.reserve(vtxCnt);
+    std::vector<bool> visited(vtxCnt, false);
+    for (unsigned s : starts) {
+        if (visited[s]) {
+            continue;
+        }
+        visited[s] = true;
+        order.push_back(s);
+        // order doubles as the BFS queue.
+        for (unsigned h = order.size() - 1; h < order.size(); ++h) {
+            unsigned v = order[h];
+            unsigned frontier = order.size();
+            for (unsigned long long e = ptrs[v]; e < ptrs[v + 1]; ++e) {
+                unsigned u = nbrs[e];
+                if (!visited[u]) {
+                    visited[u] = true;
+                    order.push_back(u);
+                }
+            }
+            std::sort(order.begin() + frontier, order.end(), byDegree);
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+/**
+ *
+ * Gorder: greedily place next the vertex sharing the most edges and common
+ * neighbors with the last GORDER_WINDOW placed vertices. Neighbor lists of
+ * vertices above sqrt(vtxCnt) degree are not expanded for common neighbors,
+ * which bounds the cost on power-law graphs.
+ *
+ */
+static std::vector<unsigned>
+gorderOrder(unsigned vtxCnt, const std::vector<unsigned long long> &ptrs,
+            const std::vector<unsigned> &nbrs) {
+    std::vector<unsigned> order;
+    if (vtxCnt == 0) {
+        return order;
+    }
+    order.reserve(vtxCnt);
+    const unsigned long long hubDegree = std::max(16u, (unsigned)std::sqrt((double)vtxCnt));
+
+    // Seed the score-0 bucket so that unconnected picks favour high degree.
+    std::vector<unsigned> byDegree = degreeOrder(vtxCnt, ptrs);
+    UnitHeap heap(vtxCnt);
+    for (auto it = byDegree.rbegin(); it != byDegree.rend(); ++it) {
+        heap.push(*it);
+    }
+
+    auto update = [&](unsigned v, bool enter) {
+        for (unsigned long long e = ptrs[v]; e < ptrs[v + 1]; ++e) {
+            unsigned u = nbrs[e];
+            enter ? heap.increment(u) : heap.decrement(u);
+            if (ptrs[u + 1] - ptrs[u] > hubDegree) {
+                continue;
+            }
+            for (unsigned long long f = ptrs[u]; f < ptrs[u + 1]; ++f) {
+                unsigned w = nbrs[f];
+                if (w != v) {
+                    enter ? heap.increment(w) : heap.decrement(w);
+                }
+            }
+        }
+    };
+
+    while (order.size() < vtxCnt) {
+        if (order.size() > GORDER_WINDOW) {
+            update(order[order.size() - 1 - GORDER_WINDOW], false);
+        }
+        unsigned v = heap.popMax();
+        assert(v != NO_VTX);
+        order.push_back(v);
+        update(v, true);
+    }
+    return order;
+}
+
+
+std::vector<unsigned>
+computeVertexOrder(ReorderType type, unsigned vtxCnt,
+                   const std::vector<unsigned long long> &ptrs,
+                   const std::vector<unsigned> &nbrs) {
+    assert(ptrs.size() == vtxCnt + 1);
+
+    std::vector<unsigned> order;
+    switch (type) {
+        case REORDER_DEGREE:
+            order = degreeOrder(vtxCnt, ptrs);
+            break;
+        case REORDER_RCM:
+            order = rcmOrder(vtxCnt, ptrs, nbrs);
+            break;
+        case REORDER_GORDER:
+            order = gorderOrder(vtxCnt, ptrs, nbrs);
+            break;
+        default:
+            order.resize(vtxCnt);
+            for (unsigned v = 0; v < vtxCnt; ++v) {
+                order[v] = v;
+            }
+    }
+
+    // order lists old IDs by new position; invert it.
+    std::vector<unsigned> newId(vtxCnt);
+    for (unsigned i = 0; i < vtxCnt; ++i) {
+        newId[order[i]] = i;
+    }
+    return newId;
+}
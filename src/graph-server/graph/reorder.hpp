@@ -0,0 +1,28 @@
+#ifndef __REORDER_HPP__
+#define __REORDER_HPP__
+
+
+#include <string>
+#include <vector>
+
+
+/** Local vertex orderings applied during preprocessing. */
+enum ReorderType { REORDER_NONE, REORDER_DEGREE, REORDER_RCM, REORDER_GORDER };
+
+ReorderType parseReorderType(const std::string &name);
+const char *reorderTypeName(ReorderType type);
+
+/**
+ *
+ * Compute a locality-improving order of a partition's local vertices.
+ * ptrs / nbrs hold each local vertex's local neighbors (in and out edges,
+ * ghosts excluded), CSR style. Returns newId, where newId[old] is the new
+ * local ID of vertex old.
+ *
+ */
+std::vector<unsigned> computeVertexOrder(ReorderType type, unsigned vtxCnt,
+                                         const std::vector<unsigned long long> &ptrs,
+                                         const std::vector<unsigned> &nbrs);
+
+
+#endif // __REORDER_HPP__
@@ -0,0 +1,185 @@
+#include <unistd.h>
+#include <algorithm>
+#include "executor.hpp"
+
+
+// Executor and worker id of the calling thread, if it is a worker.
+static thread_local Executor *currExecutor = NULL;
+static thread_local unsigned currWorker = 0;
+
+
+/**
+ *
+ * Start nThreads workers taking root work from src.
+ *
+ */
+void
+Executor::start(unsigned nThreads, Source src, bool _poll) {
+    source = src;
+    poll = _poll;
+    halt = false;
+    for (unsigned i = 0; i < nThreads; ++i) {
+        workers.push_back(new Worker);
+        workers.back()->lk.init();
+    }
+    for (unsigned i = 0; i < nThreads; ++i)
+        threads.push_back(std::thread(&Executor::workerLoop, this, i));
+}
+
+
+/**
+ *
+ * Stop and join the workers. Tasks still queued are dropped.
+ *
+ */
+void
+Executor::stop() {
+    halt = true;
+    signal.ring();
+    for (std::thread &t : threads)
+        t.join();
+    threads.clear();
+
+    for (Worker *w : workers) {
+        w->lk.destroy();
+        delete w;
+    }
+    workers.clear();
+}
+
+
+/**
+ *
+ * Wait for every source() call in progress to return. The source must
+ * already refuse new work, e.g. because the pipeline halted.
+ *
+ */
+void
+Executor::drain() {
+    while (__atomic_load_n(&inSource, __ATOMIC_SEQ_CST))
+        usleep(StageSignal::PARK_US);
+}
+
+
+unsigned long long
+Executor::grain(unsigned long long n, unsigned long long minGrain) const {
+    const unsigned TASKS_PER_WORKER = 4;
+    unsigned long long tasks = TASKS_PER_WORKER * std::max(numWorkers(), 1u);
+    return std::max((n + tasks - 1) / tasks, minGrain);
+}
+
+
+/**
+ *
+ * Split [begin, end) into stealable tasks on the caller's deque (worker 0's
+ * if the caller is not a worker) and help until every one has run.
+ *
+ */
+void
+Executor::parallelFor(unsigned begin, unsigned end, unsigned grain,
+                      const std::function<void(unsigned, unsigned)> &body) {
+    if (end <= begin)
+        return;
+    grain = std::max(grain, 1u);
+    unsigned numTasks = (end - begin + grain - 1) / grain;
+    if (numTasks == 1 || workers.empty()) {
+        body(begin, end);
+        return;
+    }
+
+    int wid = myWorker();
+    unsigned remaining = numTasks - 1;
+    Worker &home = *workers[wid < 0 ? 0 : wid];
+    home.lk.lock();
+    for (unsigned t = 1; t < numTasks; ++t) {
+        unsigned lo = begin + t * grain;
+        unsigned hi = std::min(lo + grain, end);
+        home.tasks.push_back([&body, &remaining, lo, hi]() {
+            body(lo, hi);
+            __atomic_sub_fetch(&remaining, 1, __ATOMIC_SEQ_CST);
+        });
+    }
+    home.lk.unlock();
+    signal.ring();
+
+    body(begin, std::min(begin + grain, end));
+    while (__atomic_load_n(&remaining, __ATOMIC_SEQ_CST)) {
+        if (!runTask(wid)) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+    }
+}
+
+
+int
+Executor::myWorker() {
+    return currExecutor == this ? (int)currWorker : -1;
+}
+
+
+/**
+ *
+ * Run one task: the newest of our own, else the oldest of another worker's.
+ *
+ */
+bool
+Executor::runTask(int wid) {
+    Task task;
+    if (wid >= 0) {
+        Worker &w = *workers[wid];
+        w.lk.lock();
+        if (!w.tasks.empty()) {
+            task = std::move(w.tasks.back());
+            w.tasks.pop_back();
+        }
+        w.lk.unlock();
+    }
+
+    unsigned n = workers.size();
+    unsigned first = wid < 0 ? 0 : wid + 1;
+    for (unsigned i = 0; !task && i < n; ++i) {
+        unsigned victim = (first + i) % n;
+        if ((int)victim == wid)
+            continue;
+        Worker &v = *workers[victim];
+        v.lk.lock();
+        if (!v.tasks.empty()) {
+            task = std::move(v.tasks.front());
+            v.tasks.pop_front();
+        }
+        v.lk.unlock();
+    }
+
+    if (!task)
+        return false;
+    task();
+    return true;
+}
+
+
+void
+Executor::workerLoop(unsigned wid) {
+    currExecutor = this;
+    currWorker = wid;
+
+    StageWaiter waiter(signal, poll);
+    while (!halt) {
+        waiter.arm();
+        if (runTask(wid)) {
+            waiter.reset();
+            continue;
+        }
+
+        __atomic_add_fetch(&inSource, 1, __ATOMIC_SEQ_CST);
+        bool ran = !halt && source && source(wid);
+        __atomic_sub_fetch(&inSource, 1, __ATOMIC_SEQ_CST);
+        if (ran) {
+            waiter.reset();
+            continue;
+        }
+
+        waiter.wait();
+    }
+}
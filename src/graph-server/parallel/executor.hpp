@@ -0,0 +1,69 @@
+#ifndef __EXECUTOR_HPP__
+#define __EXECUTOR_HPP__
+
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <functional>
+#include "lock.hpp"
+#include "signal.hpp"
+
+
+/**
+ *
+ * Work-stealing executor shared by the compute stages of a node. Each
+ * worker owns a deque of tasks: it pushes and pops at the back, idle
+ * workers steal from the front. With no task left anywhere a worker asks
+ * the source for root work (a whole chunk stage), and parks on the signal
+ * when there is none either.
+ *
+ */
+class Executor {
+
+public:
+
+    typedef std::function<void()> Task;
+    // Run one unit of root work on worker `wid`; false if there was none.
+    typedef std::function<bool(unsigned)> Source;
+
+    void start(unsigned nThreads, Source src, bool poll = false);
+    void stop();
+    void drain();
+
+    // Root work became available.
+    void notify() { signal.ring(); }
+    StageSignal &getSignal() { return signal; }
+    unsigned numWorkers() const { return workers.size(); }
+    // Iterations (or other work units) per task for n of them, a few tasks
+    // per worker.
+    unsigned long long grain(unsigned long long n,
+                             unsigned long long minGrain = 64) const;
+
+    // Run body(lo, hi) over [begin, end) in grain-sized stealable tasks.
+    // The caller runs tasks too until all are done.
+    void parallelFor(unsigned begin, unsigned end, unsigned grain,
+                     const std::function<void(unsigned, unsigned)> &body);
+
+private:
+
+    struct Worker {
+        Lock lk;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<Worker *> workers;
+    std::vector<std::thread> threads;
+    Source source;
+    StageSignal signal;
+    bool poll = false;
+    bool halt = false;
+    unsigned inSource = 0;  // workers inside source(), see drain()
+
+    int myWorker();
+    bool runTask(int wid);
+    void workerLoop(unsigned wid);
+};
+
+
+#endif //__EXECUTOR_HPP__
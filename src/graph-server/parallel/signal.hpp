@@ -0,0 +1,82 @@
+#ifndef __SIGNAL_HPP__
+#define __SIGNAL_HPP__
+
+
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "../../common/utils.hpp"
+
+
+/**
+ *
+ * Wakeup shared by the queues one pipeline stage pulls from. Pushers ring
+ * it; an idle stage thread spins briefly, then parks until the next ring
+ * instead of sleeping a fixed backoff period. Read a ticket before checking
+ * the queues and wait on it, so a push in between is never missed. Parking
+ * is bounded by PARK_US so conditions not tied to a push (halting, epoch
+ * updates from peers) are still rechecked.
+ *
+ */
+class StageSignal {
+public:
+    static const unsigned SPIN_ROUNDS = 256;
+    static const unsigned PARK_US = 1024;
+
+    unsigned ticket() const { return __atomic_load_n(&seq, __ATOMIC_SEQ_CST); }
+    void ring() {
+        __atomic_add_fetch(&seq, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&sleepers, __ATOMIC_SEQ_CST)) {
+            std::lock_guard<std::mutex> guard(mtx);
+            cv.notify_all();
+        }
+    }
+    void wait(unsigned t) {
+        for (unsigned i = 0; i < SPIN_ROUNDS; ++i) {
+            if (ticket() != t)
+                return;
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+        std::unique_lock<std::mutex> ul(mtx);
+        __atomic_add_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+        if (ticket() == t)
+            cv.wait_for(ul, std::chrono::microseconds(PARK_US));
+        __atomic_sub_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+    }
+private:
+    unsigned seq = 0;
+    unsigned sleepers = 0;
+    std::mutex mtx;
+    std::condition_variable cv;
+};
+
+
+/**
+ *
+ * Per-thread idle strategy of a stage loop: park on the stage's signal, or
+ * with `poll` the old BackoffSleeper polling, kept to compare hop latency.
+ *
+ */
+class StageWaiter {
+public:
+    StageWaiter(StageSignal &_sig, bool _poll) : sig(_sig), poll(_poll) {}
+
+    void arm() { t = sig.ticket(); }
+    void wait() {
+        if (poll)
+            bs.sleep();
+        else
+            sig.wait(t);
+    }
+    void reset() { bs.reset(); }
+private:
+    StageSignal &sig;
+    bool poll;
+    unsigned t = 0;
+    BackoffSleeper bs;
+};
+
+
+#endif //__SIGNAL_HPP__
@@ -19,9 +19,7 @@
 #include "../../common/utils.hpp"
 
 
-#define MAX_IDTYPE UINT_MAX     // Limit: MAX_IDTYPE must be at least two times the number of global vertices.
-                                // From 0 to numGlobalVertices are normal ghost vertices update message,
-                                // From MAX_IDTYPE downto MAX_IDTYPE - numGlobalVertices are receive signals.
+#define MAX_IDTYPE UINT_MAX     // Limit: MAX_IDTYPE must be larger than the number of global vertices.
 
 typedef std::priority_queue< Chunk > ChunkQueue;
 
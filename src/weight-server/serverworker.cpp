@@ -111,11 +111,12 @@ void ServerWorker::work() {
                     recvTensors(workersocket, identity, chunk);
                     break;
                 }
-                case (OP::PULL): {
+                case (OP::PULL):
+                case (OP::PULLSHM): {
                     Chunk chunk;
                     memcpy(&chunk, (char *)header.data() + sizeof(OP), sizeof(Chunk));
                     std::cout << "Calling sendTensors " << std::endl;
-                    sendTensors(workersocket, identity, chunk);
+                    sendTensors(workersocket, identity, chunk, op == OP::PULLSHM);
                     break;
                 }
                 case (OP::EVAL): {
@@ -146,7 +147,7 @@ void ServerWorker::work() {
 }
 
 
-void ServerWorker::sendTensors(zmq::socket_t& socket, zmq::message_t& client_id, Chunk &chunk) {
+void ServerWorker::sendTensors(zmq::socket_t& socket, zmq::message_t& client_id, Chunk &chunk, bool shm) {
     if (ws.BLOCK && chunk.dir == PROP_TYPE::FORWARD && chunk.epoch * 2 > ws.epoch) {
         while (chunk.epoch * 2 > ws.epoch) {
             usleep(50 * 1000); // sleep 50ms
@@ -177,7 +178,7 @@ void ServerWorker::sendTensors(zmq::socket_t& socket, zmq::message_t& client_id,
         } else {
             Matrix& reqMatrix = found->second.getMat(chunk);
             // std::cout << "Calling sendTensor" << std::endl;
-            sendTensor(socket, reqMatrix, more);
+            sendTensor(socket, reqMatrix, more, chunk, shm);
         }
     }
 }
@@ -205,12 +206,18 @@ void ServerWorker::recvEvalData(zmq::socket_t& socket, zmq::message_t& client_id
     ws.updateLocalAccLoss(chunk, acc, loss);
 }
 
-void ServerWorker::sendTensor(zmq::socket_t& socket, Matrix& tensor, unsigned& more) {
+void ServerWorker::sendTensor(zmq::socket_t& socket, Matrix& tensor, unsigned& more, Chunk &chunk, bool shm) {
+    unsigned bufSize = tensor.getRows() * tensor.getCols() * sizeof(FeatType);
+    // A graph server on this host takes the data through its ring, and
+    // gets an empty data frame here.
+    bool ringed = shm && ws.pushToPullRing(chunk.globalId, tensor.getData(), bufSize);
+
     zmq::message_t responseHeader(TENSOR_HDR_SIZE);
-    populateHeader(responseHeader.data(), OP::PULL, tensor.name().c_str(),
+    populateHeader(responseHeader.data(), ringed ? OP::PULLSHM : OP::PULL, tensor.name().c_str(),
       tensor.getRows(), tensor.getCols());
-    unsigned bufSize = tensor.getRows() * tensor.getCols() * sizeof(FeatType);
-    zmq::message_t tensorData(tensor.getData(), bufSize, nofree, NULL);
+    zmq::message_t tensorData;
+    if (!ringed)
+        tensorData.rebuild(tensor.getData(), bufSize, nofree, NULL);
 
     // std::cout << "Sending tensor response header of size " << responseHeader.size() << std::endl;
     socket.send(responseHeader, ZMQ_SNDMORE);
@@ -42,8 +42,8 @@ public:
     void lambda_worker();
 
 private:
-    void sendTensor(zmq::socket_t& socket, Matrix& tensor, unsigned& more);
-    void sendTensors(zmq::socket_t& socket, zmq::message_t& client_id, Chunk &chunk);
+    void sendTensor(zmq::socket_t& socket, Matrix& tensor, unsigned& more, Chunk &chunk, bool shm);
+    void sendTensors(zmq::socket_t& socket, zmq::message_t& client_id, Chunk &chunk, bool shm = false);
 
     void recvUpdateTensor(zmq::socket_t& socket, Chunk &chunk, WeightTensorMap& weights);
     void recvTensors(zmq::socket_t& socket, zmq::message_t& client_id, Chunk &chunk);
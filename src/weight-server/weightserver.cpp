@@ -960,6 +960,36 @@ void WeightServer::closeSockets() {
     subscriber.setsockopt(ZMQ_LINGER, 0);
     subscriber.close();
     dataCtx.close();
+
+    for (auto &kv : pullRings) {
+        if (kv.second != NULL) {
+            kv.second->close();
+            delete kv.second;
+        }
+    }
+    pullRings.clear();
+}
+
+/**
+ *
+ * Copy pulled data into the ring of a graph server on this host, mapping the
+ * ring on its first pull. False if it has no ring we can map, or no room in
+ * it for the data; the data then goes over the socket.
+ *
+ */
+bool WeightServer::pushToPullRing(unsigned node, const void *data, unsigned long long len) {
+    std::lock_guard<std::mutex> lk(pullRingsMtx);
+    auto found = pullRings.find(node);
+    if (found == pullRings.end()) {
+        ShmRing *ring = new ShmRing;
+        if (!ring->open(weightRingName(listenerPort, node))) {
+            delete ring;
+            ring = NULL;
+        }
+        found = pullRings.insert(std::make_pair(node, ring)).first;
+    }
+    ShmRing *ring = found->second;
+    return ring != NULL && len <= ring->maxMsgSize() && ring->push(data, len);
 }
 
 void WeightServer::freeWeights() {
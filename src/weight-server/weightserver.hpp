@@ -24,6 +24,7 @@
 #include "AdamOptimizer.hpp"
 #include "weighttensor.hpp"
 #include "../common/matrix.hpp"
+#include "../common/shm_ring.hpp"
 #include "../common/utils.hpp"
 
 
@@ -159,6 +160,12 @@ public:
     zmq::socket_t subscriber;
     unsigned serverPort;
 
+    // Graph servers on this host take pulled data through their rings, by
+    // node ID; NULL for one whose ring cannot be mapped.
+    bool pushToPullRing(unsigned node, const void *data, unsigned long long len);
+    std::map<unsigned, ShmRing *> pullRings;
+    std::mutex pullRingsMtx;
+
     void createOutputFile(std::string &fileName);
     void closeOutputFile();
     std::ofstream outfile;